@@ -5,6 +5,6 @@ set -e
 make clean
 make erase
 make fuse
-make randbook
+make entropy-check
 make upload
 make clean
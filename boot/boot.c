@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Serial bootloader: CRC checked page stream on the console USART
+ *
+ * Runs from the boot section on every reset (BOOTRST). Waits for an
+ * update after power on, external reset, or a request from the
+ * application, otherwise starts the application immediately.
+ * EEPROM is untouched apart from the boot request word. The reset
+ * flags are cleared and passed to the application in BOOT_CAUSE.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include "system.h"
+#include "console.h"
+#include "boot.h"
+
+#define BOOT_WAIT	977U	// ~0.5s of timer1 counts after power on
+#define BOOT_IDLE	58594U	// ~30s of timer1 counts after request
+#define BOOT_GAP	20U	// ~10ms idle line ends a bad frame
+#define FRAMELEN	0x103U	// cmd, len, 255 bytes payload, crc
+
+static uint8_t frame[FRAMELEN];
+static uint8_t page[SPM_PAGESIZE];
+static uint8_t partial;
+static uint8_t sent;		// TXC0 will be set once output is done
+
+static void putch(uint8_t ch)
+{
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+	UCSR0A |= _BV(TXC0);
+	UDR0 = ch;
+	sent = 1U;
+}
+
+// Return received byte, or -1 when timer1 reaches limit
+static int16_t getch(uint16_t limit)
+{
+	while (!(UCSR0A & _BV(RXC0))) {
+		wdt_reset();
+		if (limit && TCNT1 >= limit) {
+			return -1;
+		}
+	}
+	return UDR0;
+}
+
+// Discard input until the line is idle
+static void drain(void)
+{
+	do {
+		TCNT1 = 0;
+	} while (getch(BOOT_GAP) >= 0);
+}
+
+static void start_app(void)
+{
+	if (sent) {
+		loop_until_bit_is_set(UCSR0A, TXC0);
+	}
+	// return USART0 and timer1 to reset values for the application
+	UCSR0B = 0;
+	UCSR0A = _BV(TXC0);
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+	UBRR0L = 0;
+	TCCR1B = 0;
+	TCNT1 = 0;
+	boot_rww_enable_safe();
+	wdt_reset();
+	((void (*)(void)) 0)();
+}
+
+// Read one frame, return payload length, or -1 on timeout or error
+static int16_t read_frame(uint16_t limit)
+{
+	uint16_t crc = 0xffffU;
+	uint16_t len = 2U;
+	uint16_t i;
+	int16_t ch;
+	for (i = 0; i < len + 2U; i++) {
+		ch = getch(i ? BOOT_WAIT : limit);
+		if (ch < 0) {
+			return i ? -2 : -1;
+		}
+		frame[i] = (uint8_t) ch;
+		if (i < len) {
+			crc = _crc_xmodem_update(crc, (uint8_t) ch);
+		}
+		if (i == 1U) {
+			len = (uint16_t) (2U + frame[1]);
+		}
+		if (i == 0) {
+			TCNT1 = 0;
+		}
+	}
+	if ((uint16_t) (frame[len] | (frame[len + 1U] << 8)) != crc) {
+		return -2;
+	}
+	return frame[1];
+}
+
+// Expand run-length tokens into page, return 1 if exactly one page
+static uint8_t expand(const uint8_t * src, uint8_t len)
+{
+	uint8_t out = 0;
+	uint8_t tok;
+	uint8_t count;
+	while (len) {
+		tok = *src++;
+		--len;
+		count = (uint8_t) ((tok & BOOT_COUNT) + 1U);
+		if (count > (uint8_t) (SPM_PAGESIZE - out)) {
+			return 0;
+		}
+		if (tok & BOOT_RUN) {
+			if (!len) {
+				return 0;
+			}
+			while (count--) {
+				page[out++] = *src;
+			}
+			++src;
+			--len;
+		} else {
+			if (count > len) {
+				return 0;
+			}
+			len = (uint8_t) (len - count);
+			while (count--) {
+				page[out++] = *src++;
+			}
+		}
+	}
+	return out == SPM_PAGESIZE;
+}
+
+// Erase, write and verify one application page
+static uint8_t write_page(uint8_t num)
+{
+	uint16_t addr = (uint16_t) (num * SPM_PAGESIZE);
+	uint8_t i;
+	if (num >= BOOT_PAGES) {
+		return 0;
+	}
+	if (!partial) {
+		// application is unusable until the stream completes
+		eeprom_update_word((uint16_t *) NVM_BOOT, BOOT_PARTIAL);
+		partial = 1U;
+	}
+	eeprom_busy_wait();
+	boot_page_erase(addr);
+	boot_spm_busy_wait();
+	for (i = 0; i < SPM_PAGESIZE; i += 2U) {
+		boot_page_fill(addr + i,
+			       (uint16_t) (page[i] | (page[i + 1U] << 8)));
+	}
+	boot_page_write(addr);
+	boot_spm_busy_wait();
+	boot_rww_enable();
+	for (i = 0; i < SPM_PAGESIZE; i++) {
+		if (pgm_read_byte(addr + i) != page[i]) {
+			return 0;
+		}
+	}
+	return 1U;
+}
+
+static uint16_t flash_crc(uint16_t len)
+{
+	uint16_t crc = 0xffffU;
+	uint16_t addr;
+	for (addr = 0; addr < len; addr++) {
+		crc = _crc_xmodem_update(crc, pgm_read_byte(addr));
+		wdt_reset();
+	}
+	return crc;
+}
+
+// Handle one frame, return reply status
+static uint8_t command(uint8_t len)
+{
+	uint8_t *payload = &frame[2];
+	uint8_t i;
+	uint16_t applen;
+	switch (frame[0]) {
+	case BOOT_INFO:
+		putch(BOOT_INFO);
+		putch(SPM_PAGESIZE);
+		putch(BOOT_PAGES);
+		return BOOT_VERSION;
+		break;
+	case BOOT_PAGE:
+		if (len != SPM_PAGESIZE + 1U) {
+			return BOOT_ERROR;
+		}
+		for (i = 0; i < SPM_PAGESIZE; i++) {
+			page[i] = payload[i + 1U];
+		}
+		return write_page(payload[0]) ? BOOT_OK : BOOT_ERROR;
+		break;
+	case BOOT_RLE:
+		if (!len || !expand(&payload[1], (uint8_t) (len - 1U))) {
+			return BOOT_ERROR;
+		}
+		return write_page(payload[0]) ? BOOT_OK : BOOT_ERROR;
+		break;
+	case BOOT_DONE:
+		applen = (uint16_t) (payload[0] | (payload[1] << 8));
+		if (len != 4U || applen > BOOT_START
+		    || flash_crc(applen) !=
+		    (uint16_t) (payload[2] | (payload[3] << 8))) {
+			return BOOT_ERROR;
+		}
+		eeprom_update_word((uint16_t *) NVM_BOOT, 0);
+		putch(BOOT_OK);
+		start_app();
+		break;
+	default:
+		break;
+	}
+	return BOOT_UNKNOWN;
+}
+
+void main(void)
+{
+	uint8_t cause = MCUSR;
+	uint16_t flag = eeprom_read_word((const uint16_t *) NVM_BOOT);
+	uint16_t limit = 0;
+	int16_t len;
+
+	// clear the flags so a watchdog reset here is not taken for
+	// power on again, and hand them to the application to report
+	MCUSR = 0;
+	BOOT_CAUSE = cause;
+	if (flag == BOOT_REQUEST) {
+		eeprom_update_word((uint16_t *) NVM_BOOT, 0);
+		limit = BOOT_IDLE;
+	} else if (flag == BOOT_PARTIAL || pgm_read_word(0) == 0xffffU) {
+		// no usable application, wait for an update indefinitely
+		partial = 1U;
+	} else if (cause & (_BV(PORF) | _BV(EXTRF))) {
+		limit = BOOT_WAIT;
+	} else {
+		start_app();
+	}
+
+	wdt_enable(WDTO_1S);
+	UBRR0L = (uint8_t) CONSOLE_UBRR;
+	UCSR0A = _BV(U2X0);
+	UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+	TCCR1B = _BV(CS12) | _BV(CS10);
+	TCNT1 = 0;
+
+	do {
+		len = read_frame(limit);
+		if (len == -1) {
+			if (!partial) {
+				start_app();
+			}
+		} else if (len < 0) {
+			drain();
+			putch(BOOT_ERROR);
+		} else {
+			putch(command((uint8_t) len));
+		}
+		TCNT1 = 0;
+	} while (1);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Battery state of charge and energy per feed estimate
+ */
+#ifndef BATTERY_H
+#define BATTERY_H
+#include <stdint.h>
+
+#define BATT_AH		100U	// battery capacity, Ah
+#define BATT_AMPS	10U	// nominal motor current, A
+#define BATT_VNOM	12U	// nominal battery voltage, V
+#define BATT_RESERVE	500U	// least charge left after a feed (0.1%)
+#define BATT_SETTLE	30000U	// 5 minutes off load before sampling rest
+#define BATT_LOADWAIT	200U	// 2s into a move before sampling load
+#define BATT_GAIN	4U	// rest and load filters take 1/16 per tick
+#define BATT_LEARN	2U	// learn 1/4 of each sag and feed error
+
+// Battery figures, shared by all hoists
+struct battery {
+	uint16_t rest;		// settled voltage with all motors off, mV
+	uint16_t load;		// voltage under motor load, mV, 0 if unknown
+	uint16_t sag;		// learned drop from rest under load, mV
+	uint16_t quiet;		// ticks since a motor ran, saturating
+	uint16_t running;	// ticks since a motor started, saturating
+};
+
+extern struct battery battery;
+
+// Seed rest voltage from the current conversion
+void battery_init(void);
+
+// Sample battery and integrate motor energy, once per tick
+void battery_update(void);
+
+// State of charge from rest voltage (0.1%)
+uint16_t battery_charge(void);
+
+// Internal resistance at nominal motor current, mOhm
+uint16_t battery_resist(void);
+
+// Energy of a full feed by the selected hoist, V.s
+uint16_t battery_feed(void);
+
+// Predicted state of charge after a full feed and retract (0.1%)
+uint16_t battery_after(void);
+
+// Return 1 if the selected hoist may begin a feed
+uint8_t battery_admit(void);
+
+// Selected hoist begins a feed, restart its energy count
+void battery_feed_start(void);
+
+// Selected hoist has returned home, learn energy used by its feed
+void battery_feed_end(void);
+
+#endif // BATTERY_H
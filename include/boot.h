@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Serial bootloader protocol, shared with the application
+ *
+ * Frames on the console USART: cmd, len, payload[len], crc16 (LSB
+ * first), CRC-16/CCITT (0x1021, init 0xffff) over cmd, len & payload.
+ * Each frame is answered with one status byte, except info.
+ */
+#ifndef BOOT_H
+#define BOOT_H
+
+// Boot request word at NVM_BOOT
+#define BOOT_REQUEST	0xb001U	// wait for an update after reset
+#define BOOT_PARTIAL	0xb0ffU	// update incomplete, remain in bootloader
+
+// MCUSR flags passed from the bootloader, cleared by the application
+// before it is used as the console receive index
+#define BOOT_CAUSE	GPIOR1
+
+// Protocol
+#define BOOT_VERSION	1U
+#define BOOT_INFO	0x49	// 'I': reply I, page size, app pages, version
+#define BOOT_PAGE	0x50	// 'P': page number, page data
+#define BOOT_RLE	0x5a	// 'Z': page number, run-length coded data
+#define BOOT_DONE	0x44	// 'D': length, crc16 of app flash, then start
+#define BOOT_OK		0x2e	// '.'
+#define BOOT_ERROR	0x21	// '!': bad crc, page or write, resend
+#define BOOT_UNKNOWN	0x3f	// '?'
+
+// Run-length tokens: 0x80|n repeats the next byte n+1 times,
+// otherwise copy the next n+1 literal bytes
+#define BOOT_RUN	0x80U
+#define BOOT_COUNT	0x7fU
+
+// Application flash below the boot section, BOOT_START from Makefile
+#define BOOT_PAGES	((uint8_t) (BOOT_START / SPM_PAGESIZE))
+
+#endif // BOOT_H
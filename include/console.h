@@ -6,6 +6,11 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+// Baud rate divisor with U2X0, shared with the bootloader
+#define CONSOLE_UBRR	((F_CPU + 4UL * CONSOLE_BAUD) / (8UL * CONSOLE_BAUD) - 1UL)
+
+// Message arguments are strings in program space, see PSTR()
+
 // Console event types
 enum event_type {
 	event_none,		// No new event
@@ -17,6 +22,12 @@ enum event_type {
 	event_down,		// Request to lower
 	event_up,		// Request to raise
 	event_auth,		// PIN OK
+	event_telemetry,	// Request controller telemetry
+	event_calibrate,	// Request travel calibration run
+	event_bootload,		// Request restart into the bootloader
+	event_battery,		// Request battery estimate
+	event_wear,		// Request wear counters
+	event_inputs,		// Request input filters and bounce counts
 };
 
 // Console event structure
@@ -29,24 +40,56 @@ struct console_event {
 // Clear the read buffer
 void console_flush(void);
 
-// Poll for new console event
-void console_read(struct console_event *event);
+// Wait until all queued output has been sent
+void console_drain(void);
+
+// Parse all received input into the console event queue
+void console_read(void);
 
-// Write string and decimal value to console
+// Fetch next queued console event, return 0 if queue is empty
+uint8_t console_next(struct console_event *event);
+
+// Write flash string and decimal value to console
 void console_showval(const char *message, uint16_t value);
 
 // Output current machine state and voltage
 void console_showstate(uint8_t state, uint8_t error, uint8_t vsense);
 
+// Write flash string and 32 bit decimal value to console
+void console_showlong(const char *message, uint32_t value);
+
+// Show list of space separated decimal values
+void console_showvals(const char *message, const uint16_t *vals, uint8_t len);
+
 // Show buffer as hex values
 void console_showhex(const char *message, uint8_t * buf, uint8_t len);
 
 // Show ascii string with max length
 void console_showascii(const char *message, uint8_t * buf, uint8_t len);
 
-// Write null-terminated message to console
+// Write null-terminated flash string to console
 void console_write(const char *message);
 
+// Return 1 while a frame is being received, held or answered
+uint8_t console_busy(void);
+
+// Switch UART between text console and framed binary mode with
+// character timing, pending output is sent first
+void console_framed(uint8_t enable);
+
+// Copy the next complete received frame to buf, return its length or
+// 0 if none is ready, frames longer than len are discarded
+uint8_t console_frame(uint8_t *buf, uint8_t len);
+
+// Queue a binary frame for output, regardless of the console state
+void console_send(const uint8_t *buf, uint8_t len);
+
+// Return count of free event queue slots
+uint8_t console_room(void);
+
+// Queue an event from another input source, return 0 if queue is full
+uint8_t console_post(const struct console_event *event);
+
 // Initialise serial device and prepare buffers
 void console_init(void);
 
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Entropy collector for PRNG seeding, without EEPROM state
+ */
+#ifndef ENTROPY_H
+#define ENTROPY_H
+#include <stdint.h>
+#include <avr/io.h>
+
+// Health test cutoffs for an assessed 0.5 bit/sample (SP 800-90B 4.4)
+#define ENTROPY_RCT	41U	// repetition count: 1 + 20 / H
+#define ENTROPY_APTWIN	512U	// adaptive proportion window
+#define ENTROPY_APT	410U	// adaptive proportion cutoff
+
+// Credit one bit per 4 passing samples, half the assessed rate
+#define ENTROPY_SAMPLES	4U
+#define ENTROPY_SEEDBITS	32U
+#define ENTROPY_SEEDLEN	(ENTROPY_SEEDBITS * ENTROPY_SAMPLES)
+#define ENTROPY_STARTUP	1024U	// startup test samples, ~0.2s of conversions
+
+// Health test failures since boot
+#define ENTROPY_FAILRCT	0x01
+#define ENTROPY_FAILAPT	0x02
+
+extern uint8_t entropy_status;
+
+// Timer1 low byte at asynchronous events, folded in by entropy_poll
+extern volatile uint8_t entropy_jitter;
+
+static inline void entropy_event(void)
+{
+	uint8_t j = entropy_jitter;
+	entropy_jitter = (uint8_t) ((j << 1 | j >> 7) ^ TCNT1L);
+}
+
+// Start timestamp timer, collect ADC noise and seed PRNG
+void entropy_init(void);
+
+// Mix idle ADC noise and event jitter, reseed PRNG when credited
+void entropy_poll(void);
+
+#endif // ENTROPY_H
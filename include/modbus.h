@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Modbus RTU slave on the console UART, Refer: README.md Modbus
+ */
+#ifndef MODBUS_H
+#define MODBUS_H
+#include <stdint.h>
+
+// Slave address of hoist 1, further hoists take the following addresses
+#define MODBUS_LASTADDR	(248U - HOIST_COUNT)
+#define MODBUS_FRAMELEN	64U	// longest accepted request
+#define MODBUS_FIXEDLEN	8U	// requests other than a multiple write
+
+// Inter-character and inter-frame silence in timer1 counts (F_CPU),
+// 10 bit characters, fixed times above 19200 baud
+#if CONSOLE_BAUD > 19200
+#define MODBUS_T15	((uint16_t) (F_CPU * 75UL / 100000UL))
+#define MODBUS_T35	((uint16_t) (F_CPU * 175UL / 100000UL))
+#else
+#define MODBUS_T15	((uint16_t) (F_CPU * 15UL / CONSOLE_BAUD))
+#define MODBUS_T35	((uint16_t) (F_CPU * 35UL / CONSOLE_BAUD))
+#endif
+
+// Function codes
+#define MODBUS_READCOILS	0x01
+#define MODBUS_READHOLDING	0x03
+#define MODBUS_READINPUT	0x04
+#define MODBUS_WRITECOIL	0x05
+#define MODBUS_WRITEREG		0x06
+#define MODBUS_WRITEREGS	0x10
+
+// Exception codes
+#define MODBUS_BADFUNCTION	0x01
+#define MODBUS_BADADDRESS	0x02
+#define MODBUS_BADVALUE		0x03
+#define MODBUS_BUSY		0x06
+
+// Coils, write on to trigger
+enum modbus_coil {
+	coil_down,		// lower, reads on while lowering
+	coil_up,		// raise, reads on while raising
+	coil_count,
+};
+
+// Holding registers, console settings in the same units
+enum modbus_holding {
+	holding_p1,		// H-P1 (0.01s)
+	holding_p2,		// P1-P2 (0.01s)
+	holding_man,		// Man (0.01s)
+	holding_h,		// H (0.01s)
+	holding_hr,		// H-Retry (0.01s)
+	holding_f,		// Feed (minutes)
+	holding_nf,		// Feeds/week
+	holding_accel,		// Accel (0.01s)
+	holding_decel,		// Decel (0.01s)
+	holding_approach,	// Approach (0.01s)
+	holding_slow,		// Slow (%)
+	holding_addr,		// hoist 1 address, 0 returns to console
+	holding_count,
+};
+
+// Input registers
+enum modbus_input {
+	input_state,		// enum machine_state
+	input_error,		// error flag
+	input_volts,		// battery (0.1V)
+	input_minutes,		// minutes in current state
+	input_clockhi,		// uptime (0.01s), high word
+	input_clocklo,		// uptime, low word
+	input_version,		// firmware version
+	input_up,		// learned raise time (0.01s), 0 if uncalibrated
+	input_down,		// learned lower time (0.01s)
+	input_speed,		// controller telemetry, hoist 1 only
+	input_current,
+	input_spmvolts,
+	input_fault,
+	input_samples,
+	input_messages,		// valid frames seen on the bus
+	input_crcerrors,	// frames discarded with a bad checksum
+	input_exceptions,	// exception replies sent
+	input_count,
+};
+
+// Slave address of hoist 1, 0 when the UART runs the text console
+extern uint8_t modbus_addr;
+
+// Switch the console UART to Modbus at addr, or back to text with 0
+void modbus_select(uint8_t addr);
+
+// Read slave address from EEPROM and select it
+void modbus_init(void);
+
+// Answer the next received request
+void modbus_poll(void);
+
+#endif // MODBUS_H
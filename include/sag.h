@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Stall detection from battery voltage sag under motor load
+ */
+#ifndef SAG_H
+#define SAG_H
+#include <stdint.h>
+
+#define SAG_SAMPLES	63U	// conversions averaged per tick at most
+#define SAG_GRACE	30U	// 0.3s at full throttle before sampling
+#define SAG_MARGIN	250U	// mV over 1.5x the learned drop is a stall
+#define SAG_COUNT	20U	// consecutive ticks over the limit, 0.2s
+#define SAG_LEARNMIN	100U	// steady ticks in a move to learn from
+#define SAG_LEARN	2U	// learn 1/4 of each move's drop
+#define SAG_STEP	80U	// mV one move may shift the learned drop
+
+// Learned drop index, by motor direction
+enum sag_dir {
+	sag_down,		// forward
+	sag_up,			// reverse
+	sag_dirs,
+};
+
+// Load the selected hoist's learned drops from EEPROM
+void sag_init(void);
+
+// Average the conversions of the last tick, once per tick
+void sag_update(void);
+
+// Selected hoist's motor started, direction already set
+void sag_start(void);
+
+// Selected hoist's motor stopped, learn the move's drop if learn is set,
+// learned drops are saved when they change
+void sag_stop(uint8_t learn);
+
+// Return 1 if the selected hoist's motor has stalled
+uint8_t sag_check(void);
+
+// Learned drop of the selected hoist in dir, mV, 0 until learned
+uint16_t sag_normal(uint8_t dir);
+
+#endif // SAG_H
@@ -1,12 +1,32 @@
 // SPDX-License-Identifier: MIT
 
 /*
- * SPM motor controller settings checker
+ * SPM motor controller settings checker and telemetry poller
  */
 #ifndef SPMCHECK_H
 #define SPMCHECK_H
 
+// Latest controller monitor values
+struct spm_telemetry {
+	uint16_t speed;		// motor speed, rpm
+	uint16_t fault;		// controller error flags
+	uint8_t current;	// motor current, % of max
+	uint8_t volts;		// battery voltage, V
+	uint8_t samples;	// speed samples since poll start (saturating)
+};
+
+extern struct spm_telemetry spm_telemetry;
+
 // Check and optionally update attached controller
 void spm_check(void);
 
+// Begin polling controller telemetry after motor power on
+void spm_poll_start(void);
+
+// Stop polling and release controller USART
+void spm_poll_stop(void);
+
+// Advance poller once per tick, return 1 on new speed sample
+uint8_t spm_poll(void);
+
 #endif // SPMCHECK_H
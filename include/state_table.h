@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Hoist state transition table
+ *
+ * Generated by reference/sm_mktable.py from reference/state_table.txt
+ */
+#ifndef STATE_TABLE_H
+#define STATE_TABLE_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define STATE_COUNT	11
+#define EVENT_COUNT	14
+
+// Table entries: action << 4 | next state
+#define STATE_ACTION(e)	((uint8_t) ((e) >> 4))
+#define STATE_NEXT(e)	((uint8_t) ((e) & 0xf))
+
+enum machine_state {
+	state_stop,
+	state_stop_h_p1,
+	state_stop_p1_p2,
+	state_at_h,
+	state_at_p1,
+	state_at_p2,
+	state_move_h_p1,
+	state_move_p1_p2,
+	state_move_h,
+	state_move_man,
+	state_error,
+};
+
+enum machine_event {
+	trig_up,
+	trig_down,
+	trig_home,
+	trig_p1,
+	trig_p2,
+	trig_man,
+	trig_max,
+	trig_feedtime,
+	trig_randfeed,
+	trig_safetime,
+	trig_notathome,
+	trig_stall,
+	trig_sag,
+	trig_reset,
+};
+
+enum machine_action {
+	act_spurious,
+	act_ignore,
+	act_retry,
+	act_move_up,
+	act_move_down,
+	act_start_p1,
+	act_start_p2,
+	act_stop,
+	act_arrive_p1,
+	act_home,
+	act_error,
+	act_fault,
+	act_tangle,
+};
+
+extern const uint8_t state_table[STATE_COUNT][EVENT_COUNT] PROGMEM;
+// Label tables and strings in program space, read entries with pgm_read_ptr
+extern const char *const state_label[STATE_COUNT] PROGMEM;
+extern const char *const event_name[EVENT_COUNT] PROGMEM;
+extern const char *const event_label[EVENT_COUNT] PROGMEM;
+
+#endif // STATE_TABLE_H
@@ -3,9 +3,11 @@
 #ifndef SYSTEM_H
 #define SYSTEM_H
 #include <avr/io.h>
+#include "state_table.h"
 
 // Define missing IO regs - fixed in avr-libc 2.2
 #ifndef PORTE
+#define DDRE _SFR_IO8(0x0D)
 #define PORTE _SFR_IO8(0x0E)
 #define UBRR1L  _SFR_MEM8(0xCC)
 #define UCSR1A  _SFR_MEM8(0xC8)
@@ -13,6 +15,24 @@
 #define UCSR1C  _SFR_MEM8(0xCA)
 #define UDR1    _SFR_MEM8(0xCE)
 #endif // PORTE
+#ifndef TCCR3A
+#define TCCR3A  _SFR_MEM8(0x90)
+#define TCCR3B  _SFR_MEM8(0x91)
+#define OCR3BL  _SFR_MEM8(0x9A)
+#define OCR3BH  _SFR_MEM8(0x9B)
+#define COM3B1  5
+#define WGM30   0
+#define WGM32   3
+#define CS30    0
+#endif // TCCR3A
+
+// Hoists driven by one adapter, HOISTS build option
+#ifndef HOIST_COUNT
+#define HOIST_COUNT	1U
+#endif // HOIST_COUNT
+#if HOIST_COUNT < 1 || HOIST_COUNT > 2
+#error "HOIST_COUNT must be 1 or 2"
+#endif
 
 // Default user settings
 #define DEFAULT_P1	1250U	// 12.5s H -> P1
@@ -24,11 +44,20 @@
 #define DEFAULT_HR	250U	// 2.5s Home retry timeout
 #define DEFAULT_S	60U	// 60 minutes safe time, triggers M_H
 #define DEFAULT_PK	0U	// Default Console PIN
+#define DEFAULT_ACCEL	50U	// 0.5s throttle ramp up
+#define DEFAULT_DECEL	20U	// 0.2s throttle ramp down
+#define DEFAULT_APPROACH	200U	// 2s slow approach to home
+#define DEFAULT_SLOW	40U	// 40% throttle on approach
+
+// Throttle setting limits
+#define MAX_RAMP	500U	// 5s
+#define MAX_APPROACH	6000U	// 60s
+#define MAX_SLOW	100U	// %
 
 // Fixed voltage threshold
 #define LOWVOLTS	0x4a	// ~11.8V
 
-// Auto lowering voltage threshold
+// Charging voltage, host models start here and admit feeds above it
 #define NIGHTVOLTS	0x53	// ~13.2V
 #define OVRNONE		0x00	// No voltage override
 #define OVRNIGHT	0x01	// Flag override of night volts
@@ -48,10 +77,29 @@
 #define R1	6U		// PORTD.6
 #define R2	7U		// PORTD.7
 #define A1	3U		// PORTE.3:ADC7
+// Second hoist, Refer: README.md Second Hoist
+#define H2_HOME		S5	// PORTC.3
+#define H2_UP		S6	// PORTC.2
+#define H2_DOWN		S2	// PORTC.1
+#define H2_FWD		0	// PORTB.0
+#define H2_REV		1U	// PORTB.1
+#define H2_PWR		2U	// PORTB.2
+#define H2_THROTTLE	LED	// PORTD.2:OC3B, PB3 is TXD1 to the SPM
+#define H2_ATP1		0	// PORTE.0
+#define H2_BMASK	(_BV(H2_FWD)|_BV(H2_REV)|_BV(H2_PWR))
+#define H2_EMASK	(_BV(H2_ATP1))
 #define IMASK	(_BV(S1)|_BV(S2)|_BV(S3)|_BV(S4)|_BV(S5)|_BV(S6))
 #define OMASK	(_BV(LED)|_BV(V1)|_BV(R1)|_BV(R2)|_BV(R3)|_BV(R4))
 #define SYSTICK	GPIOR0
 
+// Low voltage indicator, its pin is hoist 2's throttle when HOISTS=2
+// and the console reports the warning instead
+#if HOIST_COUNT > 1
+#define INDICATOR	0
+#else
+#define INDICATOR	_BV(LED)
+#endif
+
 // Non-volatile data addresses
 #define NVM_BASE	0x3e0
 #define NVM_P1		(NVM_BASE + 0)
@@ -61,30 +109,68 @@
 #define NVM_F		(NVM_BASE + 0x8)
 #define NVM_NF		(NVM_BASE + 0xa)
 #define NVM_SPMOFT	(NVM_BASE + 0xc)
-#define NVM_RSV0E	(NVM_BASE + 0xe)
-#define NVM_SEEDOFT	(NVM_BASE + 0x10)
+#define NVM_BOOT	(NVM_BASE + 0xe)
+#define NVM_RSVSEED	(NVM_BASE + 0x10)	// unused, was random book offset
 #define NVM_KEY		(NVM_BASE + 0x12)
 #define NVM_KEYVAL	0x55aa
 #define NVM_HR		(NVM_BASE + 0x14)
 #define NVM_PK		(NVM_BASE + 0x16)
-#define NVM_RSV18	(NVM_BASE + 0x18)
-#define NVM_RSV1A	(NVM_BASE + 0x1a)
-#define NVM_RSV1C	(NVM_BASE + 0x1c)
-#define NVM_RSV1E	(NVM_BASE + 0x1e)
+#define NVM_ACCEL	(NVM_BASE + 0x18)
+#define NVM_DECEL	(NVM_BASE + 0x1a)
+#define NVM_APPROACH	(NVM_BASE + 0x1c)
+#define NVM_SLOW	(NVM_BASE + 0x1e)
+
+// Hoist n block is NVM_HOISTLEN * n below hoist 0, key, boot, spm
+// and PIN slots are only used in the hoist 0 block
+#define NVM_HOISTLEN	0x40
+
+// Travel calibration, below the configuration space
+#define NVM_TRAVEL	(NVM_BASE - 0x8)
+#define NVM_TRAVELKEY	(NVM_TRAVEL)
+#define NVM_UP		(NVM_TRAVEL + 0x2)
+#define NVM_DOWN	(NVM_TRAVEL + 0x4)
+#define NVM_SAG		(NVM_TRAVEL + 0x6)	// learned sag, Refer: src/sag.c
 
-// Random seed area
-#define SEEDOFT_LEN	NVM_BASE
+// Modbus slave address, below travel calibration
+#define NVM_MBADDR	(NVM_TRAVEL - 0x2)
 
-// Timing estimator (for 7812.5 Hz / 78 timer)
+// Input filter lengths S1 to S6, below the Modbus address
+#define NVM_DEBOUNCE	(NVM_MBADDR - 0xc)
+
+// Wear counters, below the hoist blocks, hoist n record is
+// NVM_HOISTLEN * n below hoist 0, Refer: include/wear.h
+#define NVM_WEAR	0x300
+#define NVM_WEARBOOT	0x340	// adapter reset counters
+
+// System tick: 2MHz / 256 = 7812.5Hz timer clock, 78.125 counts per 10ms
+#define TICK_COUNT	78U	// whole timer counts per tick
+#define TICK_FRAC	0x20U	// fractional counts per tick (0.125 * 256)
+
+// One minute of 10ms ticks
 #define ONEMINUTE	6000U
 
 // One week of minutes
 #define ONEWEEK		10080U
 
-// Motor enable/disable delay time
+// Motor enable delay time, and power sequence ticks
 #define MOTOR_DELAY	0x2710	// ~ 20ms
-#define MOTOR_OFFTIME	0xc350	// ~ 0.1s
-#define MOTOR_OFFCOUNT	2U
+#define MOTOR_WAKE	3U	// over 20ms controller wake before throttle
+#define MOTOR_SETTLE	2U	// 20ms throttle CV settle before power off
+#define MOTOR_ROLLDOWN	20U	// 0.2s roll down before the next start
+
+// Warm restart
+#define WARM_RESUMES	3U	// resumes without a state change before stop
+#define WARM_CAUSES	(_BV(WDRF) | _BV(BORF))	// reset causes to resume
+
+// Stall detection from controller telemetry
+#define STALL_CURRENT	95U	// % of max motor current
+#define STALL_COUNT	3U	// consecutive samples, ~0.15s
+#define STALL_GRACE	50U	// 0.5s spin up after accel before zero speed stalls
+
+// Stop on a telemetry stall, STALLSTOP build option, 0 only reports
+#ifndef STALL_STOP
+#define STALL_STOP	1U
+#endif // STALL_STOP
 
 // Output function labels
 #define FWD		R1
@@ -93,33 +179,49 @@
 #define ATP1		R4
 #define THROTTLE	V1
 
-// Input switch triggers (asserted after debouncing via read_input)
+// Input switch triggers (asserted after debouncing via read_inputs)
 #define TRIGGER_HOME	_BV(S1)
 #define TRIGGER_UP	_BV(S3)
 #define TRIGGER_DOWN	_BV(S4)
 #define TRIGMASK	(TRIGGER_HOME|TRIGGER_UP|TRIGGER_DOWN)
 
-enum machine_state {
-	state_stop,
-	state_stop_h_p1,
-	state_stop_p1_p2,
-	state_at_h,
-	state_at_p1,
-	state_at_p2,
-	state_move_h_p1,
-	state_move_p1_p2,
-	state_move_h,
-	state_move_man,
-	state_error,
+// Accepted input state at reset, Remootio outputs idle high
+#if HOIST_COUNT > 1
+#define INPUT_IDLE	(_BV(S3)|_BV(S4)|_BV(H2_UP)|_BV(H2_DOWN))
+#else
+#define INPUT_IDLE	(_BV(S3)|_BV(S4))
+#endif
+
+// Input filters, consecutive 10ms samples to accept a change
+#define INPUT_COUNT	6U	// S1 to S6
+#define DEBOUNCE_DEFAULT	2U
+#define DEBOUNCE_MAX	7U	// three bit vertical counter
+
+// Per hoist outputs and input triggers
+struct hoist_pins {
+	volatile uint8_t *port;	// FWD, REV and PWR outputs
+	uint8_t fwd;
+	uint8_t rev;
+	uint8_t pwr;
+	volatile uint8_t *atport;	// AT P1 signal to Remootio
+	uint8_t atp1;
+	volatile uint8_t *tport;	// throttle output, PWM on timer2/3
+	uint8_t throttle;
+	volatile uint8_t *ocr;	// throttle compare register
+	volatile uint8_t *tccr;	// timer control with compare output mode
+	uint8_t com;		// compare output mode
+	uint8_t home;		// trigger masks on PINC
+	uint8_t up;
+	uint8_t down;
+	uint8_t spm;		// SPM controller serial attached
 };
 
-// Note: counters p1 and p2 are preserved across move/stop transitions:
+// Note: elapsed p1 and p2 are preserved across move/stop transitions:
 //       MOVE H-P1 <-> STOP H-P1
 //       MOVE P1-P2 <-> STOP P1-P2
 struct state_machine {
 	uint8_t state;		// machine state
 	uint8_t error;		// error flag
-	uint8_t bstate;		// current accepted input state
 	uint16_t p1;		// elapsed 0.01s moving h->p1
 	uint16_t p1_timeout;	// target elapsed p1
 	uint16_t p2;		// elapsed 0.01s moving p1->p2
@@ -129,25 +231,57 @@ struct state_machine {
 	uint16_t f_timeout;	// maximum minutes at p1
 	uint16_t nf;		// number of feeds/day
 	uint16_t nf_timeout;	// target minutes for h->p1
-	uint16_t clock;		// 0.01s system clock
-	uint16_t count;		// 0.01s state counter
-	uint16_t mincount;	// 0.01s state counter for determining minutes
-	uint16_t minutes;	// minute state counter
+	uint32_t clock;		// 0.01s system uptime
+	uint32_t since;		// clock at entry to current state
 	uint16_t hr_timeout;	// home retry timeout
-	uint16_t pk;		// serial console passkey
+	uint16_t accel;		// full throttle ramp up time
+	uint16_t decel;		// full throttle ramp down time
+	uint16_t approach;	// slow approach time before home
+	uint16_t slow;		// approach throttle percent
+	uint32_t approach_at;	// move_h age to begin slow approach, 0 = off
 };
 
-// global system variable
-extern struct state_machine feed;
+// Hoist state machines, and the selected hoist
+extern struct state_machine hoist[HOIST_COUNT];
+extern struct state_machine *feed;
+extern const struct hoist_pins pinmap[HOIST_COUNT];
+extern const struct hoist_pins *pins;
+extern uint8_t unit;
+
+// 0.01s ticks since reset for console timing, hoist deadlines run on
+// each hoist's clock, which a warm restore carries over
+extern uint32_t uptime;
+
+// Current accepted input state, shared by all hoists
+extern uint8_t bstate;
+
+// Changes of each input S1 to S6 abandoned before acceptance
+extern uint16_t bounces[INPUT_COUNT];
+
+// Serial console passkey
+extern uint16_t passkey;
 
 // global system version
 extern uint16_t sw_version;
 
+// MCUSR reset cause flags captured at boot
+extern uint8_t reset_cause;
+
 // Function prototypes
+void write_byte(uint16_t addr, uint8_t val);	// EEPROM must be idle
+uint8_t read_byte(uint16_t addr);
 void write_word(uint16_t addr, uint16_t val);
 uint16_t read_word(uint16_t addr);
 uint8_t read_inputs(void);
+void debounce_set(uint8_t input, uint8_t ticks);
+uint8_t debounce_get(uint8_t input);
 void save_config(uint16_t addr, uint16_t val);
+uint16_t read_hoist(uint16_t addr);
+void save_hoist(uint16_t addr, uint16_t val);
+void hoist_select(uint8_t n);
+void warm_save(void);
+void warm_clear(void);
+uint8_t warm_restore(void);
 void system_init(void);
 
 #endif // SYSTEM_H
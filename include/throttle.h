@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * PWM throttle control voltages on timer2 with linear ramps
+ */
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#define THROTTLE_FULL	0xffU	// full scale duty
+
+// Convert percent of full throttle to duty
+#define THROTTLE_DUTY(pc)	((uint8_t) (((pc) * 255UL + 50U) / 100U))
+
+// Configure timer2 for PWM, all throttles off
+void throttle_init(void);
+
+// Select the throttle of hoist n
+void throttle_select(uint8_t n);
+
+// Ramp towards duty, ticks is the time for a full scale change
+void throttle_ramp(uint8_t duty, uint16_t ticks);
+
+// Advance ramp by one 10ms tick
+void throttle_update(void);
+
+// Return 1 if the selected hoist's throttle has ramped to zero
+uint8_t throttle_off(void);
+
+// Return 1 if the selected hoist's throttle is at full scale
+uint8_t throttle_full(void);
+
+#endif // THROTTLE_H
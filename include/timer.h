@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * One-shot deadline timers on the 10ms system clock
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+// Timer slots
+enum timer_id {
+	timer_move,		// motor run limit
+	timer_dwell,		// feed, auto feed and safe time
+	timer_retry,		// home retry
+	timer_count,
+};
+
+// Deadline expiry callback
+typedef void (*timer_callback)(void);
+
+// Select the deadline list of hoist n
+void timer_select(uint8_t n);
+
+// Call fn after delay ticks, replacing any pending deadline on id
+void timer_arm(uint8_t id, uint32_t delay, timer_callback fn);
+
+// Cancel a pending deadline
+void timer_cancel(uint8_t id);
+
+// Cancel all pending deadlines
+void timer_cancel_all(void);
+
+// Run callbacks for every deadline reached by the system clock
+void timer_poll(void);
+
+#endif // TIMER_H
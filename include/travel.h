@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Learned hoist travel times, per direction and corrected for battery
+ */
+#ifndef TRAVEL_H
+#define TRAVEL_H
+
+#define TRAVEL_VREF	0x50U	// ~12.7V reference for normalised times
+#define TRAVEL_GAIN	2U	// learn 1/4 of each observed error
+#define TRAVEL_KEYVAL	0xca1bU
+
+// Calibration run phases
+enum travel_run {
+	travel_idle,
+	travel_lower,		// lowering H -> P1 for the set H-P1 time
+	travel_raise,		// raising P1 -> H, timed to the home trigger
+};
+
+// Travel times are in ticks normalised to TRAVEL_VREF, motor speed
+// is taken to be proportional to battery voltage
+struct travel {
+	uint16_t up;		// raise time from P1 to H, 0 if uncalibrated
+	uint16_t down;		// lower time from H to P1
+	uint16_t lowered;	// lowering accumulated since leaving H
+	uint8_t known;		// lowered is a valid depth
+	uint8_t learn;		// current raise started from a known depth
+	uint8_t from_p1;	// current raise started at P1
+	uint8_t volts;		// battery ADCH at start of current move
+	uint8_t run;		// calibration run phase
+};
+
+// Travel of each hoist, and the selected hoist
+extern struct travel travels[HOIST_COUNT];
+extern struct travel *travel;
+
+// Scale ticks run at travel->volts to reference voltage
+uint16_t travel_norm(uint16_t ticks);
+
+// Lowering ticks to P1 at travel->volts, or fixed if uncalibrated
+uint16_t travel_p1(uint16_t fixed);
+
+// Expected ticks to raise home from the lowered depth, 0 if unknown
+uint16_t travel_home(void);
+
+// Update lowering estimate from a completed raise, 0 if rejected
+uint8_t travel_learn(uint16_t raised);
+
+// Store figures from a completed calibration run
+void travel_calibrate(uint16_t raised);
+
+// Discard calibration
+void travel_clear(void);
+
+// Load selected hoist calibration from EEPROM
+void travel_init(void);
+
+#endif // TRAVEL_H
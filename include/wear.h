@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Persistent wear and usage counters, Refer: README.md Wear Counters
+ */
+#ifndef WEAR_H
+#define WEAR_H
+#include <stdint.h>
+
+#define WEAR_KEYVAL	0x3eaeU
+#define WEAR_WINDOW	8U	// home returns kept for min/mean/max
+#define WEAR_FLUSH	360000UL	// 1 hour, longest a change is held
+
+// Error causes counted per hoist
+enum wear_cause {
+	wear_sensor,		// home input active at start of raise
+	wear_fault,		// spurious home trigger
+	wear_tangle,		// home trigger while lowering
+	wear_timeout,		// home not reached within H
+	wear_stall,		// controller fault, overcurrent or no rotation
+	wear_sag,		// battery voltage sag under motor load
+	wear_causes,
+};
+
+// Reset causes counted for the adapter, in show_reset() order
+enum wear_reset {
+	wear_watchdog,
+	wear_brownout,
+	wear_external,
+	wear_poweron,
+	wear_resets,
+};
+
+// Counters of one hoist, stored as words in EEPROM
+struct wear {
+	uint16_t key;
+	uint32_t down;		// motor on ticks lowering
+	uint32_t up;		// motor on ticks raising
+	uint16_t lifts;		// raises that reached home
+	uint16_t errors[wear_causes];
+	uint16_t returns[WEAR_WINDOW];	// normalised ticks P1 to home, 0 unused
+	uint16_t next;		// returns slot to fill next
+};
+
+// Adapter reset counters
+struct wear_boot {
+	uint16_t key;
+	uint16_t resets[wear_resets];
+};
+
+// Counters of each hoist, and the adapter
+extern struct wear wears[HOIST_COUNT];
+extern struct wear_boot wear_boot;
+
+// Load counters from EEPROM, clearing any never written
+void wear_init(void);
+
+// Count motor on time of every hoist, once per tick
+void wear_update(void);
+
+// Start writing one changed counter byte to EEPROM when due and idle
+void wear_poll(void);
+
+// Count the reset cause flags in MCUSR
+void wear_reset(uint8_t cause);
+
+// Count an error of the selected hoist
+void wear_error(uint8_t cause);
+
+// Selected hoist reached home after a raise of ticks, timed if from P1
+void wear_home(uint16_t ticks, uint8_t timed);
+
+// Min, mean and max of the selected hoist's recent returns, 0 if none
+uint16_t wear_min(void);
+uint16_t wear_mean(void);
+uint16_t wear_max(void);
+
+#endif // WEAR_H
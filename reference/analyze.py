@@ -0,0 +1,543 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""analyze.py
+
+Worst case stack depth and cycle counts of the firmware.
+
+Usage: analyze.py [--objdump PATH] [--size PATH] [-b BAUD]
+                  [--history FILE] ELF SU...
+
+Run through make, which builds an analysis image with -fstack-usage,
+no link-time optimisation, no jump tables and no inlining, so that
+every source function appears in the listing with its stack record:
+
+	$ make analyze
+
+Stack depth is walked over the call graph from main() and each
+interrupt handler. Cycle counts are the longest path through each
+function's flow graph, with conditional branches taken and skips
+skipping, and calls adding the cost of their callee. Functions with
+loops are charged their longest path once per pass, for the number
+of passes listed in LOOPS. Functions in WAITS poll hardware by
+design, they are charged one pass plus their wait bound. The drain
+of the console output is charged once per main loop pass, as it
+empties everything queued before it. RESETS never return.
+
+Fails if main() plus the deepest handler does not fit in the RAM
+left after .data, .bss and .noinit, or if the interrupt load of one
+tick plus one pass of update_state() does not fit in the tick. The
+main loop replays the ticks held up by waits, so a pass with waits
+fails if it spans more ticks than the replay window, or runs longer
+than the watchdog between resets.
+Results are appended to the history file when they change.
+"""
+
+import re
+import sys
+import argparse
+import subprocess
+from datetime import date
+
+F_CPU = 2000000
+TICK_CYCLES = 78 * 256  # TICK_COUNT of timer0 at clk/256
+SPM_POLLSTEP = 2  # timer0 counts between SPM poller interrupts
+WATCHDOG = F_CPU // 4  # WDTO_250MS
+WINDOW = 255  # ticks replayed by the main loop, uint8_t
+RAMSIZE = 2048
+ISR_ENTRY = 7  # interrupt response and vector jmp
+RETADDR = 2  # return address, included in stack records
+EVENTS = 16  # console event queue, EVTLEN
+CONSOLE_BUF = 256  # console output ring, BUFLEN
+EEPROM_WRITE = 3400 * F_CPU // 1000000  # tWD_EEPROM, 3.3ms and margin
+
+# ATmega328P vector numbers
+VECTORS = {
+    1: 'INT0', 2: 'INT1', 3: 'PCINT0', 4: 'PCINT1', 5: 'PCINT2',
+    6: 'WDT', 7: 'TIMER2_COMPA', 8: 'TIMER2_COMPB', 9: 'TIMER2_OVF',
+    10: 'TIMER1_CAPT', 11: 'TIMER1_COMPA', 12: 'TIMER1_COMPB',
+    13: 'TIMER1_OVF', 14: 'TIMER0_COMPA', 15: 'TIMER0_COMPB',
+    16: 'TIMER0_OVF', 17: 'SPI_STC', 18: 'USART_RX', 19: 'USART_UDRE',
+    20: 'USART_TX', 21: 'ADC', 22: 'EE_READY', 23: 'ANALOG_COMP',
+    24: 'TWI', 25: 'SPM_READY',
+}
+
+# Loop passes per call, keep in step with the source
+LOOPS = {
+    'write_wordval': 5,  # decimal digits
+    'write_longval': 20,  # digits out and back
+    'console_read': 255,  # rxbuf
+    'console_showhex': 255,
+    'console_showascii': 255,
+    'console_frame': 64,  # MODBUS_FRAMELEN
+    'console_send': 66,  # frame and checksum
+    'motor_running': 2,  # HOIST_COUNT
+    'restart': 2,
+    'update_state': 2,
+    'frame_crc': 64,
+    'read_registers': 17,  # input_count
+    'write_registers': 24,  # two passes over holding_count
+    'modbus_poll': 2,
+    'rcvsum': 24,  # SPM_MAXLEN
+    'battery_update': 2,
+    'battery_charge': 10,  # soc_curve
+    'wear_update': 2,  # HOIST_COUNT
+    'wear_poll': 94,  # image bytes, two hoists and resets
+    'wear_init': 2,
+    'load_record': 21,  # struct wear words
+    'wear_min': 8,  # WEAR_WINDOW
+    'wear_mean': 8,
+    'wear_max': 8,
+    'show_wear': 8,
+    'console_showvals': 8,
+    'sag_update': 2,  # HOIST_COUNT
+    'count_bounces': 6,  # INPUT_COUNT
+    'debounce_init': 6,
+    'show_debounce': 6,
+    'warm_check': 17,  # struct warm_state
+    'warm_save': 2,
+    'warm_clear': 2,
+    'throttle_init': 2,
+    'timer_cancel': 3,  # timer_count
+    'timer_arm': 3,
+    'timer_poll': 3,
+    '__vector_19': 1,  # USART_UDRE, releases one finished run
+    '__udivmodqi4': 8,
+    '__udivmodhi4': 16,
+    '__udivmodsi4': 32,
+}
+LOOPDEFAULT = 255
+
+# Hardware waits by design, cycles per call beyond one loop pass
+WAITS = {
+    'write_eeprom': EEPROM_WRITE,  # previous write, EEPE
+    'read_byte': EEPROM_WRITE,
+    'console_drain': 0,  # once per pass, see drain()
+}
+
+# Never return, restart through the watchdog
+RESETS = {'bootload'}
+
+# Callees of indirect calls, by name prefix
+INDIRECT = {
+    'timer_poll': ('trigger_', ),
+}
+
+# Handlers per tick at most, from console baud and timer settings
+def isr_rates(baud):
+    chars = -(-baud // 1000)  # 10 bit characters in 10ms
+    return {
+        'TIMER0_COMPA': 1,
+        'TIMER0_COMPB': -(-78 // SPM_POLLSTEP),
+        'ADC': -(-F_CPU // (32 * 13 * 100)),  # free running at clk/32
+        'USART_RX': chars,
+        'USART_UDRE': chars,
+        'TIMER1_COMPB': -(-chars // 4),  # shortest Modbus frame
+    }
+
+# Cycles to send a full console output ring
+def drain(baud):
+    return CONSOLE_BUF * 10 * F_CPU // baud
+
+
+# One pass of the main loop after system_init and restart
+MAINLOOP = (
+    ('update_state', 1),
+    ('hoist_select', 1),
+    ('console_read', EVENTS + 1),
+    ('modbus_poll', 1),
+    ('console_next', EVENTS + 1),
+    ('handle_event', EVENTS),
+    ('entropy_poll', 1),
+    ('motor_running', 1),
+    ('console_busy', 1),
+    ('wear_poll', 1),
+    ('warm_save', 1),
+)
+
+CYCLES = {}
+for m in ('adiw', 'sbiw', 'mul', 'muls', 'mulsu', 'fmul', 'fmuls', 'fmulsu',
+          'ld', 'ldd', 'lds', 'st', 'std', 'sts', 'push', 'pop', 'sbi',
+          'cbi', 'rjmp', 'ijmp'):
+    CYCLES[m] = 2
+for m in ('jmp', 'rcall', 'icall', 'lpm', 'elpm'):
+    CYCLES[m] = 3
+for m in ('call', 'ret', 'reti'):
+    CYCLES[m] = 4
+SKIPS = ('cpse', 'sbrc', 'sbrs', 'sbic', 'sbis')
+
+LABEL = re.compile(r'^([0-9a-f]+) <(.+)>:$')
+INSN = re.compile(r'^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t(\S+)\s*(.*)$')
+TARGET = re.compile(r';\s*0x([0-9a-f]+)')
+
+
+class AnalyzeError(Exception):
+    pass
+
+
+class Insn:
+
+    def __init__(self, addr, size, op, args):
+        self.addr = addr
+        self.size = size
+        self.op = op
+        self.target = None
+        m = TARGET.search(args)
+        if m:
+            self.target = int(m.group(1), 16)
+        elif op in ('jmp', 'call'):
+            self.target = int(args.split()[0], 0)
+
+
+class Function:
+
+    def __init__(self, name, addr):
+        self.name = name
+        self.addr = addr
+        self.insns = []
+        self.frame = None
+
+
+def base_name(name):
+    """Strip compiler clone suffixes"""
+    return re.sub(r'\.(part|isra|constprop|cold)\.\d+', '', name)
+
+
+def read_listing(text):
+    funcs = {}
+    cur = None
+    for line in text.splitlines():
+        m = LABEL.match(line)
+        if m:
+            addr = int(m.group(1), 16)
+            cur = Function(base_name(m.group(2)), addr)
+            funcs[addr] = cur
+            continue
+        m = INSN.match(line)
+        if m and cur is not None:
+            size = len(m.group(2).split())
+            cur.insns.append(
+                Insn(int(m.group(1), 16), size, m.group(3), m.group(4)))
+    return funcs
+
+
+def read_stack(paths):
+    """Static frame of each function, largest of any same name"""
+    frames = {}
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                loc, size, kind = line.rstrip('\n').split('\t')
+                name = base_name(loc.rsplit(':', 1)[-1])
+                if 'dynamic' in kind and 'bounded' not in kind:
+                    raise AnalyzeError('%s: unbounded stack in %s' %
+                                       (path, name))
+                frames[name] = max(frames.get(name, 0), int(size))
+    return frames
+
+
+def read_ram(size, elf):
+    out = subprocess.run([size, '-A', elf], check=True,
+                         capture_output=True, text=True).stdout
+    used = 0
+    for line in out.splitlines():
+        f = line.split()
+        if len(f) >= 2 and f[0] in ('.data', '.bss', '.noinit'):
+            used += int(f[1])
+    return used
+
+
+class Program:
+
+    def __init__(self, funcs, frames):
+        self.funcs = funcs
+        self.byname = {}
+        for f in funcs.values():
+            self.byname.setdefault(f.name, []).append(f)
+            f.frame = frames.get(f.name)
+            if f.frame is None:
+                # library code without a stack record
+                f.frame = RETADDR + sum(1 for i in f.insns
+                                        if i.op == 'push')
+        self.depths = {}
+        self.costs = {}
+        self.active = set()
+        self.warnings = []
+        self.resets = set()
+        self.waiting = False
+        self.waited = set()
+
+    def lookup(self, name):
+        if name not in self.byname:
+            raise AnalyzeError('%s not found in listing' % (name, ))
+        return self.byname[name]
+
+    def callees(self, f, insn):
+        """Functions entered by insn, with a flag for a tail jump"""
+        if insn.op in ('icall', 'eicall', 'ijmp', 'eijmp'):
+            prefixes = INDIRECT.get(f.name)
+            if prefixes is None:
+                raise AnalyzeError('%s: unresolved indirect %s at 0x%x' %
+                                   (f.name, insn.op, insn.addr))
+            return [(g, insn.op.endswith('jmp'))
+                    for g in self.funcs.values()
+                    if g.name.startswith(prefixes)]
+        if insn.target is None or insn.op not in ('call', 'rcall', 'jmp',
+                                                  'rjmp'):
+            return []
+        if insn.target == insn.addr + insn.size and insn.op == 'rcall':
+            return []  # rcall .+0 allocates frame
+        g = self.funcs.get(insn.target)
+        if g is None or g is f:
+            return []
+        return [(g, insn.op.endswith('jmp'))]
+
+    def enter(self, f):
+        if f.addr in self.active:
+            raise AnalyzeError('recursion through %s' % (f.name, ))
+        self.active.add(f.addr)
+
+    def depth(self, f):
+        """Worst case stack bytes from entry of f"""
+        if f.addr in self.depths:
+            return self.depths[f.addr]
+        self.enter(f)
+        deep = 0
+        for insn in f.insns:
+            for g, tail in self.callees(f, insn):
+                deep = max(deep, self.depth(g))
+        self.active.discard(f.addr)
+        self.depths[f.addr] = f.frame + deep
+        return f.frame + deep
+
+    def edges(self, f):
+        """Successor index and extra cycles of each instruction"""
+        index = {insn.addr: n for n, insn in enumerate(f.insns)}
+        succ = []
+        for n, insn in enumerate(f.insns):
+            nxt = n + 1 if n + 1 < len(f.insns) else None
+            op = insn.op
+            out = []
+            if op in ('ret', 'reti', 'ijmp', 'eijmp'):
+                pass
+            elif op in ('rjmp', 'jmp'):
+                if insn.target in index:
+                    out.append((index[insn.target], 0))
+            elif op.startswith('br') and op != 'break':
+                out.append((nxt, 0))
+                if insn.target in index:
+                    out.append((index[insn.target], 1))
+            elif op in SKIPS:
+                out.append((nxt, 0))
+                if nxt is not None and nxt + 1 < len(f.insns):
+                    out.append((nxt + 1, f.insns[nxt].size // 2))
+            elif nxt is not None:
+                out.append((nxt, 0))
+            succ.append([(s, w) for s, w in out if s is not None])
+        return succ
+
+    def insn_cost(self, f, insn):
+        cost = CYCLES.get(insn.op, 1)
+        calls = self.callees(f, insn)
+        if calls:
+            cost += max(self.cost(g) for g, tail in calls)
+        return cost
+
+    def cost(self, f):
+        """Worst case cycles from entry of f to return"""
+        if f.name in RESETS:
+            self.resets.add(f.name)
+            return 0
+        key = (f.addr, self.waiting)
+        if key in self.costs:
+            return self.costs[key]
+        self.enter(f)
+        if not f.insns:
+            raise AnalyzeError('%s has no instructions' % (f.name, ))
+        succ = self.edges(f)
+        weight = [self.insn_cost(f, insn) for insn in f.insns]
+        # depth first order, edges back to an open node close a loop
+        order = []
+        back = 0
+        state = [0] * len(f.insns)
+        stack = [(0, iter(succ[0]))]
+        state[0] = 1
+        while stack:
+            n, it = stack[-1]
+            for s, w in it:
+                if state[s] == 0:
+                    state[s] = 1
+                    stack.append((s, iter(succ[s])))
+                    break
+                elif state[s] == 1:
+                    back += 1
+            else:
+                stack.pop()
+                state[n] = 2
+                order.append(n)
+        pos = {n: k for k, n in enumerate(order)}
+        longest = [0] * len(f.insns)
+        for n in order:
+            best = 0
+            for s, w in succ[n]:
+                if pos[s] < pos[n]:
+                    best = max(best, w + longest[s])
+            longest[n] = weight[n] + best
+        passes = 1
+        wait = 0
+        if f.name in WAITS:
+            if self.waiting:
+                self.waited.add(f.name)
+                wait = WAITS[f.name]
+        elif back:
+            if f.name in LOOPS:
+                passes = LOOPS[f.name] + 1
+            else:
+                passes = LOOPDEFAULT + 1
+                self.warnings.append('%s: loop without a bound, assumed %d'
+                                     % (f.name, LOOPDEFAULT))
+        self.active.discard(f.addr)
+        self.costs[key] = passes * longest[0] + wait
+        return self.costs[key]
+
+    def worst(self, name, measure):
+        return max(measure(f) for f in self.lookup(name))
+
+
+def interrupts(prog):
+    isrs = {}
+    for f in prog.funcs.values():
+        m = re.match(r'__vector_(\d+)$', f.name)
+        if m:
+            n = int(m.group(1))
+            isrs[VECTORS.get(n, f.name)] = f
+    return isrs
+
+
+def analyze(prog, ramused, baud):
+    """Return report lines, result fields and a list of failures"""
+    lines = []
+    fails = []
+    isrs = interrupts(prog)
+    rates = isr_rates(baud)
+
+    mainstack = prog.worst('main', prog.depth)
+    isrstack = 0
+    lines.append('%-16s %6s %8s %6s' % ('Handler', 'stack', 'cycles',
+                                        'per tick'))
+    load = 0
+    for name in sorted(isrs):
+        f = isrs[name]
+        d = prog.depth(f)
+        c = ISR_ENTRY + prog.cost(f)
+        rate = rates.get(name)
+        if rate is None:
+            fails.append('%s: no rate for handler' % (name, ))
+            rate = 0
+        isrstack = max(isrstack, d)
+        load += rate * c
+        lines.append('%-16s %6d %8d %6d' % (name, d, c, rate))
+    free = RAMSIZE - ramused
+    stack = mainstack + isrstack
+    lines.append('')
+    lines.append('RAM free after data: %d bytes' % (free, ))
+    lines.append('Stack main: %d, deepest handler: %d, total: %d, '
+                 'margin: %d' % (mainstack, isrstack, stack, free - stack))
+    if stack > free:
+        fails.append('stack %d exceeds free RAM %d' % (stack, free))
+
+    tick = prog.worst('update_state', prog.cost) + CYCLES['call']
+    lines.append('Tick: handlers %d + update_state %d = %d of %d cycles' %
+                 (load, tick, load + tick, TICK_CYCLES))
+    if load + tick > TICK_CYCLES:
+        fails.append('tick path %d exceeds %d cycles' %
+                     (load + tick, TICK_CYCLES))
+
+    prog.waiting = True
+    work = sum(count * (prog.worst(name, prog.cost) + CYCLES['call'])
+               for name, count in MAINLOOP)
+    # the drain feeds the watchdog, the rest of the pass must not
+    fed = drain(baud) if 'console_drain' in prog.waited else 0
+    # handlers keep taking their share of every tick the pass spans
+    ticks = -(-(work + fed) // max(1, TICK_CYCLES - load))
+    total = work + fed + ticks * load
+    lines.append('Main pass: %d cycles, %0.1f ms, %d ticks late' %
+                 (total, 1000.0 * total / F_CPU, ticks - 1))
+    if ticks - 1 > WINDOW:
+        fails.append('main pass %d ticks late exceeds replay of %d' %
+                     (ticks - 1, WINDOW))
+    if total - fed > WATCHDOG:
+        fails.append('main pass %d exceeds watchdog %d cycles' %
+                     (total - fed, WATCHDOG))
+    if prog.waited:
+        lines.append('Waits timed: ' + ', '.join(sorted(prog.waited)))
+    if prog.resets:
+        lines.append('Resets, not timed: ' + ', '.join(sorted(prog.resets)))
+    result = [
+        'free=%d' % (free, ),
+        'stack=%d' % (stack, ),
+        'main=%d' % (mainstack, ),
+        'isr=%d' % (isrstack, ),
+        'load=%d' % (load, ),
+        'tick=%d' % (tick, ),
+        'pass=%d' % (total, ),
+    ]
+    return lines, result, fails
+
+
+def describe():
+    try:
+        return subprocess.run(['git', 'describe', '--always', '--dirty'],
+                              check=True, capture_output=True,
+                              text=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return 'unknown'
+
+
+def record(path, result):
+    """Append result to history file if it differs from the last run"""
+    last = None
+    with open(path) as f:
+        for line in f:
+            if line.strip() and not line.startswith('#'):
+                last = line.split()[2:]
+    if last == result:
+        return
+    with open(path, 'a') as f:
+        f.write(' '.join([date.today().isoformat(), describe()] + result) +
+                '\n')
+
+
+def main():
+    p = argparse.ArgumentParser(description='Firmware stack and timing')
+    p.add_argument('--objdump', default='avr-objdump')
+    p.add_argument('--size', default='avr-size')
+    p.add_argument('-b', '--baud', type=int, default=19200,
+                   help='console baud of the build')
+    p.add_argument('--history', help='append results to file')
+    p.add_argument('elf')
+    p.add_argument('su', nargs='+', help='stack usage files')
+    a = p.parse_args()
+
+    sys.setrecursionlimit(10000)
+    try:
+        listing = subprocess.run([a.objdump, '-d', a.elf], check=True,
+                                 capture_output=True, text=True).stdout
+        prog = Program(read_listing(listing), read_stack(a.su))
+        lines, result, fails = analyze(prog, read_ram(a.size, a.elf),
+                                       a.baud)
+    except (AnalyzeError, OSError, subprocess.CalledProcessError) as e:
+        print('analyze: %s' % (e, ), file=sys.stderr)
+        return 1
+    for line in lines:
+        print(line)
+    for w in prog.warnings:
+        print('Warning: %s' % (w, ))
+    for f in fails:
+        print('FAIL: %s' % (f, ))
+    if a.history:
+        record(a.history, result)
+    return 1 if fails else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
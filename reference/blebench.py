@@ -0,0 +1,208 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""blebench.py
+
+Measure time to fully configure a hoist with blehhconfig, against a
+mock bleuart peripheral emulating BLE connection events and the hoist
+console at 19200 baud.
+
+Usage: blebench.py [-i INTERVAL] [-m MTU] [-n COUNT]
+
+Each run connects, authenticates, reads values and status, writes a
+full configuration then reads back values. Commands are issued one per
+write, as in blehhconfig 1.0, then batched into MTU sized writes.
+"""
+
+import os
+import sys
+import types
+import asyncio
+import argparse
+from time import monotonic
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'util',
+                                'blehhconfig'))
+try:
+    import bleak
+except ImportError:
+    # bench uses MockClient only, bleak is not required
+    bleak = types.ModuleType('bleak')
+    bleak.BleakClient = bleak.BleakScanner = None
+    sys.modules['bleak'] = bleak
+import blehhconfig
+
+BAUD = 19200
+ACN = 1234
+CONFIG = {
+    'H-P1': 1550,
+    'P1-P2': 320,
+    'Man': 150,
+    'H': 3500,
+    'H-Retry': 3000,
+    'Feed': 30,
+    'Feeds/week': 7,
+}
+NAMES = {v: k for k, v in blehhconfig._CFGKEYS.items()}
+
+
+class MockHoist:
+    """Hoist console: ACN, v, s and value commands"""
+
+    def __init__(self):
+        self.values = {k: 0 for k in NAMES}
+        self.authed = False
+        self.cmd = ''
+
+    def input(self, ch):
+        out = ''
+        if not self.authed:
+            self.cmd += ch
+            if ch == '\n':
+                if self.cmd.strip('\x10 \r\n') == str(ACN):
+                    self.authed = True
+                    out = 'OK\r\n'
+                self.cmd = ''
+        elif ch in '\r\n':
+            if self.cmd:
+                k = self.cmd[0]
+                if self.cmd[1:]:
+                    self.values[k] = int(self.cmd[1:])
+                out = '%s = %d\r\n' % (NAMES[k], self.values[k])
+            self.cmd = ''
+        elif not self.cmd and ch == 'v':
+            out = 'Values:\r\n\tFirmware = v25004\r\n'
+            for k in NAMES:
+                out += '\t%s = %d\r\n' % (NAMES[k], self.values[k])
+        elif not self.cmd and ch == 's':
+            out = 'State: [AT H] Batt: 12.9V @1234\r\n'
+        elif ch in NAMES or self.cmd:
+            self.cmd += ch
+        return out
+
+
+class MockClient:
+    """Bleak compatible client for a bleuart adapter on a mock hoist"""
+
+    interval = 0.03
+    mtu = 23
+
+    def __init__(self, device, disconnected_callback=None):
+        self.is_connected = False
+        self.mtu_size = self.mtu
+        self._hoist = MockHoist()
+        self._notify = None
+        self._task = None
+        self._rx = asyncio.Queue()
+        self._tx = bytearray()
+        self.writes = 0
+        self.notifies = 0
+
+    async def connect(self):
+        self.is_connected = True
+        self._task = asyncio.create_task(self._run())
+
+    async def disconnect(self):
+        self.is_connected = False
+        self._task.cancel()
+
+    async def start_notify(self, char, callback):
+        self._notify = callback
+
+    async def read_gatt_char(self, char):
+        return b'H1'
+
+    async def write_gatt_char(self, char, data, response=False):
+        # one write per connection event
+        await asyncio.sleep(self.interval)
+        self.writes += 1
+        self._rx.put_nowait(bytes(data))
+
+    async def _uart(self):
+        """Feed received writes through the hoist at the console baud"""
+        while True:
+            data = await self._rx.get()
+            for ch in data.decode('ascii'):
+                self._tx.extend(self._hoist.input(ch).encode('ascii'))
+            await asyncio.sleep(len(data) * 10 / BAUD)
+
+    async def _run(self):
+        uart = asyncio.create_task(self._uart())
+        try:
+            while True:
+                await asyncio.sleep(self.interval)
+                # reply bytes arrive at the console baud
+                count = min(len(self._tx), int(self.interval * BAUD / 10))
+                while count:
+                    chunk = min(count, self.mtu_size - 3)
+                    data = bytes(self._tx[0:chunk])
+                    del self._tx[0:chunk]
+                    count -= chunk
+                    self.notifies += 1
+                    await self._notify(None, data)
+        finally:
+            uart.cancel()
+
+
+async def configure(batched):
+    con = blehhconfig.BleConsole()
+    con._loop = asyncio.get_running_loop()
+    con._running = True
+    con.setacn(ACN)
+    con.portdev = 'mock'
+    start = monotonic()
+    await con._connect()
+    if batched:
+        await con._hello()
+        await con._update(CONFIG)
+    else:
+        hello = ((b' ', None), con._authcmd(), (b'v', 'Values:'),
+                 (b's', 'State:'))
+        for cmd in hello:
+            await con._sendcmds((cmd, ))
+        for k in CONFIG:
+            await con._update({k: CONFIG[k]})
+    await con._getvalues()
+    # value lines follow the Values: reply
+    deadline = start + 30.0
+    ok = False
+    while not ok and monotonic() < deadline:
+        await asyncio.sleep(0.001)
+        ok = all(con.cfg.get(k) == CONFIG[k] for k in CONFIG)
+    elapsed = monotonic() - start
+    client = con._portdev
+    await client.disconnect()
+    return elapsed, ok, client.writes, client.notifies
+
+
+async def bench(count):
+    for batched in (False, True):
+        times = []
+        for i in range(0, count):
+            elapsed, ok, writes, notifies = await configure(batched)
+            if not ok:
+                print('Configuration not verified')
+                return 1
+            times.append(elapsed)
+        print('%-10s %6.3fs  %3d writes  %3d notifies' %
+              ('batched' if batched else 'sequential',
+               sum(times) / len(times), writes, notifies))
+    return 0
+
+
+def main():
+    p = argparse.ArgumentParser(description='BLE configure benchmark')
+    p.add_argument('-i', '--interval', type=float, default=0.03,
+                   help='connection interval in seconds')
+    p.add_argument('-m', '--mtu', type=int, default=23, help='ATT MTU')
+    p.add_argument('-n', '--count', type=int, default=3)
+    a = p.parse_args()
+    MockClient.interval = a.interval
+    MockClient.mtu = a.mtu
+    blehhconfig.BleakClient = MockClient
+    print('Interval: %0.0fms, MTU: %d, mean of %d runs' %
+          (1000 * a.interval, a.mtu, a.count))
+    return asyncio.run(bench(a.count))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""consolebench.py
+
+Measure serial console command throughput with pipelined requests.
+
+Usage: consolebench.py [-b BAUD] [-n COUNT] [-w WINDOW] PORT ACN
+
+Firmware must be built with the matching console baud rate, eg:
+
+	$ make CONSOLE_BAUD=125000 upload
+
+Only read commands are issued, stored configuration is not modified.
+"""
+
+import sys
+import argparse
+from time import monotonic
+from serial import Serial
+
+# Read-only console commands, each answered with one "Label = value" line
+COMMANDS = (b'1', b'2', b'h', b'f', b'n', b'm', b'r')
+
+
+def readline(s, deadline):
+    buf = bytearray()
+    while monotonic() < deadline:
+        ch = s.read(1)
+        if ch:
+            buf.extend(ch)
+            if ch == b'\n':
+                return bytes(buf)
+    return None
+
+
+def main():
+    p = argparse.ArgumentParser(description='Console command benchmark')
+    p.add_argument('-b', '--baud', type=int, default=19200)
+    p.add_argument('-n', '--count', type=int, default=1000)
+    p.add_argument('-w', '--window', type=int, default=8,
+                   help='commands in flight')
+    p.add_argument('port')
+    p.add_argument('acn', type=int)
+    a = p.parse_args()
+
+    s = Serial(port=a.port, baudrate=a.baud, rtscts=False, timeout=0.05)
+    s.reset_input_buffer()
+    s.write(b'\x10' + str(a.acn).encode('ascii') + b'\r\n')
+    deadline = monotonic() + 2.0
+    while True:
+        l = readline(s, deadline)
+        if l is None:
+            print('No response to access code')
+            return 1
+        if l.strip() == b'OK':
+            break
+
+    sent = 0
+    done = 0
+    lost = 0
+    txbytes = 0
+    start = monotonic()
+    while done + lost < a.count:
+        while sent < a.count and sent - done - lost < a.window:
+            cmd = COMMANDS[sent % len(COMMANDS)] + b'\r\n'
+            s.write(cmd)
+            txbytes += len(cmd)
+            sent += 1
+        l = readline(s, monotonic() + 1.0)
+        if l is None:
+            # reply dropped, release its window slot
+            lost += 1
+        elif b' = ' in l:
+            done += 1
+    elapsed = monotonic() - start
+    s.close()
+
+    print('Baud: %d, window: %d' % (a.baud, a.window))
+    print('Commands: %d ok, %d lost in %0.3fs' % (done, lost, elapsed))
+    print('Rate: %0.1f commands/s, %0.0f bytes/s sent' %
+          (done / elapsed, txbytes / elapsed))
+    return 0 if lost == 0 else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host check of the entropy collector health tests and extractor
+ *
+ * Builds the firmware entropy collector for the host and feeds it
+ * simulated battery sense conversions: gaussian noise around a fixed
+ * level, a stuck converter, and a biased converter. Checks that the
+ * health tests pass noise and catch the faults, that extracted seeds
+ * are unbiased and distinct, and that a single input bit flip changes
+ * about half of the seed bits.
+ *
+ * Usage: entropycheck
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+// Each boot sample loop iteration loads the next simulated conversion
+#undef wdt_reset
+#define wdt_reset() adc_next()
+#define srandom check_srandom
+static void adc_next(void);
+static void check_srandom(uint32_t seed);
+#include "../src/entropy.c"
+#undef srandom
+
+#define CHECK_LEVEL	400U	// 10 bit conversion, ~12.5V
+#define CHECK_NOISE	0.8	// noise rms in LSB
+#define CHECK_SEEDS	20000U	// seeds for bias and duplicate checks
+#define CHECK_BIAS	0.02	// allowed bit frequency error
+#define CHECK_FLIPS	2000U	// trials for the bit flip check
+
+volatile uint8_t host_regs[0x100];
+
+enum adc_mode { adc_noise, adc_stuck, adc_biased };
+
+static enum adc_mode mode;
+static uint32_t host_rng = 0x12345678U;
+static uint32_t seeds;
+static uint32_t last_seed;
+static unsigned failures;
+static char message[64];
+
+static uint32_t xorshift(void)
+{
+	host_rng ^= host_rng << 13;
+	host_rng ^= host_rng >> 17;
+	host_rng ^= host_rng << 5;
+	return host_rng;
+}
+
+// Approximately gaussian, sum of twelve uniforms
+static double gauss(void)
+{
+	double sum = -6.0;
+	unsigned i;
+	for (i = 0; i < 12U; i++) {
+		sum += (double) xorshift() / 4294967296.0;
+	}
+	return sum;
+}
+
+static void adc_load(uint16_t val)
+{
+	ADCH = (uint8_t) (val >> 2);
+	ADCL = (uint8_t) (val << 6);
+	ADCSRA |= _BV(ADIF);
+}
+
+static void adc_next(void)
+{
+	static unsigned biased;
+	double v;
+	switch (mode) {
+	case adc_noise:
+		v = CHECK_LEVEL + CHECK_NOISE * gauss();
+		adc_load((uint16_t) (v + 0.5));
+		break;
+	case adc_stuck:
+		adc_load(CHECK_LEVEL);
+		break;
+	case adc_biased:
+		// level in 13 of 16 samples, but never 41 times in a row
+		adc_load((uint16_t) (CHECK_LEVEL + ((++biased & 0xfU) > 12U)));
+		break;
+	}
+}
+
+static void check_srandom(uint32_t seed)
+{
+	last_seed = seed;
+	++seeds;
+}
+
+void console_write(const char *msg)
+{
+	strncpy(message, msg, sizeof(message) - 1U);
+}
+
+static void reset(enum adc_mode m)
+{
+	pool = 0;
+	credit = 0;
+	rct_last = 0;
+	rct_count = 0;
+	apt_first = 0;
+	apt_count = 0;
+	apt_len = 0;
+	entropy_status = 0;
+	entropy_jitter = 0;
+	seeds = 0;
+	message[0] = '\0';
+	mode = m;
+	adc_next();
+}
+
+static void report(const char *name, int ok, const char *fmt, double val)
+{
+	printf("%-44s %s", name, ok ? "ok" : "FAIL");
+	if (fmt) {
+		printf(fmt, val);
+	}
+	printf("\n");
+	if (!ok) {
+		++failures;
+	}
+}
+
+static unsigned bitcount(uint32_t v)
+{
+	unsigned n = 0;
+	while (v) {
+		v &= v - 1U;
+		++n;
+	}
+	return n;
+}
+
+static int cmp_seed(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+	return (x > y) - (x < y);
+}
+
+static void check_boot(void)
+{
+	reset(adc_noise);
+	entropy_init();
+	report("noise seeds at boot", seeds == 1U && !entropy_status
+	       && !message[0], NULL, 0.0);
+
+	reset(adc_stuck);
+	entropy_init();
+	report("stuck converter fails repetition count",
+	       seeds == 1U && entropy_status == ENTROPY_FAILRCT
+	       && strncmp(message, "Entropy: Health fail", 20U) == 0,
+	       NULL, 0.0);
+	report("stuck converter earns no credit", credit == 0, NULL, 0.0);
+
+	reset(adc_biased);
+	entropy_init();
+	report("biased converter fails adaptive proportion",
+	       seeds == 1U && entropy_status == ENTROPY_FAILAPT, NULL, 0.0);
+}
+
+static void check_seeds(void)
+{
+	static uint32_t out[CHECK_SEEDS];
+	unsigned ones[32];
+	unsigned i;
+	unsigned b;
+	unsigned dups = 0;
+	double worst = 0.0;
+
+	memset(ones, 0, sizeof(ones));
+	reset(adc_noise);
+	for (i = 0; i < CHECK_SEEDS; i++) {
+		uint32_t count = seeds;
+		while (seeds == count) {
+			entropy_event();
+			entropy_poll();
+			adc_next();
+		}
+		out[i] = last_seed;
+		for (b = 0; b < 32U; b++) {
+			ones[b] += (last_seed >> b) & 1U;
+		}
+	}
+	for (b = 0; b < 32U; b++) {
+		double err = (double) ones[b] / CHECK_SEEDS - 0.5;
+		if (err < 0) {
+			err = -err;
+		}
+		if (err > worst) {
+			worst = err;
+		}
+	}
+	report("idle seeds without health failure", !entropy_status, NULL,
+	       0.0);
+	report("seed bit frequency", worst < CHECK_BIAS,
+	       " (worst bit off by %0.4f)", worst);
+	qsort(out, CHECK_SEEDS, sizeof(out[0]), cmp_seed);
+	for (i = 1; i < CHECK_SEEDS; i++) {
+		dups += out[i] == out[i - 1U];
+	}
+	report("distinct seeds", dups <= 1U, " (%0.0f repeated)", dups);
+}
+
+static void check_flips(void)
+{
+	uint8_t input[ENTROPY_SEEDLEN];
+	uint32_t start;
+	uint32_t a;
+	uint32_t b;
+	unsigned i;
+	unsigned t;
+	unsigned total = 0;
+	double mean;
+
+	for (t = 0; t < CHECK_FLIPS; t++) {
+		start = xorshift();
+		for (i = 0; i < sizeof(input); i++) {
+			input[i] = (uint8_t) xorshift();
+		}
+		pool = start;
+		for (i = 0; i < sizeof(input); i++) {
+			mix(input[i]);
+		}
+		a = extract();
+		input[xorshift() % sizeof(input)] ^= (uint8_t) (1U << (t & 7U));
+		pool = start;
+		for (i = 0; i < sizeof(input); i++) {
+			mix(input[i]);
+		}
+		b = extract();
+		total += bitcount(a ^ b);
+	}
+	mean = (double) total / CHECK_FLIPS;
+	report("single input bit flip changes half the seed",
+	       mean > 15.5 && mean < 16.5, " (mean %0.2f bits)", mean);
+}
+
+int main(void)
+{
+	memset((void *) host_regs, 0, sizeof(host_regs));
+	check_boot();
+	check_seeds();
+	check_flips();
+	return failures ? 1 : 0;
+}
@@ -1,38 +1,329 @@
 #!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""fakespm.py
 
-# fake SPM controller for testing
+Fault-injecting SPM motor controller emulator for testing.
 
+Usage: fakespm.py [options]
+
+Serves the SPM 0x11/0xf1/0xf2/0xf3/0xf4 protocol and the 0x3b/0x3c
+telemetry monitor requests on a new
+pseudo-terminal (default) or a serial port (--port). Controller
+memory is loaded from spm_config.bin with the expected model string
+at 0x40, so an unmodified adapter will find no changes to write.
+
+Each sync session (traffic separated by --idle seconds) is reported
+with the time to connect, read, write and commit, and the faults
+injected. Use --log to record every packet with a timestamp.
+"""
+
+import os
+import sys
+import tty
+import random
 import logging
-from spmtool import Spm
-from time import sleep
+import argparse
+from time import monotonic, sleep
+from select import select
 
-PORT = '/dev/ttyUSB1'
+BAUDRATE = 19200
+MEMLEN = 0x80
+MODELOFT = 0x40
+MODEL = 'SPM24121'
+CONFIG = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      'spm_config.bin')
+INFO = b'\x04\x05\x01'
+MONLEN = 0x10
+MON1_VOLTS = 9
+MON2_SPEED = 0
+MON2_CURRENT = 2
+MON2_FAULT = 3
 
-logging.basicConfig(level=logging.DEBUG)
+logging.basicConfig(level=logging.INFO, format='%(message)s')
 _log = logging.getLogger('fakespm')
 
-s = Spm(PORT)
-s.load('spm24121_factory.bin')
-s._open()
-while True:
-    rv = s._readraw()
-    if rv is not None:
-        hdr = rv[0]
-        blen = rv[1]
-        body = rv[2]
-
-        if hdr == 0x11:
-            s._sendmsg(0x11, b'\x04\x05\x01')
-        elif hdr == 0xf1:
-            s._sendmsg(0xf1)
-        elif hdr == 0xf2:
-            offset = body[2]
-            rlen = body[3]
-            _log.debug('Sending offset=%02x, rlen=%02x', offset, rlen)
-            s._sendmsg(0xf2, s._config[offset:offset + rlen])
-        elif hdr == 0xf3:
-            s._sendmsg(0xf3)
+
+class Link:
+    """Raw byte link on a pty master or serial port"""
+
+    def __init__(self, port=None):
+        self._serial = None
+        self._fd = None
+        self.name = port
+        if port is not None:
+            from serial import Serial
+            self._serial = Serial(port=port, baudrate=BAUDRATE, timeout=0)
+            self._fd = self._serial.fileno()
+        else:
+            self._fd, slave = os.openpty()
+            tty.setraw(slave)
+            self.name = os.ttyname(slave)
+            self._slave = slave
+
+    def read(self, timeout):
+        r, w, x = select((self._fd, ), (), (), timeout)
+        if r:
+            try:
+                return os.read(self._fd, 64)
+            except OSError:
+                # pty slave not yet opened by a client
+                sleep(timeout)
+        return b''
+
+    def write(self, buf):
+        if buf:
+            os.write(self._fd, buf)
+
+
+class FakeSpm:
+    """SPM protocol state with fault injection"""
+
+    def __init__(self, link, args):
+        self.link = link
+        self.args = args
+        self.mem = bytearray(MEMLEN)
+        with open(args.config, 'rb') as f:
+            src = f.read(MEMLEN)
+        self.mem[0:len(src)] = src
+        model = args.model.encode('ascii')[0:8].ljust(8, b'\x00')
+        self.mem[MODELOFT:MODELOFT + 8] = model
+        self.pending = None
+        self.buf = bytearray()
+        self.logfile = None
+        if args.log:
+            self.logfile = open(args.log, 'w')
+            self.logfile.write('time,dir,hdr,len,fault\n')
+        self.asleep = True
+        self.wakeat = 0.0
+        self.writes = 0
+        self.session = None
+        self.monstart = None
+
+    def _record(self, direction, hdr, blen, fault=''):
+        now = monotonic()
+        if self.logfile is not None:
+            self.logfile.write('%0.6f,%s,0x%02x,%d,%s\n' %
+                               (now, direction, hdr, blen, fault))
+        if fault:
+            self.session['faults'][fault] = self.session['faults'].get(
+                fault, 0) + 1
+
+    def _mark(self, key):
+        if key not in self.session:
+            self.session[key] = monotonic()
+
+    def _start(self, now):
+        self.session = {'start': now, 'faults': {}, 'requests': 0}
+        self.monstart = None
+        self.asleep = True
+        self.wakeat = now + self.args.wake / 1000.0
+        self.writes = 0
+        self.pending = None
+
+    def _finish(self):
+        s = self.session
+        self.session = None
+        if s is None:
+            return
+        t0 = s['start']
+        msg = ['Session: %d requests' % (s['requests'], )]
+        for key in ('connect', 'read', 'write', 'commit', 'reset',
+                    'monitor', 'stall', 'fault'):
+            if key in s:
+                msg.append('%s %0.3fs' % (key, s[key] - t0))
+        msg.append('total %0.3fs' % (s['last'] - t0, ))
+        if s['faults']:
+            msg.append('faults: ' + ', '.join(
+                '%s=%d' % (k, v) for k, v in sorted(s['faults'].items())))
+        _log.info(', '.join(msg))
+
+    def _send(self, hdr, body=b''):
+        pkt = bytearray((hdr, len(body)))
+        pkt.extend(body)
+        pkt.append(sum(pkt) & 0xff)
+        fault = ''
+        if random.random() < self.args.badsum:
+            pkt[-1] ^= 0x5a
+            fault = 'badsum'
+        if self.args.drop:
+            out = bytearray()
+            for b in pkt:
+                if random.random() < self.args.drop:
+                    fault = 'drop'
+                else:
+                    out.append(b)
+            pkt = out
+        if self.args.latency:
+            sleep(self.args.latency / 1000.0)
+        self.link.write(bytes(pkt))
+        self._record('tx', hdr, len(body), fault)
+
+    def _reset(self):
+        """Controller resets mid-write, losing uncommitted memory"""
+        self._record('rx', 0xf3, 0x10, 'reset')
+        self._mark('reset')
+        self.pending = None
+        self.asleep = True
+        self.wakeat = monotonic() + self.args.reset_time / 1000.0
+
+    def _packet(self, hdr, body):
+        self.session['requests'] += 1
+        self._record('rx', hdr, len(body))
+        if hdr == 0xf1:
+            self._send(0xf1)
+        elif hdr == 0x11:
+            self._mark('connect')
+            self._send(0x11, INFO)
+        elif hdr == 0xf2 and len(body) == 3:
+            oft = body[0] & 0x7f
+            rlen = min(body[1], MEMLEN - oft)
+            mem = self.pending if self.pending is not None else self.mem
+            self._send(0xf2, bytes(mem[oft:oft + rlen]))
+            if oft + rlen >= MEMLEN:
+                self._mark('read')
+        elif hdr == 0xf3 and len(body) >= 3:
+            self.writes += 1
+            if self.args.reset_after and self.writes == self.args.reset_after:
+                self._reset()
+                return
+            if self.pending is None:
+                self.pending = bytearray(self.mem)
+            oft = body[0] & 0x7f
+            wlen = min(body[1], MEMLEN - oft, len(body) - 3)
+            self.pending[oft:oft + wlen] = body[3:3 + wlen]
+            self._send(0xf3, b'\x00')
+            if oft + wlen >= MEMLEN:
+                self._mark('write')
+        elif hdr == 0x3b:
+            mon = bytearray(MONLEN)
+            mon[MON1_VOLTS] = self.args.volts
+            self._send(0x3b, bytes(mon))
+        elif hdr == 0x3c:
+            self._send(0x3c, self._monitor2())
         elif hdr == 0xf4:
-            s._sendmsg(0xf4)
+            if self.pending is not None:
+                self.mem = self.pending
+                self.pending = None
+            self._mark('commit')
+            self._send(0xf4)
         else:
-            _log.debug('Unknown message - ignored')
+            _log.debug('Unknown message 0x%02x - ignored', hdr)
+
+    def _monitor2(self):
+        """Speed, current and fault, jammed after --stall-after seconds"""
+        now = monotonic()
+        if self.monstart is None:
+            self.monstart = now
+            self._mark('monitor')
+        speed = self.args.speed
+        current = self.args.current
+        fault = 0
+        elapsed = now - self.monstart
+        if self.args.stall_after and elapsed >= self.args.stall_after:
+            speed = 0
+            current = 100
+            self._mark('stall')
+        if self.args.fault_after and elapsed >= self.args.fault_after:
+            fault = self.args.fault
+            self._mark('fault')
+        mon = bytearray(MONLEN)
+        mon[MON2_SPEED:MON2_SPEED + 2] = speed.to_bytes(2, 'big')
+        mon[MON2_CURRENT] = current
+        mon[MON2_FAULT:MON2_FAULT + 2] = fault.to_bytes(2, 'big')
+        return bytes(mon)
+
+    def _receive(self, data, now):
+        if self.session is None:
+            self._start(now)
+        self.session['last'] = now
+        if self.asleep:
+            if now < self.wakeat:
+                # controller still waking, input is lost
+                self._record('rx', data[0], len(data), 'asleep')
+                return
+            self.asleep = False
+            self.buf.clear()
+        self.buf.extend(data)
+        while len(self.buf) >= 3:
+            blen = self.buf[1]
+            if blen > 0x20:
+                self.buf.pop(0)
+                continue
+            total = 3 + blen
+            if len(self.buf) < total:
+                break
+            pkt = self.buf[0:total]
+            del self.buf[0:total]
+            if sum(pkt[0:-1]) & 0xff != pkt[-1]:
+                self._record('rx', pkt[0], blen, 'rxsum')
+                continue
+            self._packet(pkt[0], bytes(pkt[2:-1]))
+            if self.asleep:
+                self.buf.clear()
+                break
+
+    def run(self):
+        _log.info('Fake SPM %s on %s', self.args.model, self.link.name)
+        while True:
+            data = self.link.read(0.05)
+            now = monotonic()
+            if data:
+                self._receive(data, now)
+            elif self.session is not None:
+                if now - self.session['last'] > self.args.idle:
+                    self._finish()
+                    self.buf.clear()
+                    if self.logfile is not None:
+                        self.logfile.flush()
+
+
+def main():
+    p = argparse.ArgumentParser(description='Fault-injecting fake SPM')
+    p.add_argument('--port', help='serial port, default new pty')
+    p.add_argument('--config', default=CONFIG,
+                   help='controller memory image')
+    p.add_argument('--model', default=MODEL, help='model string at 0x40')
+    p.add_argument('--latency', type=float, default=0.0,
+                   help='delay before each reply, ms')
+    p.add_argument('--wake', type=float, default=0.0,
+                   help='ignore input for ms after idle')
+    p.add_argument('--drop', type=float, default=0.0,
+                   help='probability of dropping each reply byte')
+    p.add_argument('--badsum', type=float, default=0.0,
+                   help='probability of a bad reply checksum')
+    p.add_argument('--reset-after', type=int, default=0,
+                   help='reset on this memory write request')
+    p.add_argument('--reset-time', type=float, default=500.0,
+                   help='time to recover from reset, ms')
+    p.add_argument('--volts', type=int, default=13,
+                   help='reported battery voltage, V')
+    p.add_argument('--speed', type=int, default=1000,
+                   help='reported motor speed, rpm')
+    p.add_argument('--current', type=int, default=30,
+                   help='reported motor current, %% of max')
+    p.add_argument('--stall-after', type=float, default=0.0,
+                   help='report a jammed motor after seconds of polling')
+    p.add_argument('--fault', type=lambda v: int(v, 0), default=0x0001,
+                   help='controller error flags for --fault-after')
+    p.add_argument('--fault-after', type=float, default=0.0,
+                   help='report a controller fault after seconds of polling')
+    p.add_argument('--idle', type=float, default=1.0,
+                   help='idle seconds between sync sessions')
+    p.add_argument('--seed', type=int, help='fault random seed')
+    p.add_argument('--log', help='write packet timing log to csv file')
+    p.add_argument('-v', '--verbose', action='store_true')
+    args = p.parse_args()
+    if args.verbose:
+        _log.setLevel(logging.DEBUG)
+    random.seed(args.seed)
+
+    spm = FakeSpm(Link(args.port), args)
+    try:
+        spm.run()
+    except KeyboardInterrupt:
+        spm._finish()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,247 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""hhreplay.py
+
+Summarise an hhconfig telemetry log, or replay its inputs through the
+host-built state machine and compare the resulting state transitions.
+
+Usage: hhreplay.py [-s] [-t TICKS] [--sim PATH] LOG [LOG ...]
+
+Build the replay harness with:
+
+	$ make hoistreplay
+
+Replay starts at the first stationary state recorded in each session,
+with the most recent configuration values. Recorded up, down, home,
+stall and sag triggers, battery voltage, value changes and random
+feed delays are fed back at their device clock, then each recorded
+state transition is checked against the simulation.
+
+Firmware before v25004 logged feed and safe time timeouts as up and
+down triggers, so sessions booted on it are summarised but not
+replayed.
+"""
+
+import os
+import re
+import sys
+import argparse
+import subprocess
+from time import monotonic
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'util',
+                                'hhconfig'))
+import hhconfig
+
+EXTERNAL = ('up', 'down', 'home', 'stall', 'sag')
+STATES = ('[STOP]', '[STOP H-P1]', '[STOP P1-P2]', '[AT H]', '[AT P1]',
+          '[AT P2]', '[MOVE H-P1]', '[MOVE P1-P2]', '[MOVE -H]',
+          '[MOVE MAN]', '[Unknown/Error]')
+STATIONARY = ('[STOP]', '[STOP H-P1]', '[STOP P1-P2]', '[AT H]', '[AT P1]',
+              '[AT P2]')
+BURST = 200  # host ms between a trigger and the state line it caused
+NAMED = 25004  # first firmware to log every trigger by event name
+FEEDIN = re.compile(r'Feed in \(min\): (\d+)')
+BOOT = re.compile(r'Info: Boot v(\d+)')
+SIMSTATE = re.compile(r'(State|Sync): (\[[^\]]*\])( \[Error\])? @(\d+)')
+
+
+def adch(decivolts):
+    """Return battery ADC reading for a console voltage"""
+    return min(0xff, (decivolts * 80 + 64) // 128)
+
+
+def load(filenames):
+    recs = []
+    for f in filenames:
+        recs.extend(hhconfig.readlog(f))
+    return recs
+
+
+def summary(recs):
+    """Print trigger counts, time in state and voltage range"""
+    triggers = {}
+    states = {}
+    volts = []
+    sessions = 0
+    last = None
+    for r in recs:
+        kind = r[1]
+        if kind == hhconfig._LOG_TRIGGER:
+            triggers[r[2]] = triggers.get(r[2], 0) + 1
+            if r[2] == 'reset':
+                sessions += 1
+                last = None
+        elif kind == hhconfig._LOG_STATE:
+            if r[4]:
+                volts.append(r[4])
+            if r[3] is not None:
+                if last is not None and r[3] >= last[1]:
+                    states[last[0]] = states.get(last[0],
+                                                 0) + r[3] - last[1]
+                last = (r[2], r[3])
+    span = (recs[-1][0] - recs[0][0]) / 3600000.0 if recs else 0.0
+    print('Records: %d over %0.1f hours, %d resets' %
+          (len(recs), span, sessions))
+    if volts:
+        print('Battery: min %0.1fV, mean %0.1fV, max %0.1fV' %
+              (min(volts) / 10.0, sum(volts) / len(volts) / 10.0,
+               max(volts) / 10.0))
+    print('Triggers:')
+    for t in sorted(triggers, key=lambda k: -triggers[k]):
+        print('\t%-10s %d' % (t, triggers[t]))
+    print('Time in state:')
+    for s in sorted(states, key=lambda k: -states[k]):
+        print('\t%-16s %0.1f h' % (s, states[s] / 360000.0))
+
+
+def mkinputs(recs):
+    """Return replay inputs and recorded transitions, per session"""
+    sessions = []
+    inputs = None
+    trans = None
+    values = {}
+    anchor = None
+    state = None
+    volts = None
+    legacy = False
+    for i, r in enumerate(recs):
+        when, kind, sym, clock = r[0], r[1], r[2], r[3]
+        est = None
+        if anchor is not None:
+            est = anchor[1] + (when - anchor[0]) // 10
+        if kind == hhconfig._LOG_STATE and clock is not None:
+            anchor = (when, clock)
+            if r[4] and adch(r[4]) != volts:
+                volts = adch(r[4])
+                if inputs is not None:
+                    inputs.append((clock, 'volts %d' % (volts, )))
+            if inputs is None and not legacy:
+                if sym in STATIONARY:
+                    inputs = []
+                    trans = []
+                    sessions.append((inputs, trans))
+                    if volts is not None:
+                        inputs.append((clock, 'volts %d' % (volts, )))
+                    for k in values:
+                        inputs.append((clock, 'set %d %d' %
+                                       (ord(hhconfig._CFGKEYS[k]), values[k])))
+                    inputs.append((clock, 'sync %d %d' %
+                                   (STATES.index(sym), r[5])))
+                    state = (sym, r[5])
+            elif (sym, r[5]) != state:
+                state = (sym, r[5])
+                trans.append((clock, sym, r[5]))
+        elif kind == hhconfig._LOG_TRIGGER:
+            if sym == 'reset':
+                inputs = None
+                state = None
+                anchor = None
+            elif sym in EXTERNAL and inputs is not None:
+                # take exact clock from the state line this trigger caused
+                for n in recs[i + 1:]:
+                    if n[0] - when > BURST or n[1] == hhconfig._LOG_TRIGGER:
+                        break
+                    if n[1] == hhconfig._LOG_STATE and n[3] is not None:
+                        est = n[3]
+                        break
+                if est is not None:
+                    inputs.append((est, 'trigger %s' % (sym, )))
+        elif kind == hhconfig._LOG_VALUE:
+            if sym in hhconfig._CFGKEYS:
+                values[sym] = r[6]
+                if inputs is not None and est is not None:
+                    inputs.append(
+                        (est, 'set %d %d' % (ord(hhconfig._CFGKEYS[sym]), r[6])))
+        elif kind == hhconfig._LOG_TEXT:
+            m = FEEDIN.match(sym)
+            if m is not None and inputs is not None and anchor is not None:
+                if when - anchor[0] <= BURST:
+                    est = anchor[1]
+                inputs.append((est, 'feedin %s' % (m.group(1), )))
+            elif sym.startswith('Info: Boot'):
+                m = BOOT.match(sym)
+                legacy = m is not None and int(m.group(1)) < NAMED
+                inputs = None
+                state = None
+                anchor = None
+    return sessions
+
+
+def simulate(sim, inputs):
+    """Run inputs through the replay harness, return transitions"""
+    lines = []
+    for clock, cmd in sorted(inputs, key=lambda x: x[0]):
+        lines.append('%d %s\n' % (clock, cmd))
+    if inputs:
+        lines.append('%d end\n' % (max(x[0] for x in inputs) + 1, ))
+    res = subprocess.run([sim],
+                         input=''.join(lines),
+                         capture_output=True,
+                         text=True,
+                         check=True)
+    trans = []
+    for l in res.stdout.split('\n'):
+        m = SIMSTATE.match(l)
+        if m is not None and m.group(1) == 'State':
+            trans.append((int(m.group(4)), m.group(2),
+                          1 if m.group(3) else 0))
+    return trans
+
+
+def compare(recorded, simulated, ticks):
+    """Return count matched, max skew and first divergence or None"""
+    skew = 0
+    for i, r in enumerate(recorded):
+        if i >= len(simulated):
+            return i, skew, (r, None)
+        s = simulated[i]
+        if s[1:] != r[1:] or abs(s[0] - r[0]) > ticks:
+            return i, skew, (r, s)
+        skew = max(skew, abs(s[0] - r[0]))
+    return len(recorded), skew, None
+
+
+def fmt(t):
+    if t is None:
+        return '[none]'
+    return '%s%s @%d' % (t[1], ' [Error]' if t[2] else '', t[0])
+
+
+def main():
+    p = argparse.ArgumentParser(description='Telemetry log replay')
+    p.add_argument('-s', '--summary', action='store_true',
+                   help='summarise log only')
+    p.add_argument('-t', '--ticks', type=int, default=5,
+                   help='allowed clock skew in 0.01s ticks')
+    p.add_argument('--sim', default='./hoistreplay', help='replay harness')
+    p.add_argument('log', nargs='+')
+    a = p.parse_args()
+
+    start = monotonic()
+    recs = load(a.log)
+    print('Read %d records in %0.3fs' % (len(recs), monotonic() - start))
+    if a.summary:
+        summary(recs)
+        return 0
+
+    ret = 0
+    total = 0
+    matched = 0
+    for n, (inputs, recorded) in enumerate(mkinputs(recs)):
+        simulated = simulate(a.sim, inputs)
+        count, skew, diverge = compare(recorded, simulated, a.ticks)
+        total += len(recorded)
+        matched += count
+        print('Session %d: %d/%d transitions match, max skew %d ticks' %
+              (n + 1, count, len(recorded), skew))
+        if diverge is not None:
+            print('\tRecorded:  %s\n\tSimulated: %s' % (fmt(diverge[0]),
+                                                      fmt(diverge[1])))
+            ret = 1
+    print('Matched %d/%d transitions' % (matched, total))
+    return ret
+
+
+if __name__ == '__main__':
+    sys.exit(main())
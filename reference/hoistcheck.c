@@ -0,0 +1,1143 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Exhaustive state-space checker for the hoist state machine
+ *
+ * Builds the firmware state machine for the host and explores every
+ * reachable machine state under all input edges in breadth-first
+ * order, checking output invariants and that the home position
+ * remains reachable. Every trigger in every reached state is checked
+ * against the transition spec, parsed here independently of the
+ * generated table. Violations are reported with a minimal input
+ * trace from reset.
+ *
+ * Usage: hoistcheck [-v] [state_table.txt]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// Deterministic feed scheduling keeps the state space finite
+#define random model_random
+// Check the telemetry stall stop path
+#define STALL_STOP	1U
+#define main firmware_main
+static long model_random(void);
+#include "../src/system.c"
+#include "../src/timer.c"
+#include "../src/throttle.c"
+#include "../src/travel.c"
+#include "../src/state_table.c"
+#include "../src/main.c"
+#undef main
+#undef random
+
+#define MODEL_SINCE	51U	// clip state age beyond the tangle threshold
+#define MODEL_SHORT	20U	// ticks per short wait
+#define MODEL_FAR	250U	// deadlines beyond this are not distinguished
+#define MODEL_REPORT	3U	// traces reported per invariant
+#define NODE_NONE	0xffffffffU
+#define MODEL_TABLE	"reference/state_table.txt"
+
+volatile uint8_t host_regs[0x100];
+
+static long model_random(void)
+{
+	return 0x40000000L;
+}
+
+// Console, entropy and SPM stubs
+void console_flush(void)
+{
+}
+
+void console_drain(void)
+{
+}
+
+void console_read(void)
+{
+}
+
+uint8_t console_busy(void)
+{
+	return 0;
+}
+
+uint8_t console_next(struct console_event *event)
+{
+	(void) event;
+	return 0;
+}
+
+void console_showval(const char *message, uint16_t value)
+{
+	(void) message;
+	(void) value;
+}
+
+void console_showlong(const char *message, uint32_t value)
+{
+	(void) message;
+	(void) value;
+}
+
+void console_showvals(const char *message, const uint16_t *vals, uint8_t len)
+{
+	(void) message;
+	(void) vals;
+	(void) len;
+}
+
+void console_showstate(uint8_t state, uint8_t error, uint8_t vsense)
+{
+	(void) state;
+	(void) error;
+	(void) vsense;
+}
+
+void console_showhex(const char *message, uint8_t * buf, uint8_t len)
+{
+	(void) message;
+	(void) buf;
+	(void) len;
+}
+
+void console_showascii(const char *message, uint8_t * buf, uint8_t len)
+{
+	(void) message;
+	(void) buf;
+	(void) len;
+}
+
+void console_write(const char *message)
+{
+	(void) message;
+}
+
+void console_init(void)
+{
+}
+
+void entropy_init(void)
+{
+}
+
+void entropy_poll(void)
+{
+}
+
+// Battery admits a feed in the high voltage band
+struct battery battery;
+
+void battery_init(void)
+{
+}
+
+void battery_update(void)
+{
+}
+
+uint16_t battery_charge(void)
+{
+	return 0;
+}
+
+uint16_t battery_resist(void)
+{
+	return 0;
+}
+
+uint16_t battery_feed(void)
+{
+	return 0;
+}
+
+uint16_t battery_after(void)
+{
+	return 0;
+}
+
+uint8_t battery_admit(void)
+{
+	return ADCH >= NIGHTVOLTS;
+}
+
+void battery_feed_start(void)
+{
+}
+
+void battery_feed_end(void)
+{
+}
+
+// Wear counters are not modelled
+struct wear wears[HOIST_COUNT];
+struct wear_boot wear_boot;
+
+void wear_init(void)
+{
+}
+
+void wear_update(void)
+{
+}
+
+void wear_poll(void)
+{
+}
+
+void wear_reset(uint8_t cause)
+{
+	(void) cause;
+}
+
+void wear_error(uint8_t cause)
+{
+	(void) cause;
+}
+
+void wear_home(uint16_t ticks, uint8_t timed)
+{
+	(void) ticks;
+	(void) timed;
+}
+
+uint16_t wear_min(void)
+{
+	return 0;
+}
+
+uint16_t wear_mean(void)
+{
+	return 0;
+}
+
+uint16_t wear_max(void)
+{
+	return 0;
+}
+
+// Sag stalls are not modelled, controller stalls take the same paths
+void sag_init(void)
+{
+}
+
+void sag_update(void)
+{
+}
+
+void sag_start(void)
+{
+}
+
+void sag_stop(uint8_t learn)
+{
+	(void) learn;
+}
+
+uint8_t sag_check(void)
+{
+	return 0;
+}
+
+uint16_t sag_normal(uint8_t dir)
+{
+	(void) dir;
+	return 0;
+}
+
+uint8_t modbus_addr;
+
+void modbus_select(uint8_t addr)
+{
+	(void) addr;
+}
+
+void modbus_init(void)
+{
+}
+
+void modbus_poll(void)
+{
+}
+
+void spm_check(void)
+{
+}
+
+// Controller telemetry reports a fault on the next poll when set
+struct spm_telemetry spm_telemetry;
+static uint8_t model_fault;
+
+void spm_poll_start(void)
+{
+}
+
+void spm_poll_stop(void)
+{
+}
+
+uint8_t spm_poll(void)
+{
+	spm_telemetry.fault = model_fault;
+	spm_telemetry.speed = 1U;
+	return model_fault;
+}
+
+// Model inputs
+enum model_input {
+	in_home_close,
+	in_home_open,
+	in_up,
+	in_down,
+	in_console_down,
+	in_console_up,
+	in_wait,
+	in_short,
+	in_volt_low,
+	in_volt_mid,
+	in_volt_high,
+	in_stall,
+	in_watchdog,
+	in_count,
+};
+
+static const char *const input_name[in_count] = {
+	"home switch closes",
+	"home switch opens",
+	"remootio up",
+	"remootio down",
+	"console d",
+	"console u",
+	"wait for next timeout",
+	"wait 0.2s",
+	"battery low",
+	"battery mid",
+	"battery charged",
+	"controller fault",
+	"watchdog reset",
+};
+
+static const uint8_t volt_band[3] = { 0x40, 0x50, 0x60 };
+
+#define OUTMASK	(_BV(FWD) | _BV(REV) | _BV(PWR) | _BV(THROTTLE) | _BV(ATP1))
+
+// Complete mutable firmware state
+struct snapshot {
+	struct state_machine feed;
+	struct timer_list timers;
+	struct ramp ramp;
+	struct drive drive;
+	struct travel travel;
+	struct warm_state warm;
+	uint8_t bstate;
+	uint8_t reset_cause;
+	uint8_t tccr2a;
+	uint8_t pinc;
+	uint8_t portd;
+	uint8_t adch;
+	uint8_t systick;
+};
+
+// Canonical state, independent of absolute clock
+struct key {
+	uint8_t state;
+	uint8_t error;
+	uint8_t bstate;
+	uint8_t outputs;
+	uint8_t drive;
+	uint8_t count;
+	uint8_t pending;
+	uint8_t level;
+	uint8_t adch;
+	uint8_t since;
+	uint8_t resumes;
+	uint16_t p1;
+	uint16_t p2;
+	uint16_t nf_timeout;
+	uint32_t remain[timer_count];
+	timer_callback fn[timer_count];
+};
+
+struct node {
+	struct snapshot snap;
+	struct key key;
+	uint32_t parent;
+	uint8_t input;
+};
+
+struct edge {
+	uint32_t from;
+	uint32_t to;
+};
+
+static struct node *nodes;
+static uint32_t nodecount;
+static uint32_t nodecap;
+static uint32_t *hashtab;
+static uint32_t hashsize;
+static struct edge *edges;
+static uint32_t edgecount;
+static uint32_t edgecap;
+static uint32_t transitions;
+static int verbose;
+
+static void *xrealloc(void *ptr, size_t len)
+{
+	void *ret = realloc(ptr, len);
+	if (ret == NULL) {
+		fprintf(stderr, "hoistcheck: Out of memory\n");
+		exit(2);
+	}
+	return ret;
+}
+
+static void save(struct snapshot *s)
+{
+	s->feed = *feed;
+	s->timers = *tl;
+	s->ramp = *ramp;
+	s->drive = drives[0];
+	s->travel = *travel;
+	s->warm = warm[0];
+	s->bstate = bstate;
+	s->reset_cause = reset_cause;
+	s->tccr2a = TCCR2A;
+	s->pinc = PINC;
+	s->portd = PORTD;
+	s->adch = ADCH;
+	s->systick = SYSTICK;
+}
+
+static void restore(const struct snapshot *s)
+{
+	*feed = s->feed;
+	*tl = s->timers;
+	*ramp = s->ramp;
+	drives[0] = s->drive;
+	*travel = s->travel;
+	warm[0] = s->warm;
+	bstate = s->bstate;
+	reset_cause = s->reset_cause;
+	TCCR2A = s->tccr2a;
+	PINC = s->pinc;
+	PORTD = s->portd;
+	ADCH = s->adch;
+	SYSTICK = s->systick;
+	// align debounce history with the stable input state
+	read_inputs();
+}
+
+static void makekey(struct key *k)
+{
+	uint32_t age = feed->clock - feed->since;
+	uint8_t id;
+	memset(k, 0, sizeof(*k));
+	k->state = feed->state;
+	k->error = feed->error;
+	k->bstate = bstate;
+	// throttle ramp level only matters while ramping down to stop
+	k->outputs = PORTD & OUTMASK & (uint8_t) ~_BV(THROTTLE);
+	k->drive = drives[0].phase;
+	k->count = drives[0].count;
+	k->pending = drives[0].pending;
+	if (drives[0].phase == drive_ramp) {
+		k->level = (uint8_t) (ramp->level >> 8);
+	}
+	k->adch = ADCH;
+	k->since = age > MODEL_SINCE ? MODEL_SINCE : (uint8_t) age;
+	k->resumes = warm[0].resumes;
+	// travel is only resumed from the partial move states
+	if (feed->state == state_move_h_p1 || feed->state == state_stop_h_p1) {
+		k->p1 = feed->p1;
+	}
+	if (feed->state == state_move_p1_p2 || feed->state == state_stop_p1_p2) {
+		k->p2 = feed->p2;
+	}
+	k->nf_timeout = feed->nf_timeout;
+	for (id = tl->head; id != TIMER_NONE; id = tl->next[id]) {
+		k->remain[id] = tl->deadline[id] - feed->clock + 1U;
+		if (k->remain[id] > MODEL_FAR) {
+			k->remain[id] = MODEL_FAR;
+		}
+		k->fn[id] = tl->callback[id];
+	}
+}
+
+static uint32_t keyhash(const struct key *k)
+{
+	const uint8_t *p = (const uint8_t *) k;
+	uint32_t h = 2166136261U;
+	size_t i;
+	for (i = 0; i < sizeof(*k); i++) {
+		h = (h ^ p[i]) * 16777619U;
+	}
+	return h;
+}
+
+static void rehash(void)
+{
+	uint32_t i;
+	hashsize = hashsize ? hashsize * 2U : 0x10000U;
+	hashtab = xrealloc(hashtab, hashsize * sizeof(uint32_t));
+	for (i = 0; i < hashsize; i++) {
+		hashtab[i] = NODE_NONE;
+	}
+	for (i = 0; i < nodecount; i++) {
+		uint32_t h = keyhash(&nodes[i].key) & (hashsize - 1U);
+		while (hashtab[h] != NODE_NONE) {
+			h = (h + 1U) & (hashsize - 1U);
+		}
+		hashtab[h] = i;
+	}
+}
+
+// Return index of node matching current state, adding it if new
+static uint32_t lookup(uint32_t parent, uint8_t input, int *isnew)
+{
+	struct key k;
+	uint32_t h;
+	makekey(&k);
+	if (nodecount * 2U >= hashsize) {
+		rehash();
+	}
+	h = keyhash(&k) & (hashsize - 1U);
+	while (hashtab[h] != NODE_NONE) {
+		if (memcmp(&nodes[hashtab[h]].key, &k, sizeof(k)) == 0) {
+			*isnew = 0;
+			return hashtab[h];
+		}
+		h = (h + 1U) & (hashsize - 1U);
+	}
+	if (nodecount == nodecap) {
+		nodecap = nodecap ? nodecap * 2U : 0x4000U;
+		nodes = xrealloc(nodes, nodecap * sizeof(struct node));
+	}
+	save(&nodes[nodecount].snap);
+	nodes[nodecount].key = k;
+	nodes[nodecount].parent = parent;
+	nodes[nodecount].input = input;
+	hashtab[h] = nodecount;
+	*isnew = 1;
+	return nodecount++;
+}
+
+static void add_edge(uint32_t from, uint32_t to)
+{
+	if (edgecount == edgecap) {
+		edgecap = edgecap ? edgecap * 2U : 0x10000U;
+		edges = xrealloc(edges, edgecap * sizeof(struct edge));
+	}
+	edges[edgecount].from = from;
+	edges[edgecount].to = to;
+	++edgecount;
+}
+
+static void tick(void)
+{
+	++SYSTICK;
+	update_state(SYSTICK);
+}
+
+static void settle(void)
+{
+	tick();
+	tick();
+}
+
+static void pulse(uint8_t bit)
+{
+	PINC &= (uint8_t) ~_BV(bit);
+	settle();
+	PINC |= (uint8_t) _BV(bit);
+	settle();
+}
+
+static void console_event(uint8_t type)
+{
+	struct console_event event;
+	event.type = type;
+	event.key = 0;
+	event.value = 0;
+	handle_event(&event);
+}
+
+// Snapshot taken by the main loop, then reset with RAM retained
+static void watchdog_reset(void)
+{
+	warm_save();
+	feed->state = 0;
+	feed->error = 0;
+	feed->p1 = 0;
+	feed->p2 = 0;
+	feed->clock = 0;
+	feed->since = 0;
+	feed->nf_timeout = 0;
+	bstate = INPUT_IDLE;
+	// input filters restart, a closed home switch is accepted again
+	count0 = 0;
+	count1 = 0;
+	count2 = 0;
+	memset(travel, 0, sizeof(*travel));
+	stall_over = 0;
+	stall_still = 0;
+	stall_seen = 0;
+	memset(drives, 0, sizeof(drives));
+	PORTD = 0;
+	SYSTICK = 0;
+	timer_cancel_all();
+	throttle_init();
+	read_inputs();
+	reset_cause = _BV(WDRF);
+	restart();
+	settle();
+}
+
+// Apply input to restored state, return 0 if not applicable
+static int apply(uint8_t input, int *physical)
+{
+	uint8_t portd = PORTD;
+	uint32_t jump;
+	*physical = 1;
+	switch (input) {
+	case in_home_close:
+		if (PINC & _BV(S1)) {
+			return 0;
+		}
+		// limit switch closes only when raised onto it
+		*physical = (portd & _BV(REV)) != 0;
+		PINC |= (uint8_t) _BV(S1);
+		settle();
+		break;
+	case in_home_open:
+		if (!(PINC & _BV(S1))) {
+			return 0;
+		}
+		*physical = (portd & _BV(FWD)) != 0;
+		PINC &= (uint8_t) ~_BV(S1);
+		settle();
+		break;
+	case in_up:
+		pulse(S3);
+		break;
+	case in_down:
+		pulse(S4);
+		break;
+	case in_console_down:
+		console_event(event_down);
+		settle();
+		break;
+	case in_console_up:
+		console_event(event_up);
+		settle();
+		break;
+	case in_wait:
+		// deadlines are skipped to, starts and stops run tick by tick
+		if (tl->head == TIMER_NONE
+		    || (drives[0].phase != drive_off
+			&& drives[0].phase != drive_run)) {
+			return 0;
+		}
+		jump = tl->deadline[tl->head] - feed->clock;
+		if (jump > 1U) {
+			feed->clock += jump - 1U;
+			SYSTICK = (uint8_t) (SYSTICK + jump - 1U);
+		}
+		tick();
+		settle();
+		break;
+	case in_short:
+		for (jump = 0; jump < MODEL_SHORT; jump++) {
+			tick();
+		}
+		break;
+	case in_volt_low:
+	case in_volt_mid:
+	case in_volt_high:
+		if (ADCH == volt_band[input - in_volt_low]) {
+			return 0;
+		}
+		ADCH = volt_band[input - in_volt_low];
+		settle();
+		break;
+	case in_stall:
+		// telemetry is only polled while the controller is powered
+		if (!(portd & _BV(PWR))) {
+			return 0;
+		}
+		model_fault = 1U;
+		tick();
+		model_fault = 0;
+		settle();
+		break;
+	case in_watchdog:
+		watchdog_reset();
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+static void show_trace(uint32_t idx)
+{
+	uint32_t path[256];
+	uint32_t len = 0;
+	while (idx != NODE_NONE && len < 256U) {
+		path[len++] = idx;
+		idx = nodes[idx].parent;
+	}
+	while (len) {
+		const struct node *n = &nodes[path[--len]];
+		uint8_t out = n->snap.portd;
+		if (n->parent == NODE_NONE) {
+			printf("\treset, home switch %s",
+			       (n->snap.pinc & _BV(S1)) ? "closed" : "open");
+		} else {
+			printf("\t%s", input_name[n->input]);
+		}
+		printf(" -> %s%s%s%s%s%s\n", state_label[n->key.state],
+		       n->key.error ? " [Error]" : "",
+		       (out & _BV(PWR)) ? " PWR" : "",
+		       (out & _BV(FWD)) ? " FWD" : "",
+		       (out & _BV(REV)) ? " REV" : "",
+		       (out & _BV(THROTTLE)) ? " THROTTLE" : "");
+	}
+}
+
+// Output invariants
+enum check_id {
+	check_direction,
+	check_stopped,
+	check_moving,
+	check_throttle,
+	check_home,
+	check_table,
+	check_count,
+};
+
+static const char *const check_name[check_count] = {
+	"FWD and REV never both asserted",
+	"PWR off in STOP/AT, after ramp at P1/P2",
+	"MOVE states drive, or hold, one direction",
+	"Throttle CV off whenever PWR is off",
+	"Home reachable from every non-error state",
+	"Triggers follow reference/state_table.txt",
+};
+
+static uint32_t failures[check_count];
+
+// Transition spec, action and next state of each state and event
+struct spec {
+	uint8_t action;
+	uint8_t next;
+};
+
+static struct spec table[STATE_COUNT][EVENT_COUNT];
+
+// Spec action names, bound to firmware actions by name not position
+static const struct {
+	const char *name;
+	uint8_t action;
+} spec_action[] = {
+	{ "spurious", act_spurious },
+	{ "ignore", act_ignore },
+	{ "retry", act_retry },
+	{ "move_up", act_move_up },
+	{ "move_down", act_move_down },
+	{ "start_p1", act_start_p1 },
+	{ "start_p2", act_start_p2 },
+	{ "stop", act_stop },
+	{ "arrive_p1", act_arrive_p1 },
+	{ "home", act_home },
+	{ "error", act_error },
+	{ "fault", act_fault },
+	{ "tangle", act_tangle },
+};
+
+static void spec_error(const char *path, unsigned line, const char *msg)
+{
+	fprintf(stderr, "hoistcheck: %s:%u: %s\n", path, line, msg);
+	exit(2);
+}
+
+// Index of name in list of count names, count if absent
+static uint8_t spec_find(char names[][16], uint8_t count, const char *name)
+{
+	uint8_t i;
+	for (i = 0; i < count; i++) {
+		if (strcmp(names[i], name) == 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+// Parse the transition spec, states and events in firmware enum order
+static void read_table(const char *path)
+{
+	char states[STATE_COUNT][16];
+	char events[EVENT_COUNT][16];
+	char buf[160];
+	char raw[160];
+	uint8_t nstates = 0;
+	uint8_t nevents = 0;
+	unsigned line = 0;
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		exit(2);
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		char *field[4];
+		uint8_t n = 0;
+		char *tok;
+		strcpy(raw, buf);
+		tok = strtok(buf, " \t\r\n");
+		++line;
+		if (tok == NULL || *tok == '#') {
+			continue;
+		}
+		while (tok && n < 4U) {
+			field[n++] = tok;
+			tok = strtok(NULL, " \t\r\n");
+		}
+		if (strcmp(field[0], "state") == 0) {
+			// label runs to the end of the line, shown bracketed
+			char label[sizeof(raw) + 2U];
+			raw[strcspn(raw, "\r\n")] = 0;
+			if (n < 3U || nstates == STATE_COUNT
+			    || strlen(field[1]) >= sizeof(states[0])) {
+				spec_error(path, line, "bad state");
+			}
+			snprintf(label, sizeof(label), "[%s]", raw + (field[2] - buf));
+			if (strcmp(label, state_label[nstates]) != 0) {
+				spec_error(path, line, "state out of order");
+			}
+			strcpy(states[nstates++], field[1]);
+		} else if (strcmp(field[0], "event") == 0) {
+			if (n < 2U || nevents == EVENT_COUNT
+			    || strlen(field[1]) >= sizeof(events[0])) {
+				spec_error(path, line, "bad event");
+			}
+			if (strcmp(field[1], event_name[nevents]) != 0) {
+				spec_error(path, line, "event out of order");
+			}
+			strcpy(events[nevents++], field[1]);
+		} else {
+			uint8_t event = spec_find(events, nevents, field[1]);
+			uint8_t to = STATE_COUNT;
+			uint8_t act = 0;
+			uint8_t from;
+			if (n < 3U || event == nevents) {
+				spec_error(path, line, "bad transition");
+			}
+			while (act < sizeof(spec_action) / sizeof(spec_action[0])
+			       && strcmp(spec_action[act].name, field[2])) {
+				++act;
+			}
+			if (act == sizeof(spec_action) / sizeof(spec_action[0])) {
+				spec_error(path, line, "unknown action");
+			}
+			if (n == 4U) {
+				to = spec_find(states, nstates, field[3]);
+				if (to == nstates) {
+					spec_error(path, line, "unknown state");
+				}
+			}
+			for (from = 0; from < nstates; from++) {
+				if (strcmp(field[0], "*") == 0
+				    || strcmp(field[0], states[from]) == 0) {
+					table[from][event].action =
+					    spec_action[act].action;
+					// no target keeps the state
+					table[from][event].next =
+					    to == STATE_COUNT ? from : to;
+				}
+			}
+		}
+	}
+	fclose(f);
+	if (nstates != STATE_COUNT || nevents != EVENT_COUNT) {
+		spec_error(path, line, "state or event count differs");
+	}
+}
+
+static void fail(uint8_t check, uint32_t idx)
+{
+	if (failures[check] < MODEL_REPORT) {
+		printf("Violation: %s\n", check_name[check]);
+		show_trace(idx);
+	}
+	++failures[check];
+}
+
+// Trigger every event from node and compare with the spec
+static void check_spec(uint32_t idx)
+{
+	uint8_t event;
+	for (event = 0; event < EVENT_COUNT; event++) {
+		const struct spec *t;
+		uint8_t expect;
+		uint8_t error;
+		restore(&nodes[idx].snap);
+		t = &table[feed->state][event];
+		expect = t->next;
+		error = feed->error;
+		switch (t->action) {
+		case act_spurious:
+		case act_ignore:
+		case act_retry:
+			expect = feed->state;
+			break;
+		case act_move_up:
+			// a closed home switch stops with a sensor error
+			if (bstate & pins->home) {
+				expect = state_stop;
+				error = 1U;
+			}
+			break;
+		case act_start_p1:
+			// low voltage holds the hoist at home
+			if (!check_voltage(OVRNONE)) {
+				expect = state_at_h;
+			}
+			break;
+		case act_home:
+			error = 0;
+			break;
+		case act_error:
+		case act_fault:
+			error = 1U;
+			break;
+		case act_tangle:
+			// within 0.5s of the move start the trigger is dropped
+			if (feed->clock - feed->since > 50U) {
+				error = 1U;
+			} else {
+				expect = feed->state;
+			}
+			break;
+		default:
+			break;
+		}
+		trigger(event, OVRNONE);
+		if (feed->state != expect || (feed->error != 0) != error) {
+			fail(check_table, idx);
+			if (failures[check_table] <= MODEL_REPORT) {
+				printf("\ttrigger %s -> %s%s, expected %s%s\n",
+				       event_name[event], state_label[feed->state],
+				       feed->error ? " [Error]" : "",
+				       state_label[expect], error ? " [Error]" : "");
+			}
+			return;
+		}
+	}
+}
+
+static void check_node(uint32_t idx)
+{
+	const struct key *k = &nodes[idx].key;
+	const struct snapshot *s = &nodes[idx].snap;
+	uint8_t out = k->outputs;
+	uint8_t dir = out & (_BV(FWD) | _BV(REV));
+	if (dir == (_BV(FWD) | _BV(REV))) {
+		fail(check_direction, idx);
+	}
+	if (!(out & _BV(PWR))
+	    && (s->ramp.level || (s->portd & _BV(THROTTLE))
+		|| (s->tccr2a & _BV(COM2B1)))) {
+		fail(check_throttle, idx);
+	}
+	switch (k->state) {
+	case state_stop:
+	case state_stop_h_p1:
+	case state_stop_p1_p2:
+	case state_at_h:
+		if (out & _BV(PWR)) {
+			fail(check_stopped, idx);
+		}
+		break;
+	case state_at_p1:
+	case state_at_p2:
+		// timed stops ramp down before power is cut
+		if ((out & _BV(PWR)) && k->drive != drive_ramp
+		    && k->drive != drive_settle) {
+			fail(check_stopped, idx);
+		}
+		break;
+	case state_move_h_p1:
+	case state_move_p1_p2:
+	case state_move_h:
+	case state_move_man:
+		if (k->pending) {
+			// start held until the previous move has stopped
+			if (k->drive == drive_off || k->drive == drive_wake
+			    || k->drive == drive_run
+			    || (k->pending != _BV(FWD)
+				&& k->pending != _BV(REV))) {
+				fail(check_moving, idx);
+			}
+		} else if (!(out & _BV(PWR)) || dir == 0
+			   || dir == (_BV(FWD) | _BV(REV))) {
+			fail(check_moving, idx);
+		}
+		break;
+	default:
+		break;
+	}
+	check_spec(idx);
+}
+
+// Mark every state that can reach AT H over physical edges
+static void check_reachable(void)
+{
+	uint32_t *first = calloc(nodecount + 1U, sizeof(uint32_t));
+	uint32_t *from = malloc((edgecount + 1U) * sizeof(uint32_t));
+	uint32_t *queue = malloc((nodecount + 1U) * sizeof(uint32_t));
+	uint8_t *reach = calloc(nodecount + 1U, 1);
+	uint32_t qh = 0;
+	uint32_t qt = 0;
+	uint32_t i;
+	if (!first || !from || !queue || !reach) {
+		fprintf(stderr, "hoistcheck: Out of memory\n");
+		exit(2);
+	}
+	// reverse adjacency, indexed by destination
+	for (i = 0; i < edgecount; i++) {
+		++first[edges[i].to + 1U];
+	}
+	for (i = 0; i < nodecount; i++) {
+		first[i + 1U] += first[i];
+	}
+	for (i = 0; i < edgecount; i++) {
+		from[first[edges[i].to]++] = edges[i].from;
+	}
+	for (i = nodecount; i > 0; i--) {
+		first[i] = first[i - 1U];
+	}
+	first[0] = 0;
+	for (i = 0; i < nodecount; i++) {
+		if (nodes[i].key.state == state_at_h) {
+			reach[i] = 1U;
+			queue[qt++] = i;
+		}
+	}
+	while (qh < qt) {
+		uint32_t n = queue[qh++];
+		for (i = first[n]; i < first[n + 1U]; i++) {
+			if (!reach[from[i]]) {
+				reach[from[i]] = 1U;
+				queue[qt++] = from[i];
+			}
+		}
+	}
+	for (i = 0; i < nodecount; i++) {
+		if (!reach[i] && !nodes[i].key.error) {
+			fail(check_home, i);
+		}
+	}
+	if (verbose) {
+		printf("%u of %u states can reach AT H\n", qt, nodecount);
+	}
+	free(first);
+	free(from);
+	free(queue);
+	free(reach);
+}
+
+static void model_init(uint8_t homed)
+{
+	memset((void *) host_regs, 0, sizeof(host_regs));
+	memset(feed, 0, sizeof(*feed));
+	// uncalibrated travel, learned times would make the space infinite
+	memset(travel, 0, sizeof(*travel));
+	timer_cancel_all();
+	feed->p1_timeout = 60U;
+	feed->p2_timeout = 60U;
+	feed->man_timeout = 40U;
+	feed->h_timeout = 200U;
+	feed->hr_timeout = 100U;
+	feed->f_timeout = 1U;
+	feed->accel = 20U;
+	feed->decel = 10U;
+	feed->approach = 30U;
+	feed->slow = 40U;
+	throttle_init();
+	feed->nf = 2000U;
+	bstate = INPUT_IDLE;
+	PINC = bstate;
+	ADCH = volt_band[2];
+	read_inputs();
+	trigger_reset();
+	if (homed) {
+		PINC |= (uint8_t) _BV(S1);
+	}
+	settle();
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start;
+	struct timespec end;
+	uint32_t cur;
+	uint32_t total = 0;
+	uint8_t homed;
+	uint8_t input;
+	uint8_t check;
+	double elapsed;
+	int isnew;
+	int physical;
+
+	if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+		verbose = 1;
+		--argc;
+		++argv;
+	}
+	read_table(argc > 1 ? argv[1] : MODEL_TABLE);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (homed = 0; homed < 2U; homed++) {
+		model_init(homed);
+		cur = lookup(NODE_NONE, 0, &isnew);
+		if (isnew) {
+			check_node(cur);
+		}
+	}
+	for (cur = 0; cur < nodecount; cur++) {
+		for (input = 0; input < in_count; input++) {
+			restore(&nodes[cur].snap);
+			if (!apply(input, &physical)) {
+				continue;
+			}
+			++transitions;
+			uint32_t dst = lookup(cur, input, &isnew);
+			if (isnew) {
+				check_node(dst);
+			}
+			if (physical && dst != cur) {
+				add_edge(cur, dst);
+			}
+		}
+	}
+	check_reachable();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (double) (end.tv_sec - start.tv_sec)
+	    + (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+	for (check = 0; check < check_count; check++) {
+		printf("%-44s %s", check_name[check],
+		       failures[check] ? "FAIL" : "ok");
+		if (failures[check]) {
+			printf(" (%u states)", failures[check]);
+		}
+		printf("\n");
+		total += failures[check];
+	}
+	printf("%u states, %u transitions in %0.3fs, %0.0f states/s\n",
+	       nodecount, transitions, elapsed,
+	       elapsed > 0.0 ? (double) nodecount / elapsed : 0.0);
+	return total ? 1 : 0;
+}
@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Replay recorded hoist inputs through the firmware state machine
+ *
+ * Builds the firmware state machine for the host like hoistcheck,
+ * then reads timed inputs from stdin and writes the resulting
+ * console output to stdout. Inputs are one per line, in clock order:
+ *
+ *	clock sync state error	restart at stationary state
+ *	clock set key value	console value command, eg: set 49 1500
+ *	clock volts adch	battery voltage ADC reading
+ *	clock feedin minutes	random feed delay drawn by the hoist
+ *	clock trigger name	external trigger: up, down, home, stall or sag
+ *	clock end		run to clock and stop
+ *
+ * Each sync is reported with a "Sync:" line. The home switch opens
+ * half a second after the motor starts lowering. Random feed delays
+ * draw the maximum unless replaced with feedin, so the replay never
+ * feeds before the recorded hoist.
+ *
+ * Usage: hoistreplay < inputs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define random replay_random
+#define main firmware_main
+static long replay_random(void);
+#include "../src/system.c"
+#include "../src/timer.c"
+#include "../src/throttle.c"
+#include "../src/travel.c"
+#include "../src/battery.c"
+#include "../src/wear.c"
+#include "../src/sag.c"
+#include "../src/state_table.c"
+#include "../src/main.c"
+#undef main
+#undef random
+
+#define HOME_CLEAR	50U	// ticks lowering before home switch opens
+#define LINELEN		128
+
+volatile uint8_t host_regs[0x100];
+
+static uint8_t lowering;
+
+static long replay_random(void)
+{
+	return 0x7fffffffL;
+}
+
+// Console output is written to stdout, SPM is idle
+void console_flush(void)
+{
+}
+
+void console_drain(void)
+{
+}
+
+void console_read(void)
+{
+}
+
+uint8_t console_busy(void)
+{
+	return 0;
+}
+
+uint8_t console_next(struct console_event *event)
+{
+	(void) event;
+	return 0;
+}
+
+void console_showval(const char *message, uint16_t value)
+{
+	printf("%s%u\n", message, value);
+}
+
+void console_showlong(const char *message, uint32_t value)
+{
+	printf("%s%lu\n", message, (unsigned long) value);
+}
+
+void console_showvals(const char *message, const uint16_t *vals, uint8_t len)
+{
+	(void) message;
+	(void) vals;
+	(void) len;
+}
+
+void console_showstate(uint8_t state, uint8_t error, uint8_t vsense)
+{
+	(void) vsense;
+	printf("State: %s%s @%lu\n",
+	       state < STATE_COUNT ? state_label[state] : "[Unknown/Error]",
+	       error ? " [Error]" : "", (unsigned long) feed->clock);
+}
+
+void console_showhex(const char *message, uint8_t * buf, uint8_t len)
+{
+	(void) message;
+	(void) buf;
+	(void) len;
+}
+
+void console_showascii(const char *message, uint8_t * buf, uint8_t len)
+{
+	(void) message;
+	(void) buf;
+	(void) len;
+}
+
+void console_write(const char *message)
+{
+	const char *c;
+	for (c = message; *c; c++) {
+		if (*c != '\r') {
+			putchar(*c);
+		}
+	}
+}
+
+void console_init(void)
+{
+}
+
+void entropy_init(void)
+{
+}
+
+void entropy_poll(void)
+{
+}
+
+uint8_t modbus_addr;
+
+void modbus_select(uint8_t addr)
+{
+	(void) addr;
+}
+
+void modbus_init(void)
+{
+}
+
+void modbus_poll(void)
+{
+}
+
+void spm_check(void)
+{
+}
+
+struct spm_telemetry spm_telemetry;
+
+void spm_poll_start(void)
+{
+}
+
+void spm_poll_stop(void)
+{
+}
+
+uint8_t spm_poll(void)
+{
+	spm_telemetry.speed = 1U;
+	return 0;
+}
+
+static void tick(void)
+{
+	++SYSTICK;
+	update_state(SYSTICK);
+	// hoist leaves the home switch shortly after lowering begins
+	if ((PORTD & _BV(PWR)) && (PORTD & _BV(FWD))) {
+		if (lowering < HOME_CLEAR) {
+			++lowering;
+		} else {
+			PINC &= (uint8_t) ~_BV(S1);
+		}
+	} else {
+		lowering = 0;
+	}
+}
+
+// Run until clock, skipping ahead while the motor is idle
+static void run_to(uint32_t clock)
+{
+	uint32_t jump;
+	while ((int32_t) (clock - feed->clock) > 0) {
+		jump = clock - feed->clock;
+		if (tl->head != TIMER_NONE
+		    && tl->deadline[tl->head] - feed->clock < jump) {
+			jump = tl->deadline[tl->head] - feed->clock;
+		}
+		if (!motor_running() && !lowering && jump > 2U) {
+			// keep two ticks for input debounce
+			jump -= 2U;
+			feed->clock += jump;
+			SYSTICK = (uint8_t) (SYSTICK + jump);
+		} else {
+			tick();
+		}
+	}
+}
+
+static void set_home(uint8_t closed)
+{
+	if (closed) {
+		PINC |= (uint8_t) _BV(S1);
+		bstate |= (uint8_t) _BV(S1);
+	} else {
+		PINC &= (uint8_t) ~_BV(S1);
+		bstate &= (uint8_t) ~_BV(S1);
+	}
+}
+
+// Restart machine at a recorded stationary state
+static void sync_state(uint32_t clock, uint8_t state, uint8_t error)
+{
+	printf("Sync: %s @%lu\n", state_label[state], (unsigned long) clock);
+	timer_cancel_all();
+	PORTD = 0;
+	throttle_init();
+	feed->approach_at = 0;
+	lowering = 0;
+	feed->clock = clock;
+	feed->since = clock;
+	SYSTICK = (uint8_t) clock;
+	feed->state = state;
+	feed->error = error;
+	set_home(state == state_at_h);
+	read_inputs();
+	read_inputs();
+	if (state == state_at_h) {
+		set_randfeed();
+	}
+	arm_timers();
+}
+
+static void set_value(uint8_t key, uint16_t value)
+{
+	struct console_event event;
+	event.type = event_setvalue;
+	event.key = key;
+	event.value = value;
+	handle_event(&event);
+}
+
+static int external(const char *name)
+{
+	if (strcmp(name, "up") == 0) {
+		trigger(trig_up, OVRNONE);
+	} else if (strcmp(name, "down") == 0) {
+		// console and remootio overrides are not distinguished
+		trigger(trig_down, OVRLOW);
+	} else if (strcmp(name, "home") == 0) {
+		set_home(1U);
+		trigger(trig_home, OVRNONE);
+	} else if (strcmp(name, "stall") == 0) {
+		trigger(trig_stall, OVRNONE);
+	} else if (strcmp(name, "sag") == 0) {
+		trigger(trig_sag, OVRNONE);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+int main(void)
+{
+	char line[LINELEN];
+	char cmd[16];
+	char name[16];
+	unsigned long clock;
+	unsigned long a;
+	unsigned long b;
+	unsigned long count = 0;
+
+	memset((void *) host_regs, 0, sizeof(host_regs));
+	memset(hoist, 0, sizeof(hoist));
+	bstate = INPUT_IDLE;
+	PINC = bstate;
+	ADCH = NIGHTVOLTS;
+	throttle_init();
+	read_inputs();
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		if (sscanf(line, "%lu %15s", &clock, cmd) != 2) {
+			continue;
+		}
+		++count;
+		if (strcmp(cmd, "sync") == 0
+		    && sscanf(line, "%*u %*s %lu %lu", &a, &b) == 2
+		    && a < STATE_COUNT) {
+			sync_state((uint32_t) clock, (uint8_t) a, (uint8_t) b);
+			continue;
+		}
+		run_to((uint32_t) clock);
+		if (strcmp(cmd, "set") == 0
+		    && sscanf(line, "%*u %*s %lu %lu", &a, &b) == 2) {
+			set_value((uint8_t) a, (uint16_t) b);
+		} else if (strcmp(cmd, "volts") == 0
+			   && sscanf(line, "%*u %*s %lu", &a) == 1) {
+			ADCH = (uint8_t) a;
+		} else if (strcmp(cmd, "feedin") == 0
+			   && sscanf(line, "%*u %*s %lu", &a) == 1) {
+			feed->nf_timeout = (uint16_t) a;
+			arm_timers();
+		} else if (strcmp(cmd, "trigger") == 0
+			   && sscanf(line, "%*u %*s %15s", name) == 1) {
+			if (!external(name)) {
+				fprintf(stderr, "hoistreplay: Unknown trigger %s\n",
+					name);
+			}
+		} else if (strcmp(cmd, "end") == 0) {
+			break;
+		} else {
+			fprintf(stderr, "hoistreplay: Invalid input %s", line);
+			return 1;
+		}
+	}
+	fprintf(stderr, "hoistreplay: %lu inputs to clock %lu\n", count,
+		(unsigned long) feed->clock);
+	return 0;
+}
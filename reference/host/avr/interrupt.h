@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc interrupt handling
+ */
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+#include <avr/io.h>
+
+#define ISR(vector)	void vector(void); void vector(void)
+#define sei()		do { } while (0)
+#define cli()		do { } while (0)
+
+#endif // HOST_AVR_INTERRUPT_H
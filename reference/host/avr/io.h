@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc register definitions
+ *
+ * I/O registers are backed by a plain array so that firmware sources
+ * can be compiled and exercised by host tools.
+ */
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+#include <stdint.h>
+
+extern volatile uint8_t host_regs[0x100];
+
+#define _SFR_IO8(x)	(host_regs[(x) + 0x20])
+#define _SFR_MEM8(x)	(host_regs[(x)])
+#define _SFR_MEM16(x)	(*(volatile uint16_t *)&host_regs[(x)])
+#define _BV(b)		(1U << (b))
+#define bit_is_set(r, b)	((r) & _BV(b))
+#define bit_is_clear(r, b)	(!((r) & _BV(b)))
+#define loop_until_bit_is_set(r, b)	do { } while (0)
+#define loop_until_bit_is_clear(r, b)	do { } while (0)
+
+#define PINB	_SFR_IO8(0x03)
+#define DDRB	_SFR_IO8(0x04)
+#define PORTB	_SFR_IO8(0x05)
+#define PINC	_SFR_IO8(0x06)
+#define DDRC	_SFR_IO8(0x07)
+#define PORTC	_SFR_IO8(0x08)
+#define PIND	_SFR_IO8(0x09)
+#define DDRD	_SFR_IO8(0x0a)
+#define PORTD	_SFR_IO8(0x0b)
+#define PINE	_SFR_IO8(0x0c)
+#define DDRE	_SFR_IO8(0x0d)
+#define PORTE	_SFR_IO8(0x0e)
+#define TIFR0	_SFR_IO8(0x15)
+#define TIFR1	_SFR_IO8(0x16)
+#define GPIOR0	_SFR_IO8(0x1e)
+#define EECR	_SFR_IO8(0x1f)
+#define EEDR	_SFR_IO8(0x20)
+#define EEAR	_SFR_MEM16(0x41)
+#define TCCR0A	_SFR_IO8(0x24)
+#define TCCR0B	_SFR_IO8(0x25)
+#define TCNT0	_SFR_IO8(0x26)
+#define OCR0A	_SFR_IO8(0x27)
+#define OCR0B	_SFR_IO8(0x28)
+#define GPIOR1	_SFR_IO8(0x2a)
+#define GPIOR2	_SFR_IO8(0x2b)
+#define SMCR	_SFR_IO8(0x33)
+#define MCUSR	_SFR_IO8(0x34)
+#define MCUCR	_SFR_IO8(0x35)
+#define WDTCSR	_SFR_MEM8(0x60)
+#define TIMSK0	_SFR_MEM8(0x6e)
+#define TIMSK1	_SFR_MEM8(0x6f)
+#define TCCR1B	_SFR_MEM8(0x81)
+#define TCNT1	_SFR_MEM16(0x84)
+#define TCNT1L	_SFR_MEM8(0x84)
+#define OCR1B	_SFR_MEM16(0x8a)
+#define ADCL	_SFR_MEM8(0x78)
+#define ADCH	_SFR_MEM8(0x79)
+#define ADCSRA	_SFR_MEM8(0x7a)
+#define ADCSRB	_SFR_MEM8(0x7b)
+#define ADMUX	_SFR_MEM8(0x7c)
+#define UCSR0A	_SFR_MEM8(0xc0)
+#define UCSR0B	_SFR_MEM8(0xc1)
+#define UCSR0C	_SFR_MEM8(0xc2)
+#define UBRR0L	_SFR_MEM8(0xc4)
+#define UBRR0H	_SFR_MEM8(0xc5)
+#define UDR0	_SFR_MEM8(0xc6)
+#define UCSR1A	_SFR_MEM8(0xc8)
+#define UCSR1B	_SFR_MEM8(0xc9)
+#define UCSR1C	_SFR_MEM8(0xca)
+#define UBRR1L	_SFR_MEM8(0xcc)
+#define UDR1	_SFR_MEM8(0xce)
+#define TCCR2A	_SFR_MEM8(0xb0)
+#define TCCR2B	_SFR_MEM8(0xb1)
+#define OCR2A	_SFR_MEM8(0xb3)
+#define OCR2B	_SFR_MEM8(0xb4)
+
+#define WGM01	1
+#define CS02	2
+#define CS10	0
+#define OCIE1B	2
+#define OCF1B	2
+#define OCIE0A	1
+#define CS20	0
+#define WGM20	0
+#define WGM21	1
+#define COM2B1	5
+#define COM2A1	7
+#define MUX0	0
+#define MUX1	1
+#define MUX2	2
+#define ADLAR	5
+#define REFS0	6
+#define ADPS0	0
+#define ADPS2	2
+#define ADIE	3
+#define ADIF	4
+#define ADATE	5
+#define ADSC	6
+#define ADEN	7
+#define PORF	0
+#define EXTRF	1
+#define BORF	2
+#define WDRF	3
+#define EERE	0
+#define EEPE	1
+#define EEMPE	2
+#define U2X0	1
+#define DOR0	3
+#define FE0	4
+#define UDRE0	5
+#define RXC0	7
+#define UCSZ00	1
+#define UCSZ01	2
+#define TXEN0	3
+#define RXEN0	4
+#define UDRIE0	5
+#define RXCIE0	7
+
+#endif // HOST_AVR_IO_H
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc program space access
+ */
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)		(s)
+#define pgm_read_byte(addr)	(*(const uint8_t *) (addr))
+#define pgm_read_word(addr)	(*(const uint16_t *) (addr))
+#define pgm_read_ptr(addr)	(*(const void *const *) (addr))
+
+#endif // HOST_AVR_PGMSPACE_H
@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc sleep modes
+ */
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define sleep_mode()	do { } while (0)
+
+#endif // HOST_AVR_SLEEP_H
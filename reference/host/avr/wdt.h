@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc watchdog control
+ */
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#define WDTO_250MS	4
+#define wdt_reset()	do { } while (0)
+#define wdt_enable(t)	do { (void) (t); } while (0)
+
+#endif // HOST_AVR_WDT_H
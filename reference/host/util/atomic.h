@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc atomic blocks
+ */
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_FORCEON	0
+#define ATOMIC_RESTORESTATE	0
+#define ATOMIC_BLOCK(type)	for (int host_atomic = 1; host_atomic; host_atomic = 0)
+
+#endif // HOST_UTIL_ATOMIC_H
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc CRC routines
+ */
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+#include <stdint.h>
+
+// CRC-16 (Modbus) polynomial 0xa001, as documented for avr-libc
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+	int i;
+	crc ^= a;
+	for (i = 0; i < 8; ++i) {
+		if (crc & 1) {
+			crc = (uint16_t) ((crc >> 1) ^ 0xa001);
+		} else {
+			crc = (uint16_t) (crc >> 1);
+		}
+	}
+	return crc;
+}
+
+#endif // HOST_UTIL_CRC16_H
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for avr-libc busy wait loops
+ */
+#ifndef HOST_UTIL_DELAY_BASIC_H
+#define HOST_UTIL_DELAY_BASIC_H
+#include <stdint.h>
+
+#define _delay_loop_1(count)	do { (void) (count); } while (0)
+#define _delay_loop_2(count)	do { (void) (count); } while (0)
+
+#endif // HOST_UTIL_DELAY_BASIC_H
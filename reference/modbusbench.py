@@ -0,0 +1,243 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: MIT
+"""modbusbench.py
+
+Check the Modbus RTU slave and measure polls per second on a
+simulated multi-drop bus of host-built adapters.
+
+Usage: modbusbench.py [-b BAUD] [-k SLAVES] [-n COUNT] [--sim PATH]
+
+Build the host slave with:
+
+	$ make modbusslave
+
+Each slave runs on its own pty, at addresses 1 to SLAVES. Every
+request is written to all of them, as on a shared RS-485 pair, after
+waiting its time on the line. Replies are expected from the addressed
+slave only.
+"""
+
+import os
+import sys
+import select
+import argparse
+import subprocess
+from time import monotonic, sleep
+
+READCOILS = 0x01
+READHOLDING = 0x03
+READINPUT = 0x04
+WRITECOIL = 0x05
+WRITEREG = 0x06
+
+HOLDING_F = 5
+HOLDING_SLOW = 10
+HOLDING_ADDR = 11
+INPUT_STATE = 0
+INPUT_VERSION = 6
+INPUT_CRCERRORS = 15
+INPUT_COUNT = 17
+STATE_AT_H = 3
+STATE_MOVE_H_P1 = 6
+
+TIMEOUT = 0.1  # reply timeout, seconds
+
+
+def crc16(buf):
+    crc = 0xffff
+    for b in buf:
+        crc ^= b
+        for i in range(8):
+            if crc & 1:
+                crc = (crc >> 1) ^ 0xa001
+            else:
+                crc >>= 1
+    return crc
+
+
+def adu(addr, pdu):
+    msg = bytes((addr, )) + pdu
+    crc = crc16(msg)
+    return msg + bytes((crc & 0xff, crc >> 8))
+
+
+def words(*vals):
+    return b''.join(v.to_bytes(2, 'big') for v in vals)
+
+
+class Bus:
+    """Slaves on a shared line, one pty each"""
+
+    def __init__(self, sim, count, baud):
+        self.baud = baud
+        self.char = 10.0 / baud
+        self.procs = []
+        self.fds = {}
+        self.collisions = 0
+        for addr in range(1, count + 1):
+            p = subprocess.Popen([sim, str(addr)],
+                                 stdout=subprocess.PIPE,
+                                 text=True)
+            path = p.stdout.readline().strip()
+            self.procs.append(p)
+            self.fds[addr] = os.open(path, os.O_RDWR | os.O_NOCTTY)
+
+    def close(self):
+        for fd in self.fds.values():
+            os.close(fd)
+        for p in self.procs:
+            p.terminate()
+            p.wait()
+
+    def idle(self):
+        """Wait out the 3.5 character bus silence"""
+        sleep(3.5 * self.char)
+
+    def send(self, frame):
+        sleep(len(frame) * self.char)
+        for fd in self.fds.values():
+            os.write(fd, frame)
+
+    def receive(self, addr, timeout=TIMEOUT):
+        """Return reply from addr, counting any other slave's output"""
+        buf = b''
+        deadline = monotonic() + timeout
+        quiet = None
+        fds = list(self.fds.values())
+        while True:
+            now = monotonic()
+            limit = deadline if quiet is None else min(deadline, quiet)
+            if now >= limit:
+                break
+            r, w, x = select.select(fds, [], [], limit - now)
+            for fd in r:
+                data = os.read(fd, 256)
+                if addr in self.fds and fd == self.fds[addr]:
+                    buf += data
+                    quiet = monotonic() + 3.5 * self.char + 0.01
+                else:
+                    self.collisions += 1
+        return buf
+
+    def request(self, addr, pdu, timeout=TIMEOUT):
+        self.idle()
+        self.send(adu(addr, pdu))
+        reply = self.receive(addr, timeout)
+        if len(reply) < 4 or crc16(reply) != 0 or reply[0] != addr:
+            return None
+        return reply[1:-2]
+
+
+def read_regs(bus, addr, fn, start, count):
+    r = bus.request(addr, bytes((fn, )) + words(start, count))
+    if r is None or r[0] != fn or r[1] != 2 * count:
+        return None
+    return [int.from_bytes(r[2 + 2 * i:4 + 2 * i], 'big')
+            for i in range(count)]
+
+
+failures = 0
+
+
+def report(name, ok, detail=''):
+    global failures
+    print('%-44s %s%s' % (name, 'ok' if ok else 'FAIL', detail))
+    if not ok:
+        failures += 1
+
+
+def checks(bus, count):
+    ok = True
+    for addr in range(1, count + 1):
+        regs = read_regs(bus, addr, READINPUT, 0, INPUT_COUNT)
+        ok = ok and regs is not None and regs[INPUT_STATE] == STATE_AT_H \
+            and regs[INPUT_VERSION] != 0
+    report('every slave answers at its address', ok)
+
+    r = bus.request(1, bytes((WRITEREG, )) + words(HOLDING_SLOW, 55))
+    regs = read_regs(bus, 1, READHOLDING, HOLDING_SLOW, 1)
+    report('write register reads back',
+           r == bytes((WRITEREG, )) + words(HOLDING_SLOW, 55)
+           and regs == [55])
+
+    r = bus.request(1, bytes((WRITEREG, )) + words(HOLDING_SLOW, 101))
+    report('out of range value is refused', r == bytes((0x86, 0x03)))
+
+    r = bus.request(1, bytes((READHOLDING, )) + words(HOLDING_ADDR + 1, 1))
+    report('unknown register is refused', r == bytes((0x83, 0x02)))
+
+    r = bus.request(1, bytes((0x2b, 0x0e, 0x01, 0x00)))
+    report('unknown function is refused', r == bytes((0xab, 0x01)))
+
+    frame = bytearray(adu(1, bytes((READINPUT, )) + words(0, 1)))
+    frame[-1] ^= 0xff
+    bus.idle()
+    bus.send(bytes(frame))
+    silent = bus.receive(1) == b''
+    regs = read_regs(bus, 1, READINPUT, INPUT_CRCERRORS, 1)
+    report('bad checksum is ignored and counted',
+           silent and regs is not None and regs[0] >= 1)
+
+    frame = adu(1, bytes((READINPUT, )) + words(0, 1))
+    bus.idle()
+    bus.send(frame[:3])
+    sleep(10 * bus.char)
+    bus.send(frame[3:])
+    report('request split by silence is ignored', bus.receive(1) == b'')
+
+    bus.idle()
+    bus.send(adu(0, bytes((WRITEREG, )) + words(HOLDING_F, 45)))
+    silent = bus.receive(0, 0.05) == b''
+    ok = silent
+    for addr in range(1, count + 1):
+        ok = ok and read_regs(bus, addr, READHOLDING, HOLDING_F, 1) == [45]
+    report('broadcast write reaches every slave', ok)
+
+    r = bus.request(count, bytes((WRITECOIL, )) + words(0, 0xff00))
+    sleep(0.1)
+    regs = read_regs(bus, count, READINPUT, INPUT_STATE, 1)
+    coils = bus.request(count, bytes((READCOILS, )) + words(0, 2))
+    report('down coil lowers the hoist',
+           r == bytes((WRITECOIL, )) + words(0, 0xff00)
+           and regs == [STATE_MOVE_H_P1] and coils == bytes((1, 1, 1)))
+
+    report('unaddressed slaves stay silent', bus.collisions == 0,
+           ' (%d collisions)' % (bus.collisions, ))
+
+
+def bench(bus, slaves, polls):
+    lost = 0
+    start = monotonic()
+    for i in range(polls):
+        addr = 1 + i % slaves
+        if read_regs(bus, addr, READINPUT, 0, INPUT_COUNT) is None:
+            lost += 1
+    elapsed = monotonic() - start
+    # request, reply and two bus silences on the line
+    line = (8 + 5 + 2 * INPUT_COUNT + 7) * bus.char
+    print('%d polls of %d registers in %0.2fs, %0.1f polls/s, %d lost' %
+          (polls, INPUT_COUNT, elapsed, polls / elapsed, lost))
+    print('Line limit at %d baud: %0.1f polls/s' % (bus.baud, 1.0 / line))
+    report('every poll answered', lost == 0)
+
+
+def main():
+    p = argparse.ArgumentParser(description='Modbus slave check')
+    p.add_argument('-b', '--baud', type=int, default=19200,
+                   help='console baud of the slave build')
+    p.add_argument('-k', '--slaves', type=int, default=4)
+    p.add_argument('-n', '--count', type=int, default=200)
+    p.add_argument('--sim', default='./modbusslave', help='host slave')
+    a = p.parse_args()
+
+    bus = Bus(a.sim, a.slaves, a.baud)
+    try:
+        checks(bus, a.slaves)
+        bench(bus, a.slaves, a.count)
+    finally:
+        bus.close()
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Run the firmware Modbus slave on a host pseudo-terminal
+ *
+ * Builds the firmware for the host like hoistreplay, along with the
+ * console UART and Modbus slave, and attaches the UART to a pty.
+ * Received bytes are stamped with a timer1 count and passed to the
+ * receive interrupt, the frame timer interrupt is taken once its
+ * silence has elapsed in real time, and replies are written out at
+ * the console baud rate. The system tick runs in real time, and the
+ * hoist starts at home with default settings.
+ *
+ * The pty path is written to stdout on startup.
+ *
+ * Usage: modbusslave ADDR
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <avr/wdt.h>
+
+// Waiting for output to drain sends it
+#undef wdt_reset
+#define wdt_reset() uart_out()
+#define main firmware_main
+static void uart_out(void);
+#include "../src/system.c"
+#include "../src/timer.c"
+#include "../src/throttle.c"
+#include "../src/travel.c"
+#include "../src/battery.c"
+#include "../src/wear.c"
+#include "../src/sag.c"
+#include "../src/state_table.c"
+#include "../src/console.c"
+#include "../src/modbus.c"
+#include "../src/main.c"
+#undef main
+
+#define HOME_CLEAR	50U	// ticks lowering before home switch opens
+#define TICK_US		10000U
+#define COUNTS_US	(F_CPU / 1000000UL)
+#define FRAME_US	(MODBUS_T35 / COUNTS_US)
+
+volatile uint8_t host_regs[0x100];
+uint8_t entropy_status;
+volatile uint8_t entropy_jitter;
+struct spm_telemetry spm_telemetry;
+
+static int pty;
+static uint16_t depth;
+
+void entropy_init(void)
+{
+}
+
+void entropy_poll(void)
+{
+}
+
+void spm_check(void)
+{
+}
+
+void spm_poll_start(void)
+{
+}
+
+void spm_poll_stop(void)
+{
+}
+
+uint8_t spm_poll(void)
+{
+	spm_telemetry.speed = 1U;
+	return 0;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000U + (uint64_t) ts.tv_nsec / 1000U;
+}
+
+// Free running timer1 at F_CPU
+static void timer1_at(uint64_t us)
+{
+	TCNT1 = (uint16_t) (us * COUNTS_US);
+}
+
+// Write buf to the pty, taking as long as it would on the line
+static void uart_write(const uint8_t *buf, unsigned len)
+{
+	struct timespec ts;
+	uint64_t ns = (uint64_t) len * 10U * 1000000000U / CONSOLE_BAUD;
+	ts.tv_sec = (time_t) (ns / 1000000000U);
+	ts.tv_nsec = (long) (ns % 1000000000U);
+	nanosleep(&ts, NULL);
+	if (write(pty, buf, len) != (ssize_t) len) {
+		perror("modbusslave: write");
+		exit(1);
+	}
+}
+
+// Send queued output, the interrupt leaves UDRIE0 set after each byte
+static void uart_out(void)
+{
+	uint8_t buf[BUFLEN];
+	unsigned len = 0;
+	while (UCSR0B & _BV(UDRIE0)) {
+		USART_UDRE_vect();
+		if (UCSR0B & _BV(UDRIE0)) {
+			buf[len++] = UDR0;
+		}
+		if (len == sizeof(buf)) {
+			uart_write(buf, len);
+			len = 0;
+		}
+	}
+	if (len) {
+		uart_write(buf, len);
+	}
+}
+
+// Hoist leaves the home switch shortly after lowering, and returns
+// to it after raising for as long as it was lowered
+static void hoist_move(void)
+{
+	uint8_t out = PORTD;
+	if (out & _BV(PWR)) {
+		if (out & _BV(FWD)) {
+			++depth;
+		} else if ((out & _BV(REV)) && depth) {
+			--depth;
+		}
+	}
+	if (depth > HOME_CLEAR) {
+		PINC &= (uint8_t) ~_BV(S1);
+	} else {
+		PINC |= (uint8_t) _BV(S1);
+	}
+}
+
+// Firmware main loop body
+static void service(uint8_t * lt)
+{
+	struct console_event event;
+	while (*lt != SYSTICK) {
+		++*lt;
+		update_state(*lt);
+	}
+	hoist_select(addressed);
+	console_read();
+	modbus_poll();
+	while (console_next(&event)) {
+		handle_event(&event);
+		console_read();
+	}
+	uart_out();
+}
+
+static int open_pty(void)
+{
+	struct termios tio;
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	int slave;
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+		return -1;
+	}
+	// hold the slave side open and raw, so the master never hangs up
+	slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio)) {
+		return -1;
+	}
+	cfmakeraw(&tio);
+	if (tcsetattr(slave, TCSANOW, &tio)) {
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t buf[BUFLEN];
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t next_tick;
+	uint64_t frame_due = 0;
+	uint64_t now;
+	uint64_t wait;
+	unsigned long addr;
+	ssize_t len;
+	ssize_t i;
+	uint8_t lt;
+
+	if (argc != 2 || (addr = strtoul(argv[1], NULL, 0)) == 0
+	    || addr > MODBUS_LASTADDR) {
+		fprintf(stderr, "Usage: modbusslave ADDR\n");
+		return 1;
+	}
+	pty = open_pty();
+	if (pty < 0) {
+		perror("modbusslave: pty");
+		return 1;
+	}
+	printf("%s\n", ptsname(pty));
+	fflush(stdout);
+
+	memset((void *) host_regs, 0, sizeof(host_regs));
+	memset(hoist, 0, sizeof(hoist));
+	hoist_select(0);
+	load_parameters();
+	bstate = INPUT_IDLE | _BV(S1);
+	PINC = bstate;
+	ADCH = NIGHTVOLTS;
+	throttle_init();
+	read_inputs();
+	feed->state = state_at_h;
+	arm_timers();
+	UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+	modbus_select((uint8_t) addr);
+
+	pfd.fd = pty;
+	pfd.events = POLLIN;
+	lt = SYSTICK;
+	next_tick = now_us() + TICK_US;
+	do {
+		now = now_us();
+		wait = next_tick > now ? next_tick - now : 0;
+		if (frame_due) {
+			if (frame_due <= now) {
+				wait = 0;
+			} else if (frame_due - now < wait) {
+				wait = frame_due - now;
+			}
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = (long) (wait * 1000U);
+		if (ppoll(&pfd, 1, &ts, NULL) > 0 && (pfd.revents & POLLIN)) {
+			len = read(pty, buf, sizeof(buf));
+			for (i = 0; i < len; i++) {
+				now = now_us();
+				timer1_at(now);
+				UCSR0A = 0;
+				UDR0 = buf[i];
+				USART_RX_vect();
+				if (TIMSK1 & _BV(OCIE1B)) {
+					frame_due = now + FRAME_US;
+				}
+			}
+		}
+		now = now_us();
+		if (frame_due && now >= frame_due) {
+			frame_due = 0;
+			timer1_at(now);
+			TIMER1_COMPB_vect();
+		}
+		while (now >= next_tick) {
+			next_tick += TICK_US;
+			++SYSTICK;
+			hoist_move();
+		}
+		service(&lt);
+	} while (1);
+	return 0;
+}
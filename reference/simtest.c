@@ -0,0 +1,538 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Firmware-in-the-loop test with simavr
+ *
+ * Runs the firmware ELF on a simulated ATmega328PB at 2MHz with a
+ * scripted console on USART0, an emulated SPM controller on USART1,
+ * a hoist travel model on the home switch and a battery voltage on
+ * ADC7. Output pins on PORTD are checked over a scripted feed cycle
+ * and CPU cycles are reported for boot and for each wake of the
+ * main loop.
+ *
+ * With -p, USART1 is connected to an external SPM emulator on the
+ * named tty (eg reference/fakespm.py) and the simulation is paced
+ * to real time.
+ *
+ * With -s, the firmware is expected to stop on a telemetry stall
+ * (STALLSTOP=1, the default), otherwise to report the stall and keep
+ * running.
+ *
+ * Usage: simtest [-v] [-s] [-b boot_ms] [-t tick_cycles] [-p tty] elf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+#include "avr_adc.h"
+#include "system.h"
+#include "spm_config.h"
+
+#define SIM_MCU		"atmega328pb"
+#define SIM_FREQ	2000000UL
+#define SIM_MS		(SIM_FREQ / 1000UL)
+#define SIM_VCC		5000U	// AVCC reference, mV
+#define SIM_VDIV	8.17	// battery sense divider on ADC7
+#define SIM_CONSOLE	4096U
+#define SIM_REG_PORTD	0x2b
+#define SIM_REG_GPIOR0	0x3e
+#define SIM_BOOT_MS	2000U	// default boot to ready budget
+#define SIM_TICK_CYCLES	2000U	// default mean cycles per tick budget
+#define SIM_PULSE_MS	200U	// remootio relay pulse
+
+static avr_t *avr;
+static int verbose;
+static int stallstop;
+static int failures;
+
+// Console capture
+static char console[SIM_CONSOLE];
+static unsigned consolelen;
+static unsigned consolemark;
+
+// Emulated SPM controller
+static uint8_t spm_mem[0x80];
+static uint8_t spm_buf[24];
+static unsigned spm_len;
+static unsigned spm_reads;
+static unsigned spm_writes;
+static int spm_jam;
+static int spm_fd = -1;
+static struct timespec sim_start;
+
+// Hoist travel model, ms below home
+static long hoist_pos;
+
+// Cycle accounting
+static avr_cycle_count_t boot_cycles;
+static avr_cycle_count_t wake_start;
+static avr_cycle_count_t wake_min = (avr_cycle_count_t) -1;
+static avr_cycle_count_t wake_max;
+static avr_cycle_count_t wake_total;
+static unsigned long wake_count;
+static unsigned long tick_count;
+static uint8_t wake_tick;
+
+static void console_out(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void) irq;
+	(void) param;
+	if (verbose) {
+		putchar((int) value);
+	}
+	if (consolelen < SIM_CONSOLE - 1U) {
+		console[consolelen++] = (char) value;
+		console[consolelen] = '\0';
+	}
+}
+
+static void console_send(const char *str)
+{
+	avr_irq_t *in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'),
+				      UART_IRQ_INPUT);
+	while (*str) {
+		avr_raise_irq(in, (uint8_t) * (str++));
+	}
+}
+
+static void spm_reply(uint8_t hdr, uint8_t len, const uint8_t * body)
+{
+	avr_irq_t *in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				      UART_IRQ_INPUT);
+	uint8_t sum = (uint8_t) (hdr + len);
+	avr_raise_irq(in, hdr);
+	avr_raise_irq(in, len);
+	while (len) {
+		sum = (uint8_t) (sum + *body);
+		avr_raise_irq(in, *(body++));
+		--len;
+	}
+	avr_raise_irq(in, sum);
+}
+
+static void spm_packet(void)
+{
+	static const uint8_t info[3] = { 0x04, 0x05, 0x01 };
+	static const uint8_t ack[1] = { 0x00 };
+	uint8_t mon[0x10];
+	uint8_t oft = spm_buf[2];
+	memset(mon, 0, sizeof(mon));
+	switch (spm_buf[0]) {
+	case 0x3b:
+		mon[9] = 13U;
+		spm_reply(0x3b, sizeof(mon), mon);
+		break;
+	case 0x3c:
+		// 1000rpm at 30% current, jammed motor draws full current
+		if (!spm_jam) {
+			mon[0] = 0x03;
+			mon[1] = 0xe8;
+		}
+		mon[2] = spm_jam ? 100U : 30U;
+		spm_reply(0x3c, sizeof(mon), mon);
+		break;
+	case 0xf1:
+		spm_reply(0xf1, 0, NULL);
+		break;
+	case 0x11:
+		spm_reply(0x11, sizeof(info), info);
+		break;
+	case 0xf2:
+		spm_reply(0xf2, 0x10, &spm_mem[oft & 0x70]);
+		++spm_reads;
+		break;
+	case 0xf3:
+		if (oft + spm_buf[3] <= sizeof(spm_mem)) {
+			memcpy(&spm_mem[oft], &spm_buf[5], spm_buf[3]);
+		}
+		spm_reply(0xf3, sizeof(ack), ack);
+		++spm_writes;
+		break;
+	case 0xf4:
+		spm_reply(0xf4, 0, NULL);
+		break;
+	default:
+		break;
+	}
+}
+
+static void spm_in(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void) irq;
+	(void) param;
+	if (spm_fd >= 0) {
+		uint8_t ch = (uint8_t) value;
+		if (write(spm_fd, &ch, 1) != 1) {
+			fprintf(stderr, "simtest: SPM tty write error\n");
+		}
+		return;
+	}
+	if (spm_len < sizeof(spm_buf)) {
+		spm_buf[spm_len++] = (uint8_t) value;
+	}
+	if (spm_len >= 3U && spm_len == 3U + spm_buf[1]) {
+		uint8_t sum = 0;
+		for (unsigned i = 0; i < spm_len - 1U; i++) {
+			sum = (uint8_t) (sum + spm_buf[i]);
+		}
+		if (sum == spm_buf[spm_len - 1U]) {
+			spm_packet();
+		}
+		spm_len = 0;
+	} else if (spm_len >= sizeof(spm_buf)) {
+		spm_len = 0;
+	}
+}
+
+// Forward input from external SPM, pace simulation to wall clock
+static void spm_poll(void)
+{
+	uint8_t buf[32];
+	struct timespec now;
+	ssize_t len = read(spm_fd, buf, sizeof(buf));
+	avr_irq_t *in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				      UART_IRQ_INPUT);
+	for (ssize_t i = 0; i < len; i++) {
+		avr_raise_irq(in, buf[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double wall = (double) (now.tv_sec - sim_start.tv_sec)
+	    + (double) (now.tv_nsec - sim_start.tv_nsec) * 1e-9;
+	double ahead = (double) avr->cycle / (double) SIM_FREQ - wall;
+	if (ahead > 0.0) {
+		usleep((useconds_t) (ahead * 1e6));
+	}
+}
+
+static int spm_open(const char *path)
+{
+	struct termios tio;
+	int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	return fd;
+}
+
+static void spm_init(void)
+{
+	static const uint8_t model[8] = SPM_MODEL;
+	memcpy(&spm_mem[0x40], model, sizeof(model));
+	for (unsigned i = 0; i < SPM_CFGLEN; i++) {
+		spm_mem[cfg_bytes[i]] = cfg_vals[i];
+	}
+}
+
+static uint8_t portd(void)
+{
+	return avr->data[SIM_REG_PORTD];
+}
+
+static void set_input(uint8_t bit, uint8_t level)
+{
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), bit),
+		      level);
+}
+
+static void set_battery(unsigned millivolts)
+{
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC7),
+		      (uint32_t) (millivolts / SIM_VDIV));
+}
+
+// Step simulation and account for time spent awake
+static void step(void)
+{
+	int prev = avr->state;
+	int state = avr_run(avr);
+	if (state == cpu_Done || state == cpu_Crashed) {
+		fprintf(stderr, "simtest: CPU stopped at pc=0x%04x\n", avr->pc);
+		exit(2);
+	}
+	if (prev != cpu_Sleeping && avr->state == cpu_Sleeping) {
+		if (!boot_cycles) {
+			boot_cycles = avr->cycle;
+		} else {
+			avr_cycle_count_t len = avr->cycle - wake_start;
+			uint8_t ticks = (uint8_t) (avr->data[SIM_REG_GPIOR0]
+						   - wake_tick);
+			wake_total += len;
+			tick_count += ticks;
+			++wake_count;
+			if (len < wake_min) {
+				wake_min = len;
+			}
+			if (len > wake_max) {
+				wake_max = len;
+			}
+		}
+	} else if (prev == cpu_Sleeping && avr->state != cpu_Sleeping) {
+		wake_start = avr->cycle;
+		wake_tick = avr->data[SIM_REG_GPIOR0];
+	}
+}
+
+// Run for ms, moving the hoist on the motor outputs
+static void run(unsigned ms)
+{
+	while (ms) {
+		avr_cycle_count_t end = avr->cycle + SIM_MS;
+		while (avr->cycle < end) {
+			step();
+		}
+		uint8_t out = portd();
+		if (out & _BV(PWR)) {
+			if (out & _BV(FWD)) {
+				++hoist_pos;
+			}
+			if ((out & _BV(REV)) && hoist_pos > 0) {
+				--hoist_pos;
+			}
+		}
+		set_input(S1, hoist_pos <= 0);
+		if (spm_fd >= 0) {
+			spm_poll();
+		}
+		--ms;
+	}
+}
+
+static void check(const char *name, int ok)
+{
+	printf("%-44s %s\n", name, ok ? "ok" : "FAIL");
+	if (!ok) {
+		++failures;
+	}
+}
+
+// Run until console output since the last mark contains str
+static int expect(const char *str, unsigned ms)
+{
+	while (ms) {
+		if (strstr(&console[consolemark], str)) {
+			consolemark = consolelen;
+			return 1;
+		}
+		run(1U);
+		--ms;
+	}
+	return 0;
+}
+
+// Run until PORTD masked bits match value
+static int wait_port(uint8_t mask, uint8_t value, unsigned ms)
+{
+	while (ms) {
+		if ((portd() & mask) == value) {
+			return 1;
+		}
+		run(1U);
+		--ms;
+	}
+	return 0;
+}
+
+static void pulse(uint8_t bit)
+{
+	set_input(bit, 0);
+	run(SIM_PULSE_MS);
+	set_input(bit, 1U);
+}
+
+static void scenario(void)
+{
+	uint8_t motor = _BV(PWR) | _BV(FWD) | _BV(REV);
+	uint8_t outputs = motor | _BV(ATP1);
+
+	consolemark = 0;
+	check("boot message", expect("Info: Boot", 3000U));
+	if (spm_fd >= 0) {
+		check("SPM check complete", expect("SPM: ", 5000U));
+	} else {
+		check("SPM config read without update",
+		      expect("SPM: ", 3000U) && spm_reads == 8U
+		      && spm_writes == 0);
+	}
+	check("arrive at home on reset", wait_port(outputs, 0, 1000U));
+
+	// unlock console with default PIN and query state
+	console_send("\x10" "0\r\n");
+	check("console unlocked", expect("OK", 500U));
+	console_send("s");
+	check("console state AT H", expect("[AT H]", 500U));
+
+	// low battery refuses remootio lower
+	set_battery(11000U);
+	run(100U);
+	pulse(S4);
+	run(500U);
+	check("low battery blocks remootio down", (portd() & motor) == 0);
+
+	// remootio lower to P1
+	set_battery(12800U);
+	run(100U);
+	pulse(S4);
+	check("remootio down lowers hoist",
+	      wait_port(motor, _BV(PWR) | _BV(FWD), 500U));
+	check("stop and signal at P1",
+	      wait_port(outputs, _BV(ATP1), DEFAULT_P1 * 10U + 1000U));
+	check("travel H-P1 within 2%",
+	      labs(hoist_pos - (long) DEFAULT_P1 * 10L) <
+	      (long) DEFAULT_P1 / 5L);
+
+	// remootio raise to home
+	pulse(S3);
+	check("remootio up raises hoist",
+	      wait_port(motor | _BV(ATP1), _BV(PWR) | _BV(REV), 500U));
+	check("stop at home switch",
+	      wait_port(outputs, 0, DEFAULT_H * 10U) && hoist_pos == 0);
+	console_send("s");
+	check("console state AT H after raise", expect("[AT H]", 500U));
+
+	// console lower overrides low battery, then stop
+	set_battery(11000U);
+	run(100U);
+	console_send("d");
+	check("console down overrides low battery",
+	      wait_port(motor, _BV(PWR) | _BV(FWD), 500U));
+	run(3000U);
+	console_send("d");
+	check("console down stops hoist", wait_port(motor, 0, 1000U));
+
+	// jam the motor while raising
+	set_battery(12800U);
+	console_send("u");
+	check("console up raises hoist",
+	      wait_port(motor, _BV(PWR) | _BV(REV), 500U));
+	run(1000U);
+	console_send("t");
+	check("telemetry reports speed", expect("Speed = 1000", 500U));
+	spm_jam = 1;
+	if (stallstop) {
+		check("stall stops motor within 0.5s",
+		      wait_port(motor, 0, 500U));
+		check("stall reported", expect("Stall: ", 500U));
+		spm_jam = 0;
+		console_send("u");
+	} else {
+		check("stall reported", expect("Stall: ", 500U));
+		check("stall telemetry reported", expect("Fault = ", 500U));
+		check("stall does not stop motor",
+		      (portd() & motor) == (_BV(PWR) | _BV(REV)));
+		spm_jam = 0;
+	}
+	check("stop at home after stall",
+	      wait_port(outputs, 0, DEFAULT_H * 10U) && hoist_pos == 0);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: simtest [-v] [-s] [-b boot_ms] [-t tick_cycles]"
+		" [-p tty] firmware.elf\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	elf_firmware_t fw;
+	unsigned boot_budget = SIM_BOOT_MS;
+	unsigned tick_budget = SIM_TICK_CYCLES;
+	uint32_t flags = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vsb:t:p:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 's':
+			stallstop = 1;
+			break;
+		case 'b':
+			boot_budget = (unsigned) strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			tick_budget = (unsigned) strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			spm_fd = spm_open(optarg);
+			if (spm_fd < 0) {
+				perror(optarg);
+				return 2;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+	}
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw)) {
+		fprintf(stderr, "simtest: Unable to load %s\n", argv[optind]);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name(SIM_MCU);
+	if (!avr) {
+		fprintf(stderr, "simtest: simavr lacks %s core\n", SIM_MCU);
+		return 2;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = SIM_FREQ;
+	avr->vcc = SIM_VCC;
+	avr->avcc = SIM_VCC;
+
+	// detach simavr stdio from both USARTs
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('1'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('1'), &flags);
+	avr_irq_register_notify(avr_io_getirq
+				(avr, AVR_IOCTL_UART_GETIRQ('0'),
+				 UART_IRQ_OUTPUT), console_out, NULL);
+	avr_irq_register_notify(avr_io_getirq
+				(avr, AVR_IOCTL_UART_GETIRQ('1'),
+				 UART_IRQ_OUTPUT), spm_in, NULL);
+	spm_init();
+
+	// hoist at home, remootio relays released, battery charged
+	set_input(S1, 1U);
+	set_input(S3, 1U);
+	set_input(S4, 1U);
+	set_battery(12800U);
+
+	clock_gettime(CLOCK_MONOTONIC, &sim_start);
+	scenario();
+
+	double mean = wake_count ? (double) wake_total / (double) tick_count
+	    : 0.0;
+	printf("Boot to ready: %llu cycles, %0.1fms\n",
+	       (unsigned long long) boot_cycles,
+	       (double) boot_cycles / (double) SIM_MS);
+	printf("Ticks: %lu in %lu wakes, %0.1f cycles/tick\n",
+	       tick_count, wake_count, mean);
+	printf("Wake: min %llu, max %llu cycles\n",
+	       (unsigned long long) wake_min, (unsigned long long) wake_max);
+	check("boot time within budget",
+	      boot_cycles != 0 && boot_cycles <= boot_budget * SIM_MS);
+	check("tick cycles within budget", mean <= (double) tick_budget);
+	avr_terminate(avr);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+# SPDX-License-Identifier: MIT
+"""sm_mktable.py
+
+Create state machine tables and diagram from transition definition.
+
+Usage: sm_mktable.py state_table.txt state_table.h state_table.c table.svg
+
+The parsed table is also available to host tools via load().
+"""
+
+import sys
+from xml.sax.saxutils import escape
+
+# Action codes, in enum order - refer src/main.c: trigger()
+ACTIONS = (
+    'spurious',
+    'ignore',
+    'retry',
+    'move_up',
+    'move_down',
+    'start_p1',
+    'start_p2',
+    'stop',
+    'arrive_p1',
+    'home',
+    'error',
+    'fault',
+    'tangle',
+)
+
+
+class StateTable:
+    """Parsed transition definition"""
+
+    def __init__(self):
+        self.states = []
+        self.labels = {}
+        self.events = []
+        self.names = {}
+        self.elabels = {}
+        self.table = {}
+
+    def entry(self, state, event):
+        """Return (action, next state) for state and event"""
+        return self.table[(state, event)]
+
+
+def load(filename):
+    """Read a transition definition and return a StateTable"""
+    st = StateTable()
+    rows = []
+    with open(filename) as f:
+        for lno, l in enumerate(f, start=1):
+            l = l.split('#', maxsplit=1)[0].strip()
+            if not l:
+                continue
+            if l.startswith('state\t') or l.startswith('event\t'):
+                v = [i for i in l.split('\t') if i]
+                if v[0] == 'state' and len(v) == 3:
+                    st.states.append(v[1])
+                    st.labels[v[1]] = v[2]
+                elif v[0] == 'event' and len(v) == 4:
+                    st.events.append(v[1])
+                    st.names[v[1]] = v[2]
+                    st.elabels[v[1]] = v[3]
+                else:
+                    raise ValueError('%s:%d: invalid declaration' %
+                                     (filename, lno))
+            else:
+                v = l.split()
+                if len(v) not in (3, 4):
+                    raise ValueError('%s:%d: invalid transition' %
+                                     (filename, lno))
+                rows.append((lno, v))
+
+    if len(st.states) > 16 or len(ACTIONS) > 16:
+        raise ValueError('Table entry overflow')
+    for s in st.states:
+        for e in st.events:
+            st.table[(s, e)] = ('spurious', s)
+    for lno, v in rows:
+        src, evt, act = v[0:3]
+        dst = v[3] if len(v) == 4 else None
+        if src != '*' and src not in st.labels:
+            raise ValueError('%s:%d: unknown state %r' % (filename, lno, src))
+        if evt not in st.names:
+            raise ValueError('%s:%d: unknown event %r' % (filename, lno, evt))
+        if act not in ACTIONS:
+            raise ValueError('%s:%d: unknown action %r' %
+                             (filename, lno, act))
+        if dst is not None and dst not in st.labels:
+            raise ValueError('%s:%d: unknown state %r' % (filename, lno, dst))
+        for s in st.states if src == '*' else (src, ):
+            st.table[(s, evt)] = (act, dst if dst is not None else s)
+    return st
+
+
+def _cstr(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def write_header(st, filename):
+    with open(filename, 'w') as f:
+        f.write('// SPDX-License-Identifier: MIT\n\n')
+        f.write('/*\n * Hoist state transition table\n *\n')
+        f.write(' * Generated by reference/sm_mktable.py from')
+        f.write(' reference/state_table.txt\n */\n')
+        f.write('#ifndef STATE_TABLE_H\n#define STATE_TABLE_H\n\n')
+        f.write('#include <stdint.h>\n#include <avr/pgmspace.h>\n\n')
+        f.write('#define STATE_COUNT\t%d\n' % (len(st.states), ))
+        f.write('#define EVENT_COUNT\t%d\n\n' % (len(st.events), ))
+        f.write('// Table entries: action << 4 | next state\n')
+        f.write('#define STATE_ACTION(e)\t((uint8_t) ((e) >> 4))\n')
+        f.write('#define STATE_NEXT(e)\t((uint8_t) ((e) & 0xf))\n\n')
+        f.write('enum machine_state {\n')
+        for s in st.states:
+            f.write('\tstate_%s,\n' % (s, ))
+        f.write('};\n\nenum machine_event {\n')
+        for e in st.events:
+            f.write('\ttrig_%s,\n' % (e, ))
+        f.write('};\n\nenum machine_action {\n')
+        for a in ACTIONS:
+            f.write('\tact_%s,\n' % (a, ))
+        f.write('};\n\n')
+        f.write('extern const uint8_t state_table[STATE_COUNT][EVENT_COUNT]'
+                ' PROGMEM;\n')
+        f.write('// Label tables and strings in program space, read entries'
+                ' with pgm_read_ptr\n')
+        f.write('extern const char *const state_label[STATE_COUNT]'
+                ' PROGMEM;\n')
+        f.write('extern const char *const event_name[EVENT_COUNT]'
+                ' PROGMEM;\n')
+        f.write('extern const char *const event_label[EVENT_COUNT]'
+                ' PROGMEM;\n\n')
+        f.write('#endif // STATE_TABLE_H\n')
+
+
+def write_source(st, filename):
+    with open(filename, 'w') as f:
+        f.write('// SPDX-License-Identifier: MIT\n\n')
+        f.write('/*\n * Generated by reference/sm_mktable.py from')
+        f.write(' reference/state_table.txt\n */\n')
+        f.write('#include "state_table.h"\n\n')
+        f.write('const uint8_t state_table[STATE_COUNT][EVENT_COUNT]'
+                ' PROGMEM = {\n')
+        for s in st.states:
+            f.write('\t[state_%s] = {\n' % (s, ))
+            for e in st.events:
+                act, dst = st.entry(s, e)
+                f.write('\t\t[trig_%s] = (act_%s << 4) | state_%s,\n' %
+                        (e, act, dst))
+            f.write('\t},\n')
+        f.write('};\n\n// Label strings in program space\n')
+        for s in st.states:
+            f.write('static const char sl_%s[] PROGMEM = %s;\n' %
+                    (s, _cstr('[' + st.labels[s] + ']')))
+        for e in st.events:
+            f.write('static const char en_%s[] PROGMEM = %s;\n' %
+                    (e, _cstr(st.names[e])))
+        for e in st.events:
+            f.write('static const char el_%s[] PROGMEM = %s;\n' %
+                    (e, _cstr(st.elabels[e])))
+        f.write('\nconst char *const state_label[STATE_COUNT] PROGMEM = {\n')
+        for s in st.states:
+            f.write('\tsl_%s,\n' % (s, ))
+        f.write('};\n\nconst char *const event_name[EVENT_COUNT]'
+                ' PROGMEM = {\n')
+        for e in st.events:
+            f.write('\ten_%s,\n' % (e, ))
+        f.write('};\n\nconst char *const event_label[EVENT_COUNT]'
+                ' PROGMEM = {\n')
+        for e in st.events:
+            f.write('\tel_%s,\n' % (e, ))
+        f.write('};\n')
+
+
+def write_svg(st, filename):
+    """Render the transition table as a state x event grid"""
+    cw = 96
+    lw = 120
+    rh = 36
+    hh = 48
+    width = lw + cw * len(st.events) + 2
+    height = hh + rh * len(st.states) + 40
+    font = 'font-family="Helvetica" text-anchor="middle"'
+    with open(filename, 'w') as f:
+        f.write('<?xml version="1.0" encoding="UTF-8" standalone="no"?>\n')
+        f.write('<!-- Generated by reference/sm_mktable.py from'
+                ' reference/state_table.txt -->\n')
+        f.write('<svg xmlns="http://www.w3.org/2000/svg" width="%d" '
+                'height="%d" viewBox="0 0 %d %d">\n' %
+                (width, height, width, height))
+        f.write('<rect x="0" y="0" width="%d" height="%d" fill="#ffffff"/>\n'
+                % (width, height))
+        f.write('<text x="%d" y="20" %s font-size="14" font-weight="bold">'
+                'Remootio Hay Hoist - State Transitions</text>\n' %
+                (width // 2, font))
+        y = hh
+        for i, e in enumerate(st.events):
+            x = lw + cw * i + cw // 2
+            f.write('<text x="%d" y="%d" %s font-size="11" '
+                    'font-weight="bold">%s</text>\n' %
+                    (x, y - 6, font, escape(st.names[e])))
+        for j, s in enumerate(st.states):
+            y = hh + rh * j
+            f.write('<rect x="1" y="%d" width="%d" height="%d" '
+                    'fill="#eeeeee" stroke="#000000"/>\n' % (y, lw - 1, rh))
+            f.write('<text x="%d" y="%d" %s font-size="11" '
+                    'font-weight="bold">%s</text>\n' %
+                    (lw // 2, y + rh // 2 + 4, font, escape(st.labels[s])))
+            for i, e in enumerate(st.events):
+                x = lw + cw * i
+                act, dst = st.entry(s, e)
+                fill = '#ffffff'
+                if act == 'spurious':
+                    fill = '#f4f4f4'
+                elif act in ('error', 'fault', 'tangle'):
+                    fill = '#f8d8d0'
+                f.write('<rect x="%d" y="%d" width="%d" height="%d" '
+                        'fill="%s" stroke="#000000"/>\n' %
+                        (x, y, cw, rh, fill))
+                if act == 'spurious':
+                    continue
+                f.write('<text x="%d" y="%d" %s font-size="10">%s</text>\n' %
+                        (x + cw // 2, y + 15, font,
+                         escape(st.labels[dst] if dst != s else '-')))
+                f.write('<text x="%d" y="%d" %s font-size="9" '
+                        'font-style="italic">%s</text>\n' %
+                        (x + cw // 2, y + 28, font, escape(act)))
+        f.write('<text x="4" y="%d" font-family="Helvetica" font-size="10">'
+                'Cells show next state and action, blank cells report a '
+                'spurious trigger.</text>\n' % (height - 14, ))
+        f.write('</svg>\n')
+
+
+def main():
+    if len(sys.argv) != 5:
+        print('Usage: sm_mktable.py state_table.txt state_table.h '
+              'state_table.c table.svg')
+        return 1
+    st = load(sys.argv[1])
+    # write header first so the make rule sees the other outputs as newer
+    write_header(st, sys.argv[2])
+    write_source(st, sys.argv[3])
+    write_svg(st, sys.argv[4])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Battery state of charge and energy per feed estimate
+ *
+ * Rest voltage is filtered once the motors have been off long enough
+ * for the battery to recover, and load voltage once a move is up to
+ * speed. Their difference is the sag under motor load. Charge is
+ * read from rest voltage on a lead-acid open circuit curve. Each
+ * hoist integrates battery voltage over its motor-on ticks into the
+ * energy used by a feed, from leaving home until its return.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "system.h"
+#include "battery.h"
+
+#define SOC_POINTS	11U	// curve points, 0% to 100%
+#define SOC_STEP	100U	// charge between curve points (0.1%)
+#define VS_TICKS	100000UL	// mV.ticks per V.s
+
+struct battery battery;
+
+// Energy used by each hoist's feeds
+struct feed_energy {
+	uint32_t used;		// mV.ticks with motor power since feed start
+	uint16_t learned;	// V.s per feed, 0 until one completes
+	uint8_t feeding;	// feed started and not yet home
+};
+
+static struct feed_energy energy[HOIST_COUNT];
+
+// Rest voltage at each 10% of charge, mV
+static const uint16_t soc_curve[SOC_POINTS] PROGMEM = {
+	11390, 11510, 11660, 11810, 11960, 12100,
+	12240, 12370, 12500, 12620, 12730,
+};
+
+// Battery voltage from the 10 bit conversion, 40mV per count,
+// ADCL must be read first, and not split by the sag interrupt
+static uint16_t sample(void)
+{
+	uint8_t lo;
+	uint8_t hi;
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		lo = ADCL;
+		hi = ADCH;
+	}
+	return (uint16_t) ((hi << 2 | lo >> 6) * 40U);
+}
+
+// Move avg toward val by 1/2^gain, or start at val
+static uint16_t filter(uint16_t avg, uint16_t val, uint8_t gain)
+{
+	if (!avg) {
+		return val;
+	}
+	if (val > avg) {
+		return (uint16_t) (avg + ((val - avg) >> gain));
+	}
+	return (uint16_t) (avg - ((avg - val) >> gain));
+}
+
+static uint16_t clamp16(uint32_t val)
+{
+	if (val > 0xffffU) {
+		return 0xffffU;
+	}
+	return (uint16_t) val;
+}
+
+void battery_init(void)
+{
+	// motors are off at reset
+	battery.rest = sample();
+	battery.quiet = BATT_SETTLE;
+}
+
+void battery_update(void)
+{
+	uint16_t mv = sample();
+	uint8_t running = 0;
+	uint8_t n;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		if (*pinmap[n].port & pinmap[n].pwr) {
+			energy[n].used += mv;
+			running = 1U;
+		}
+	}
+	if (running) {
+		if (!battery.running) {
+			battery.load = 0;
+		}
+		if (battery.running < BATT_LOADWAIT) {
+			++battery.running;
+		} else {
+			battery.load = filter(battery.load, mv, BATT_GAIN);
+		}
+		battery.quiet = 0;
+		return;
+	}
+	if (battery.running) {
+		// motors stopped, learn sag from the move
+		battery.running = 0;
+		if (battery.load && battery.load < battery.rest) {
+			battery.sag = filter(battery.sag, (uint16_t)
+					     (battery.rest - battery.load),
+					     BATT_LEARN);
+		}
+	}
+	if (battery.quiet < BATT_SETTLE) {
+		++battery.quiet;
+	} else {
+		battery.rest = filter(battery.rest, mv, BATT_GAIN);
+	}
+}
+
+uint16_t battery_charge(void)
+{
+	uint16_t lo = pgm_read_word(&soc_curve[0]);
+	uint16_t hi;
+	uint8_t i;
+	if (battery.rest <= lo) {
+		return 0;
+	}
+	for (i = 1U; i < SOC_POINTS; i++) {
+		hi = pgm_read_word(&soc_curve[i]);
+		if (battery.rest < hi) {
+			return (uint16_t) ((i - 1U) * SOC_STEP
+					   + (uint32_t) (battery.rest - lo)
+					   * SOC_STEP / (hi - lo));
+		}
+		lo = hi;
+	}
+	return SOC_STEP * (SOC_POINTS - 1U);
+}
+
+uint16_t battery_resist(void)
+{
+	return (uint16_t) (battery.sag / BATT_AMPS);
+}
+
+uint16_t battery_feed(void)
+{
+	if (energy[unit].learned) {
+		return energy[unit].learned;
+	}
+	// none learned yet, lower for the set time and raise as long
+	return clamp16(2UL * feed->p1_timeout * battery.rest / VS_TICKS);
+}
+
+uint16_t battery_after(void)
+{
+	uint16_t charge = battery_charge();
+	uint32_t capacity = BATT_AH * 3600UL * BATT_VNOM / 1000U;
+	uint32_t drop = (uint32_t) battery_feed() * BATT_AMPS;
+	// round up, in 0.1% of capacity
+	drop = (drop + capacity - 1U) / capacity;
+	if (drop >= charge) {
+		return 0;
+	}
+	return (uint16_t) (charge - drop);
+}
+
+uint8_t battery_admit(void)
+{
+	// motor load must not pull the battery below the low threshold
+	if (battery.rest < battery.sag
+	    || (uint16_t) (battery.rest - battery.sag) < LOWVOLTS * 160U) {
+		return 0;
+	}
+	return battery_after() >= BATT_RESERVE;
+}
+
+void battery_feed_start(void)
+{
+	energy[unit].used = 0;
+	energy[unit].feeding = 1U;
+}
+
+void battery_feed_end(void)
+{
+	struct feed_energy *e = &energy[unit];
+	uint16_t used = clamp16(e->used / VS_TICKS);
+	if (e->feeding && used) {
+		e->learned = filter(e->learned, used, BATT_LEARN);
+	}
+	e->feeding = 0;
+}
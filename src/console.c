@@ -1,27 +1,56 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdint.h>
+#include <stddef.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
 #include "system.h"
 #include "console.h"
+#include "entropy.h"
+#include "modbus.h"
 
 #define BUFLEN 0x100
 #define BUFMASK (BUFLEN-1)
 #define RXWI GPIOR1
 #define RXRI GPIOR2
-#define IDLE_TIMEOUT	30000U	// Disable console after ~5min idle
+#define IDLE_TIMEOUT	30000U	// Disable console after 5min idle
+#define EVTLEN	16U		// Queued console events
+#define EVTMASK	(EVTLEN-1)
+#define RUNLEN	64U		// Queued output runs
+#define RUNMASK	(RUNLEN-1)
+
+// Output is queued as runs, each either a string in program space
+// or a count of formatted bytes in txbuf, sent in place by UDRE
+struct tx_run {
+	const char *text;	// flash string, NULL for bytes in txbuf
+	uint8_t len;		// txbuf bytes not yet sent
+};
 
 static uint8_t rxbuf[BUFLEN];
 static uint8_t txbuf[BUFLEN];
 static volatile uint8_t TXRI;
-static volatile uint8_t TXWI;
+static uint8_t TXWI;
+static struct tx_run txrun[RUNLEN];
+static volatile uint8_t RNRI;
+static volatile uint8_t RNWI;
 static volatile uint8_t rx_stall;
 static uint8_t wrenabled = 1;
 static uint8_t rdenabled = 0;
 static uint8_t command;
+static struct console_event evtbuf[EVTLEN];
+static uint8_t EVRI;
+static uint8_t EVWI;
+static uint8_t framed;
+static volatile uint8_t frame_open;	// received since last silence
+static volatile uint8_t frame_bad;	// open frame has an error or gap
+static volatile uint8_t frame_ready;	// rxbuf holds frame to frame_end
+static volatile uint8_t frame_end;
+static volatile uint16_t frame_last;	// timer1 count at last character
 
-static const char help[] = "\
+static const char help[] PROGMEM = "\
 \r\n\
 Commands:\r\n\
 \t1\tH-P1 (0.01s)\r\n\
@@ -31,17 +60,50 @@ Commands:\r\n\
 \tr\tH-Retry (0.01s)\r\n\
 \tf\tFeed (minutes)\r\n\
 \tn\tFeeds/week (0=off)\r\n\
+\ta\tAccel (0.01s)\r\n\
+\tb\tDecel (0.01s)\r\n\
+\tz\tApproach (0.01s)\r\n\
+\tl\tSlow (%)\r\n\
+\ti\tHoist (1-2)\r\n\
+\tx\tModbus address (0=off)\r\n\
+\tg\tDebounce (input 1-6, 0.01s 1-7)\r\n\
 \tv\tShow values\r\n\
 \ts\tStatus\r\n\
+\tt\tTelemetry\r\n\
+\te\tBattery\r\n\
+\to\tWear counters\r\n\
+\tk\tInputs\r\n\
+\tc\tCalibrate travel\r\n\
+\tw\tFirmware update\r\n\
 \td\tLower\r\n\
 \tu\tRaise\r\n\
 \r\n";
 
+// Restart the silence timer, a gap over 1.5 characters spoils the frame
+static void frame_char(uint8_t status)
+{
+	uint16_t now = TCNT1;
+	if (status & (_BV(FE0) | _BV(DOR0))) {
+		frame_bad = 1U;
+	} else if (frame_open && (uint16_t) (now - frame_last) > MODBUS_T15) {
+		frame_bad = 1U;
+	}
+	frame_open = 1U;
+	frame_last = now;
+	OCR1B = (uint16_t) (now + MODBUS_T35);
+	TIFR1 = _BV(OCF1B);
+	TIMSK1 |= _BV(OCIE1B);
+}
+
 ISR(USART_RX_vect)
 {
 	uint8_t status = UCSR0A;
 	uint8_t tmp = UDR0;
 	uint8_t look = (uint8_t) ((RXWI + 1) & BUFMASK);
+	entropy_event();
+	if (framed) {
+		frame_char(status);
+	}
 	// stall input when output buf is full
 	if (look != RXRI) {
 		if (status & (_BV(FE0) | _BV(DOR0))) {
@@ -50,19 +112,50 @@ ISR(USART_RX_vect)
 			rxbuf[look] = tmp;
 		}
 		RXWI = look;
+	} else {
+		frame_bad = 1U;
 	}
 }
 
-ISR(USART_UDRE_vect)
+// Silence of 3.5 characters ends a frame, keep one frame at a time
+ISR(TIMER1_COMPB_vect)
 {
-	if (TXRI != TXWI) {
-		uint8_t look = (uint8_t) ((TXRI + 1U) & BUFMASK);
-		UDR0 = txbuf[look];
-		TXRI = look;	// Release FIFO slot
+	TIMSK1 &= (uint8_t) ~_BV(OCIE1B);
+	if (frame_bad || frame_ready) {
+		RXWI = frame_end;
 	} else {
-		UCSR0B &= (uint8_t) ~ _BV(UDRIE0);
-		rx_stall = 0;
+		frame_end = RXWI;
+		frame_ready = 1U;
+	}
+	frame_open = 0;
+	frame_bad = 0;
+}
+
+// Send the next byte of the oldest run, runs are never queued empty
+// so at most one finished run is released per interrupt
+ISR(USART_UDRE_vect)
+{
+	struct tx_run *run;
+	uint8_t ch;
+	while (RNRI != RNWI) {
+		run = &txrun[(uint8_t) ((RNRI + 1U) & RUNMASK)];
+		if (run->text) {
+			ch = pgm_read_byte(run->text);
+			if (ch) {
+				++run->text;
+				UDR0 = ch;
+				return;
+			}
+		} else if (run->len) {
+			--run->len;
+			TXRI = (uint8_t) ((TXRI + 1U) & BUFMASK);
+			UDR0 = txbuf[TXRI];	// Release FIFO slot
+			return;
+		}
+		RNRI = (uint8_t) ((RNRI + 1U) & RUNMASK);	// Release run
 	}
+	UCSR0B &= (uint8_t) ~ _BV(UDRIE0);
+	rx_stall = 0;
 }
 
 // Set UDREIE to begin transfer
@@ -71,12 +164,32 @@ static void enable_transfer(void)
 	UCSR0B |= _BV(UDRIE0);
 }
 
-// Write byte to tx buffer
-static void write_serial(uint8_t ch)
+// Return count of queued output runs
+static uint8_t run_count(void)
 {
-	if (wrenabled) {
-		uint8_t look = (uint8_t) ((TXWI + 1) & BUFMASK);
-		if (look != TXRI) {
+	return (uint8_t) ((RNWI - RNRI) & RUNMASK);
+}
+
+// Add byte to tx buffer, extending the newest run if it holds bytes
+static void queue_byte(uint8_t ch)
+{
+	uint8_t look = (uint8_t) ((TXWI + 1) & BUFMASK);
+	uint8_t next;
+	if (look == TXRI) {
+		rx_stall = 1U;
+		return;		// drop output
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		next = (uint8_t) ((RNWI + 1U) & RUNMASK);
+		if (RNRI != RNWI && txrun[RNWI].text == NULL) {
+			++txrun[RNWI].len;
+			next = RNWI;
+		} else if (next != RNRI) {
+			txrun[next].text = NULL;
+			txrun[next].len = 1U;
+			RNWI = next;
+		}
+		if (next == RNWI) {
 			txbuf[look] = ch;
 			TXWI = look;
 		} else {
@@ -86,6 +199,31 @@ static void write_serial(uint8_t ch)
 	}
 }
 
+// Queue a reference to a flash string
+static void queue_text(const char *text)
+{
+	uint8_t look = (uint8_t) ((RNWI + 1U) & RUNMASK);
+	if (!pgm_read_byte(text)) {
+		return;
+	}
+	if (look != RNRI) {
+		txrun[look].text = text;
+		txrun[look].len = 0;
+		RNWI = look;
+	} else {
+		rx_stall = 1U;
+		// drop output
+	}
+}
+
+// Write byte to tx buffer
+static void write_serial(uint8_t ch)
+{
+	if (wrenabled) {
+		queue_byte(ch);
+	}
+}
+
 // Write byte and then flag transfer
 static void send_byte(uint8_t ch)
 {
@@ -114,6 +252,20 @@ static void write_wordval(uint16_t value)
 	}
 }
 
+// Write 32 bit value as decimal integer
+static void write_longval(uint32_t value)
+{
+	uint8_t digits[10];
+	uint8_t len = 0;
+	do {
+		digits[len++] = (uint8_t) (0x30 + value % 10U);
+		value = value / 10U;
+	} while (value);
+	while (len) {
+		write_serial(digits[--len]);
+	}
+}
+
 static void write_nibble(uint8_t nibble)
 {
 	if (nibble > 0x09) {
@@ -139,24 +291,45 @@ static void write_hexval(uint8_t value)
 	write_nibble(value & 0xf);
 }
 
-// Copy string to write buffer
+// Queue flash string without copying
 static void write_string(const char *message)
 {
-	while (*message) {
-		write_serial((uint8_t) * message++);
+	if (wrenabled) {
+		queue_text(message);
+	}
+}
+
+#if HOIST_COUNT > 1
+// Precede output for a different hoist with a "Hoist: n" line
+static void show_unit(void)
+{
+	static uint8_t shown;
+	if (unit != shown) {
+		shown = unit;
+		write_string(PSTR("Hoist: "));
+		write_serial((uint8_t) (0x31 + unit));
+		write_string(PSTR("\r\n"));
 	}
 }
+#else
+static void show_unit(void)
+{
+}
+#endif // HOIST_COUNT
 
 // Write null-terminated string to serial out
 void console_write(const char *message)
 {
+	show_unit();
 	write_string(message);
 	enable_transfer();
 }
 
 static void newline(void)
 {
-	console_write("\x0d\x0a");
+	write_serial(0x0d);
+	write_serial(0x0a);
+	enable_transfer();
 }
 
 // Read command byte
@@ -168,42 +341,77 @@ static uint8_t get_cmd(uint8_t ch)
 		break;
 	case 0x68:
 	case 0x48:
-		console_write("H? ");
+		console_write(PSTR("H? "));
 		return 0x68;
 		break;
 	case 0x70:
 	case 0x50:
-		console_write("P? ");
+		console_write(PSTR("P? "));
 		return 0x70;
 		break;
 	case 0x72:
 	case 0x52:
-		console_write("H-Retry? ");
+		console_write(PSTR("H-Retry? "));
 		return 0x72;
 		break;
 	case 0x31:
-		console_write("H-P1? ");
+		console_write(PSTR("H-P1? "));
 		return 0x31;
 		break;
 	case 0x32:
-		console_write("P1-P2? ");
+		console_write(PSTR("P1-P2? "));
 		return 0x32;
 		break;
 	case 0x66:
 	case 0x46:
-		console_write("Feed min? ");
+		console_write(PSTR("Feed min? "));
 		return 0x66;
 		break;
 	case 0x6e:
 	case 0x4e:
-		console_write("Feeds/week? ");
+		console_write(PSTR("Feeds/week? "));
 		return 0x6e;
 		break;
 	case 0x6d:
 	case 0x4d:
-		console_write("Man? ");
+		console_write(PSTR("Man? "));
 		return 0x6d;
 		break;
+	case 0x61:
+	case 0x41:
+		console_write(PSTR("Accel? "));
+		return 0x61;
+		break;
+	case 0x62:
+	case 0x42:
+		console_write(PSTR("Decel? "));
+		return 0x62;
+		break;
+	case 0x7a:
+	case 0x5a:
+		console_write(PSTR("Approach? "));
+		return 0x7a;
+		break;
+	case 0x6c:
+	case 0x4c:
+		console_write(PSTR("Slow? "));
+		return 0x6c;
+		break;
+	case 0x69:
+	case 0x49:
+		console_write(PSTR("Hoist? "));
+		return 0x69;
+		break;
+	case 0x78:
+	case 0x58:
+		console_write(PSTR("Modbus? "));
+		return 0x78;
+		break;
+	case 0x67:
+	case 0x47:
+		console_write(PSTR("Debounce? "));
+		return 0x67;
+		break;
 	case 0x3f:
 		console_write(help);
 		break;
@@ -215,6 +423,30 @@ static uint8_t get_cmd(uint8_t ch)
 	case 0x56:
 		return 0x76;
 		break;
+	case 0x74:		// t : controller telemetry
+	case 0x54:
+		return 0x74;
+		break;
+	case 0x65:		// e : battery estimate
+	case 0x45:
+		return 0x65;
+		break;
+	case 0x6f:		// o : wear counters
+	case 0x4f:
+		return 0x6f;
+		break;
+	case 0x6b:		// k : input filters
+	case 0x4b:
+		return 0x6b;
+		break;
+	case 0x63:		// c : calibrate travel
+	case 0x43:
+		return 0x63;
+		break;
+	case 0x77:		// w : firmware update
+	case 0x57:
+		return 0x77;
+		break;
 	case 0x75:		// u : raise/up
 	case 0x55:
 		return 0x75;
@@ -277,6 +509,42 @@ static void read_input(uint8_t ch, struct console_event *event)
 				event->value = 0;
 				newline();
 				command = 0;
+			} else if (command == 0x74) {
+				event->type = event_telemetry;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
+			} else if (command == 0x65) {
+				event->type = event_battery;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
+			} else if (command == 0x6f) {
+				event->type = event_wear;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
+			} else if (command == 0x6b) {
+				event->type = event_inputs;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
+			} else if (command == 0x63) {
+				event->type = event_calibrate;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
+			} else if (command == 0x77) {
+				event->type = event_bootload;
+				event->key = 0;
+				event->value = 0;
+				newline();
+				command = 0;
 			} else if (command == 0x75) {
 				event->type = event_up;
 				event->key = 0;
@@ -332,7 +600,7 @@ static void read_input(uint8_t ch, struct console_event *event)
 			case 0x0d:
 			case 0x0a:
 				// check auth key
-				if (val == feed.pk) {
+				if (val == passkey) {
 					newline();
 					event->type = event_auth;
 					event->key = 0;
@@ -354,52 +622,85 @@ void console_flush(void)
 	RXRI = RXWI;
 }
 
-// Fetch next event from console
-void console_read(struct console_event *event)
+void console_drain(void)
+{
+	while (RNRI != RNWI) {
+		wdt_reset();
+	}
+}
+
+// Parse all pending input into the event queue
+void console_read(void)
 {
 	uint8_t look;
 	uint8_t ch;
-	static uint16_t count = 0;
-	event->type = event_none;
-	++count;
-	if (count >= IDLE_TIMEOUT) {
-		count = 0xfffe;
+	struct console_event *event;
+	static uint32_t lastrx = 0;
+	static uint8_t idle = 0;
+	if (framed) {
+		return;
+	}
+	if (!idle && uptime - lastrx >= IDLE_TIMEOUT) {
+		idle = 1U;
 		if (rdenabled) {
-			console_write("\r\nIdle Timeout\r\n");
+			console_write(PSTR("\r\nIdle Timeout\r\n"));
 		}
 		command = 0;
 		rdenabled = 0;
 		wrenabled = 0;
 	}
-	while (RXRI != RXWI) {
-		count = 0;
-		look = (uint8_t) ((RXRI + 1U) & BUFMASK);
-		ch = rxbuf[look];
-		RXRI = look;	// Release FIFO slot
+	// leave remaining input in rxbuf until queued events have replied,
+	// so echoes and prompts of later lines follow held replies
+	while (RXRI != RXWI && EVRI == EVWI) {
+		look = (uint8_t) ((EVWI + 1U) & EVTMASK);
+		lastrx = uptime;
+		idle = 0;
+		event = &evtbuf[look];
+		ch = rxbuf[(uint8_t) ((RXRI + 1U) & BUFMASK)];
+		RXRI = (uint8_t) ((RXRI + 1U) & BUFMASK);	// Release FIFO slot
 		read_input(ch, event);
 		if (event->type == event_auth) {
 			rdenabled = 1;
 			wrenabled = 1;
-			console_write("OK\r\n");
-		} else {
-			if (event->type) {
-				break;
-			}
+			console_write(PSTR("OK\r\n"));
+		} else if (event->type != event_none) {
+			EVWI = look;
 		}
 	}
 }
 
+// Fetch next queued event, return 0 if none
+uint8_t console_next(struct console_event *event)
+{
+	if (EVRI == EVWI) {
+		return 0;
+	}
+	// hold events until there is room for a full reply, the wear
+	// counters take 42 runs
+	if (((uint8_t) (TXWI - TXRI) & BUFMASK) >= BUFLEN / 2U
+	    || run_count() >= RUNLEN / 4U) {
+		return 0;
+	}
+	// an EEPROM write would stall a frame being sent
+	if (framed && RNRI != RNWI) {
+		return 0;
+	}
+	EVRI = (uint8_t) ((EVRI + 1U) & EVTMASK);
+	*event = evtbuf[EVRI];
+	return 1U;
+}
+
 static void show_clock(void)
 {
-	write_string(" @");
-	write_wordval(feed.clock);
+	write_string(PSTR(" @"));
+	write_longval(feed->clock);
 }
 
 static void show_voltage(uint8_t vsense)
 {
 	uint16_t scaled = (uint16_t) (vsense << 7U);
 	uint16_t av = (uint8_t) ((scaled + 40U) / 80U);
-	write_string(" Batt: ");
+	write_string(PSTR(" Batt: "));
 	if (av > 99U) {
 		write_serial((uint8_t) (0x30 + av / 100));
 		av = av % 100;
@@ -412,53 +713,21 @@ static void show_voltage(uint8_t vsense)
 	}
 	write_serial(0x2e);
 	write_serial((uint8_t) (0x30 + av));
-	write_string("V");
+	write_string(PSTR("V"));
 }
 
 // Output current machine state and voltage
 void console_showstate(uint8_t state, uint8_t error, uint8_t vsense)
 {
-	const char *smsg;
-	write_string("State: ");
-	switch (state) {
-	case state_stop:
-		smsg = "[STOP]";
-		break;
-	case state_stop_h_p1:
-		smsg = "[STOP H-P1]";
-		break;
-	case state_stop_p1_p2:
-		smsg = "[STOP P1-P2]";
-		break;
-	case state_at_h:
-		smsg = "[AT H]";
-		break;
-	case state_at_p1:
-		smsg = "[AT P1]";
-		break;
-	case state_at_p2:
-		smsg = "[AT P2]";
-		break;
-	case state_move_h_p1:
-		smsg = "[MOVE H-P1]";
-		break;
-	case state_move_p1_p2:
-		smsg = "[MOVE P1-P2]";
-		break;
-	case state_move_h:
-		smsg = "[MOVE -H]";
-		break;
-	case state_move_man:
-		smsg = "[MOVE MAN]";
-		break;
-	case state_error:
-	default:
-		smsg = "[Unknown/Error]";
-		break;
+	const char *smsg = PSTR("[Unknown/Error]");
+	show_unit();
+	write_string(PSTR("State: "));
+	if (state < STATE_COUNT) {
+		smsg = pgm_read_ptr(&state_label[state]);
 	}
 	write_string(smsg);
 	if (error) {
-		write_string(" [Error]");
+		write_string(PSTR(" [Error]"));
 	}
 	show_voltage(vsense);
 	show_clock();
@@ -468,15 +737,43 @@ void console_showstate(uint8_t state, uint8_t error, uint8_t vsense)
 // Write string and decimal value to console
 void console_showval(const char *message, uint16_t value)
 {
+	show_unit();
 	write_string(message);
 	write_wordval(value);
 	newline();
 	enable_transfer();
 }
 
+// Write string and 32 bit decimal value to console
+void console_showlong(const char *message, uint32_t value)
+{
+	show_unit();
+	write_string(message);
+	write_longval(value);
+	newline();
+	enable_transfer();
+}
+
+// Show list of space separated decimal values
+void console_showvals(const char *message, const uint16_t *vals, uint8_t len)
+{
+	show_unit();
+	write_string(message);
+	while (len) {
+		write_wordval(*(vals++));
+		--len;
+		if (len) {
+			write_serial(0x20);
+		}
+	}
+	newline();
+	enable_transfer();
+}
+
 // Show buffer as hex values
 void console_showhex(const char *message, uint8_t * buf, uint8_t len)
 {
+	show_unit();
 	write_string(message);
 	while (len) {
 		write_hexval(*(buf++));
@@ -489,6 +786,7 @@ void console_showhex(const char *message, uint8_t * buf, uint8_t len)
 // Show ascii string with max length
 void console_showascii(const char *message, uint8_t * buf, uint8_t len)
 {
+	show_unit();
 	write_string(message);
 	uint8_t ch;
 	while (len) {
@@ -504,12 +802,80 @@ void console_showascii(const char *message, uint8_t * buf, uint8_t len)
 	enable_transfer();
 }
 
+uint8_t console_room(void)
+{
+	return (uint8_t) ((EVRI - EVWI - 1U) & EVTMASK);
+}
+
+uint8_t console_post(const struct console_event *event)
+{
+	uint8_t look = (uint8_t) ((EVWI + 1U) & EVTMASK);
+	if (look == EVRI) {
+		return 0;
+	}
+	evtbuf[look] = *event;
+	EVWI = look;
+	return 1U;
+}
+
+uint8_t console_busy(void)
+{
+	return framed && (frame_open || frame_ready || RNRI != RNWI);
+}
+
+void console_framed(uint8_t enable)
+{
+	console_drain();
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		TIMSK1 &= (uint8_t) ~_BV(OCIE1B);
+		framed = enable;
+		frame_open = 0;
+		frame_bad = 0;
+		frame_ready = 0;
+		RXRI = RXWI;
+		frame_end = RXWI;
+	}
+	command = 0;
+	rdenabled = 0;
+	wrenabled = !enable;
+}
+
+uint8_t console_frame(uint8_t *buf, uint8_t len)
+{
+	uint8_t count;
+	uint8_t i;
+	if (!frame_ready) {
+		return 0;
+	}
+	count = (uint8_t) ((frame_end - RXRI) & BUFMASK);
+	if (count > len) {
+		count = 0;
+	}
+	for (i = 0; i < count; i++) {
+		buf[i] = rxbuf[(uint8_t) ((RXRI + 1U + i) & BUFMASK)];
+	}
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		RXRI = frame_end;	// Release FIFO slots
+		frame_ready = 0;
+	}
+	return count;
+}
+
+void console_send(const uint8_t *buf, uint8_t len)
+{
+	while (len) {
+		queue_byte(*buf++);
+		--len;
+	}
+	enable_transfer();
+}
+
 void console_init(void)
 {
-	// 19200,8n1 w/ interrupt receive & send
-	UBRR0L = 12;
+	// CONSOLE_BAUD (19200),8n1 w/ interrupt receive & send
+	UBRR0L = (uint8_t) CONSOLE_UBRR;
 	UCSR0A |= _BV(U2X0);	// x2 clock
 	UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
 	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
-	console_showval("Info: Boot v", sw_version);
+	console_showval(PSTR("Info: Boot v"), sw_version);
 }
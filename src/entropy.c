@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Entropy collector: ADC noise and console timing jitter
+ *
+ * Battery sense conversions carry noise in the two bits below the
+ * ADCH reading used elsewhere. Each conversion is health tested and
+ * mixed into a one-at-a-time hash pool, along with timer1 counts
+ * captured as console bytes arrive from an independent oscillator.
+ * Only ADC samples that pass the health tests are credited.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include "system.h"
+#include "console.h"
+#include "entropy.h"
+
+uint8_t entropy_status;
+volatile uint8_t entropy_jitter;
+
+static uint32_t pool;
+static uint16_t credit;		// passing samples since last seed
+static uint8_t rct_last;
+static uint8_t rct_count;
+static uint8_t apt_first;
+static uint16_t apt_count;
+static uint16_t apt_len;
+
+static void mix(uint8_t val)
+{
+	pool += val;
+	pool += pool << 10;
+	pool ^= pool >> 6;
+}
+
+// Finalise pool into a seed, credit is spent
+static uint32_t extract(void)
+{
+	uint32_t seed = pool;
+	seed += seed << 3;
+	seed ^= seed >> 11;
+	seed += seed << 15;
+	mix((uint8_t) credit);
+	credit = 0;
+	return seed;
+}
+
+static void health_fail(uint8_t flag)
+{
+	entropy_status |= flag;
+	credit = 0;
+}
+
+// Mix one raw sample, credit it if both health tests pass
+static void entropy_add(uint8_t sample)
+{
+	mix(sample);
+	if (sample != rct_last || !rct_count) {
+		rct_last = sample;
+		rct_count = 0;
+	}
+	if (rct_count < ENTROPY_RCT) {
+		++rct_count;
+	}
+	if (!apt_len) {
+		apt_first = sample;
+		apt_count = 0;
+	}
+	if (sample == apt_first) {
+		++apt_count;
+	}
+	if (++apt_len >= ENTROPY_APTWIN) {
+		apt_len = 0;
+	}
+	if (rct_count >= ENTROPY_RCT) {
+		health_fail(ENTROPY_FAILRCT);
+	} else if (apt_count >= ENTROPY_APT) {
+		health_fail(ENTROPY_FAILAPT);
+	} else if (credit < ENTROPY_SEEDLEN) {
+		++credit;
+	}
+}
+
+// Low byte of the 10 bit conversion, ADCL must be read first
+static uint8_t adc_sample(void)
+{
+	uint8_t lo = ADCL;
+	uint8_t hi = ADCH;
+	ADCSRA |= _BV(ADIF);
+	return (uint8_t) (hi << 2 | lo >> 6);
+}
+
+void entropy_init(void)
+{
+	uint16_t i;
+	// free running timer1 at F_CPU timestamps asynchronous events
+	TCCR1B = _BV(CS10);
+	for (i = 0; i < ENTROPY_STARTUP; i++) {
+		loop_until_bit_is_set(ADCSRA, ADIF);
+		entropy_add(adc_sample());
+		wdt_reset();
+	}
+	if (entropy_status) {
+		console_write(PSTR("Entropy: Health fail\r\n"));
+	}
+	srandom(extract());
+}
+
+void entropy_poll(void)
+{
+	uint8_t jitter;
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		jitter = entropy_jitter;
+		entropy_jitter = 0;
+	}
+	if (jitter) {
+		mix(jitter);
+	}
+	if (bit_is_set(ADCSRA, ADIF)) {
+		entropy_add(adc_sample());
+	}
+	if (credit >= ENTROPY_SEEDLEN) {
+		srandom(extract());
+	}
+}
@@ -5,30 +5,81 @@
  */
 #include <stdint.h>
 #include <stdlib.h>
+#include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include <avr/wdt.h>
-#include <util/delay_basic.h>
 #include "system.h"
 #include "console.h"
+#include "timer.h"
+#include "spmcheck.h"
+#include "throttle.h"
+#include "travel.h"
+#include "boot.h"
+#include "entropy.h"
+#include "modbus.h"
+#include "battery.h"
+#include "wear.h"
+#include "sag.h"
 
-static void flag_error(void)
+static uint8_t stall_over;
+static uint8_t stall_still;
+static uint8_t stall_seen;	// stall reported without stopping
+static uint8_t addressed;	// hoist addressed by console commands
+
+// Controller power sequence, starts and stops run over ticks
+enum drive_phase {
+	drive_off,		// controller unpowered
+	drive_wake,		// powered, controller waking before throttle
+	drive_run,		// powered, throttle raised
+	drive_ramp,		// powered, throttle ramping down to stop
+	drive_settle,		// powered, throttle CV settling at zero
+	drive_rolldown,		// unpowered, motor rolling down
+};
+
+struct drive {
+	uint8_t phase;
+	uint8_t count;		// ticks left to wake, settle or roll down
+	uint8_t pending;	// direction of a start held until stopped
+};
+
+static struct drive drives[HOIST_COUNT];
+
+static void arm_timers(void);
+static void arm_retry(void);
+static void show_telemetry(void);
+
+static void flag_error(uint8_t cause)
 {
-	feed.error = 1U;
+	feed->error = 1U;
+	wear_error(cause);
 }
 
 static void clear_error(void)
 {
-	feed.error = 0;
+	feed->error = 0;
 }
 
 static void read_voltage(void)
 {
+#if HOIST_COUNT > 1
+	static uint8_t low = 0;
+	// no indicator pin, report changes on the console
+	if ((ADCH < LOWVOLTS) != low) {
+		low = !low;
+		if (low) {
+			console_write(PSTR("Battery: Low\r\n"));
+		} else {
+			console_write(PSTR("Battery: OK\r\n"));
+		}
+	}
+#endif // HOIST_COUNT
 	if (ADCH < LOWVOLTS) {
 		// Set Indicator
-		PORTD |= _BV(LED);
+		PORTD |= INDICATOR;
 	} else {
 		// Clear Indicator
-		PORTD &= (uint8_t) ~ _BV(LED);
+		PORTD &= (uint8_t) ~ INDICATOR;
 	}
 }
 
@@ -39,60 +90,232 @@ static uint8_t check_voltage(uint8_t override)
 		return override & OVRLOW;
 	} else {
 		// allow any set override
-		return (override || curvolts >= NIGHTVOLTS);
+		return (override || battery_admit());
 	}
 }
 
-static void motor_start(void)
+// Set direction and power the controller, throttle follows on wake
+static void motor_drive(uint8_t dir)
 {
-	PORTD |= _BV(PWR);	// enable controller power
-	_delay_loop_2(MOTOR_DELAY);	// pause for controller
-	PORTD |= _BV(THROTTLE);	// raise throttle CV
+	struct drive *d = &drives[unit];
+	*pins->port |= dir;
+	*pins->port |= pins->pwr;	// enable controller power
+	d->phase = drive_wake;
+	d->count = MOTOR_WAKE;
 }
 
-static void motor_stop(void)
+// Raise throttle once the controller is awake
+static void motor_run(void)
 {
-	PORTD &= (uint8_t) ~ _BV(THROTTLE);	// lower throttle CV
-	_delay_loop_2(MOTOR_DELAY);	// pause to allow CV to settle
-	PORTD &= (uint8_t) ~ (_BV(PWR) | _BV(FWD) | _BV(REV));	// disable
-	// busy wait to allow motor roll down
-	uint8_t count = 0;
-	while (count < MOTOR_OFFCOUNT) {
-		wdt_reset();
-		_delay_loop_2(MOTOR_OFFTIME);
-		++count;
+	throttle_ramp(THROTTLE_FULL, feed->accel);	// raise throttle CV
+	sag_start();
+	if (pins->spm) {
+		stall_over = 0;
+		stall_still = 0;
+		stall_seen = 0;
+		spm_poll_start();
+	}
+	drives[unit].phase = drive_run;
+}
+
+// Start in direction dir once any stop in progress completes
+static void motor_start(uint8_t dir)
+{
+	struct drive *d = &drives[unit];
+	if (d->phase == drive_off) {
+		motor_drive(dir);
+	} else {
+		d->pending = dir;
+	}
+}
+
+// Cut controller power and allow the motor to roll down
+static void motor_off(void)
+{
+	struct drive *d = &drives[unit];
+	*pins->port &= (uint8_t) ~ (pins->pwr | pins->fwd | pins->rev);
+	// only learn from whole moves, stopped at home, P1 or P2
+	sag_stop(!feed->error && (feed->state == state_at_h
+				  || feed->state == state_at_p1
+				  || feed->state == state_at_p2));
+	d->phase = drive_rolldown;
+	d->count = MOTOR_ROLLDOWN;
+}
+
+// Stop, ramping down over decel for a timed stop, else at once
+static void motor_stop(uint8_t timed)
+{
+	struct drive *d = &drives[unit];
+	d->pending = 0;
+	if (pins->spm) {
+		spm_poll_stop();
+	}
+	if (d->phase == drive_off || d->phase == drive_rolldown) {
+		return;
+	}
+	if (timed && d->phase == drive_run) {
+		// power is cut by motor_update once the ramp completes
+		throttle_ramp(0, feed->decel);	// lower throttle CV
+		d->phase = drive_ramp;
+	} else if (!timed || d->phase == drive_wake) {
+		// limit and error stops cut throttle and power together
+		throttle_ramp(0, 0);
+		motor_off();
+	}
+}
+
+// Advance the power sequence by one tick, then begin any held start
+static void motor_update(void)
+{
+	struct drive *d = &drives[unit];
+	uint8_t dir = d->pending;
+	switch (d->phase) {
+	case drive_wake:
+		if (--d->count == 0) {
+			motor_run();
+		}
+		break;
+	case drive_ramp:
+		if (throttle_off()) {
+			// pause to allow CV to settle
+			d->phase = drive_settle;
+			d->count = MOTOR_SETTLE;
+		}
+		break;
+	case drive_settle:
+		if (--d->count == 0) {
+			motor_off();
+		}
+		break;
+	case drive_rolldown:
+		if (--d->count == 0) {
+			d->phase = drive_off;
+		}
+		break;
+	default:
+		break;
+	}
+	if (d->phase == drive_off && dir) {
+		d->pending = 0;
+		// time the move from when the motor drives
+		feed->since = feed->clock;
+		arm_timers();
+		motor_drive(dir);
+	}
+}
+
+// Signal AT P1 state to Remootio
+static void signal_p1(void)
+{
+	*pins->atport |= pins->atp1;
+}
+
+// Signal AT H state to Remootio
+static void signal_home(void)
+{
+	*pins->atport &= (uint8_t) ~ pins->atp1;
+}
+
+// Return 1 if any hoist's controller is powered or stopping
+static uint8_t motor_running(void)
+{
+	uint8_t n;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		if (drives[n].phase != drive_off) {
+			return 1U;
+		}
 	}
+	return 0;
 }
 
-static void motor_reverse(void)
+static void show_travel(void)
 {
-	PORTD |= _BV(REV);
+	console_write(PSTR("Travel:\r\n"));
+	console_showval(PSTR("\tUp = "), travel->up);
+	console_showval(PSTR("\tDown = "), travel->down);
+	console_showval(PSTR("\tVolts = "), travel->volts);
+	console_write(PSTR("\r\n"));
 }
 
-static void motor_forward(void)
+// Complete a raise to home from a known depth
+static void finish_raise(uint16_t elapsed)
 {
-	PORTD |= _BV(FWD);
+	if (travel->run == travel_raise) {
+		travel->run = travel_idle;
+		travel_calibrate(elapsed);
+		console_write(PSTR("Calibrate: Done\r\n"));
+		show_travel();
+	} else if (travel_learn(elapsed)) {
+		console_showval(PSTR("Travel: Down = "), travel->down);
+	}
+}
+
+// Accumulate lowering depth, learn from raises and step calibration
+static void track_travel(uint8_t newstate, uint16_t elapsed)
+{
+	uint16_t lowered;
+	switch (feed->state) {
+	case state_move_h_p1:
+	case state_move_p1_p2:
+		lowered = (uint16_t) (travel->lowered + travel_norm(elapsed));
+		if (lowered < travel->lowered) {
+			travel->known = 0;
+		}
+		travel->lowered = lowered;
+		break;
+	case state_move_h:
+		if (newstate == state_at_h) {
+			wear_home(travel_norm(elapsed), travel->from_p1);
+			if (travel->learn) {
+				finish_raise(elapsed);
+			}
+		}
+		travel->learn = 0;
+		break;
+	case state_move_man:
+		travel->known = 0;
+		break;
+	default:
+		break;
+	}
+	if (travel->run == travel_lower && newstate == state_at_p1) {
+		travel->run = travel_raise;
+	} else if ((travel->run == travel_lower
+		    && newstate != state_move_h_p1)
+		   || (travel->run == travel_raise
+		       && newstate != state_move_h)) {
+		travel->run = travel_idle;
+		console_write(PSTR("Calibrate: Aborted\r\n"));
+	}
 }
 
 static void set_state(uint8_t newstate)
 {
-	feed.state = newstate;
-	feed.count = 0;
-	feed.mincount = 0;
-	feed.minutes = 0;
-	console_showstate(feed.state, feed.error, ADCH);
+	// accumulate travel time for resumed moves
+	uint16_t elapsed = (uint16_t) (feed->clock - feed->since);
+	track_travel(newstate, elapsed);
+	if (feed->state == state_move_h_p1) {
+		feed->p1 = (uint16_t) (feed->p1 + elapsed);
+	} else if (feed->state == state_move_p1_p2) {
+		feed->p2 = (uint16_t) (feed->p2 + elapsed);
+	}
+	feed->state = newstate;
+	feed->since = feed->clock;
+	arm_timers();
+	console_showstate(feed->state, feed->error, ADCH);
 }
 
-static void stop_at(uint8_t newstate)
+// Enter newstate and stop, timed is set for arrival at P1 and P2
+static void stop_at(uint8_t newstate, uint8_t timed)
 {
 	set_state(newstate);
-	motor_stop();
+	motor_stop(timed);
 }
 
 static void set_randfeed(void)
 {
-	if (feed.nf) {
-		uint16_t period = ONEWEEK / feed.nf;
+	if (feed->nf) {
+		uint16_t period = ONEWEEK / feed->nf;
 		if (period) {
 			uint16_t oft = period >> 1;
 			// randval has range 0 to 0x7fffffff inclusive
@@ -100,420 +323,795 @@ static void set_randfeed(void)
 			uint32_t tmp =
 			    ((uint32_t) (period) * (randval >> 13) +
 			     (1UL << 17)) >> 18;
-			feed.nf_timeout = oft + (uint16_t) (tmp);
+			feed->nf_timeout = oft + (uint16_t) (tmp);
 		} else {
-			feed.nf_timeout = 0;
+			feed->nf_timeout = 0;
 		}
 	} else {
-		feed.nf_timeout = 0;
+		feed->nf_timeout = 0;
 	}
-	if (feed.nf_timeout) {
-		console_showval("Feed in (min): ", feed.nf_timeout);
+	if (feed->nf_timeout) {
+		console_showval(PSTR("Feed in (min): "), feed->nf_timeout);
 	}
+	arm_timers();
 }
 
 static void stop_at_home(void)
 {
-	stop_at(state_at_h);
+	stop_at(state_at_h, 0);
+	battery_feed_end();
 	clear_error();
-	// Signal AT H state to Remootio
-	PORTD &= (uint8_t) ~ _BV(ATP1);
+	signal_home();
 	set_randfeed();
 }
 
-static void move_up(uint8_t newstate)
+// Ticks into a raise to slow for home, 0 if start position is unknown
+static uint32_t approach_time(void)
 {
-	if ((feed.bstate & TRIGGER_HOME) == 0) {
-		set_state(newstate);
-		motor_reverse();
-		motor_start();
-	} else {
-		console_write("Sensor error\r\n");
-		flag_error();
-		stop_at(state_stop);
+	uint16_t ticks = travel_home();
+	if (!ticks) {
+		// uncalibrated, assume raise takes as long as lowering
+		switch (feed->state) {
+		case state_at_p1:
+		case state_stop_h_p1:
+			ticks = feed->p1;
+			break;
+		case state_at_p2:
+		case state_stop_p1_p2:
+			ticks = (uint16_t) (feed->p1 + feed->p2);
+			break;
+		default:
+			break;
+		}
 	}
-}
-
-static void move_down(uint8_t newstate)
-{
-	set_state(newstate);
-	motor_forward();
-	motor_start();
-}
-
-static void trigger_p1(void)
-{
-	if (feed.state == state_move_h_p1) {
-		console_write("Trigger: p1\r\n");
-		stop_at(state_at_p1);
-		// Signal AT P1 state to Remootio
-		PORTD |= _BV(ATP1);
-	} else {
-		console_write("Spurious P1 trigger\r\n");
+	if (!ticks || !feed->approach || !feed->slow) {
+		return 0;
 	}
-}
-
-static void trigger_reset(void)
-{
-	console_write("Trigger: reset\r\n");
-	stop_at(state_stop);
-}
-
-static void trigger_p2(void)
-{
-	if (feed.state == state_move_p1_p2) {
-		console_write("Trigger: p2\r\n");
-		stop_at(state_at_p2);
-	} else {
-		console_write("Spurious P2 trigger\r\n");
+	if (ticks <= feed->approach) {
+		return 1U;
 	}
+	return (uint32_t) (ticks - feed->approach);
 }
 
-static void trigger_man(void)
+static void move_up(uint8_t newstate)
 {
-	if (feed.state == state_move_man) {
-		console_write("Trigger: man\r\n");
-		stop_at(state_stop);
+	if ((bstate & pins->home) == 0) {
+		travel->volts = ADCH;
+		travel->learn = travel->known && (feed->state == state_at_p1
+						|| feed->state == state_at_p2);
+		travel->from_p1 = feed->state == state_at_p1;
+		feed->approach_at = approach_time();
+		travel->known = 0;
+		set_state(newstate);
+		motor_start(pins->rev);
 	} else {
-		console_write("Spurious Man trigger\r\n");
+		console_write(PSTR("Sensor error\r\n"));
+		flag_error(wear_sensor);
+		stop_at(state_stop, 0);
 	}
 }
 
-static void trigger_max(void)
+static void move_down(uint8_t newstate)
 {
-	if (feed.state == state_move_h) {
-		console_write("Trigger: max\r\n");
-		flag_error();	// failed to reach home
-		stop_at(state_stop);
-	} else {
-		console_write("Spurious Max trigger\r\n");
-	}
+	travel->volts = ADCH;
+	set_state(newstate);
+	motor_start(pins->fwd);
 }
 
-static void trigger_up(void)
+// Look up and perform the transition for event in the current state
+static void trigger(uint8_t event, uint8_t override)
 {
-	console_write("Trigger: up\r\n");
-	switch (feed.state) {
-	case state_stop:
-	case state_stop_h_p1:
-	case state_stop_p1_p2:
-	case state_at_p1:
-	case state_at_p2:
-		move_up(state_move_h);
+	uint8_t entry = pgm_read_byte(&state_table[feed->state][event]);
+	uint8_t next = STATE_NEXT(entry);
+	console_write(PSTR("Trigger: "));
+	console_write(pgm_read_ptr(&event_name[event]));
+	console_write(PSTR("\r\n"));
+	switch (STATE_ACTION(entry)) {
+	case act_ignore:
+		console_write(PSTR("Ignore "));
+		console_write(pgm_read_ptr(&event_name[event]));
+		console_write(PSTR(" trigger\r\n"));
 		break;
-	case state_move_h_p1:
-		stop_at(state_stop_h_p1);
+	case act_retry:
+		arm_retry();
 		break;
-	case state_move_p1_p2:
-		stop_at(state_stop_p1_p2);
+	case act_move_up:
+		move_up(next);
 		break;
-	case state_move_h:
-	case state_move_man:
-		stop_at(state_stop);
+	case act_move_down:
+		move_down(next);
 		break;
-	case state_at_h:
-	default:
-		console_write("Spurious UP trigger\r\n");
+	case act_start_p1:
+		if (check_voltage(override)) {
+			battery_feed_start();
+			feed->p1 = 0;
+			travel->lowered = 0;
+			travel->known = 1U;
+			move_down(next);
+		} else {
+			console_write(PSTR("Trigger low voltage\r\n"));
+			stop_at_home();
+		}
 		break;
-	}
-}
-
-static void trigger_down(uint8_t override)
-{
-	console_write("Trigger: down\r\n");
-	switch (feed.state) {
-	case state_stop:
-		move_down(state_move_man);
+	case act_start_p2:
+		feed->p2 = 0;
+		move_down(next);
 		break;
-	case state_stop_h_p1:
-		move_down(state_move_h_p1);
+	case act_stop:
+		stop_at(next, event == trig_p2);
 		break;
-	case state_stop_p1_p2:
-		move_down(state_move_p1_p2);
+	case act_arrive_p1:
+		stop_at(next, 1U);
+		signal_p1();
 		break;
-	case state_at_h:
-		if (check_voltage(override)) {
-			move_down(state_move_h_p1);
-			feed.p1 = 0;
+	case act_home:
+		stop_at_home();
+		break;
+	case act_error:
+		if (event == trig_stall) {
+			flag_error(wear_stall);
+		} else if (event == trig_sag) {
+			flag_error(wear_sag);
 		} else {
-			console_write("Trigger low voltage\r\n");
-			stop_at_home();
+			flag_error(wear_timeout);
 		}
+		stop_at(next, 0);
 		break;
-	case state_at_p1:
-		move_down(state_move_p1_p2);
-		feed.p2 = 0;
+	case act_fault:
+		console_write(PSTR("Spurious "));
+		console_write(pgm_read_ptr(&event_label[event]));
+		console_write(PSTR(" trigger\r\n"));
+		flag_error(wear_fault);
+		stop_at(next, 0);
 		break;
-	case state_at_p2:
-		move_down(state_move_man);
+	case act_tangle:
+		// after 0.5s, might be tangled cord - flag error and stop
+		if (feed->clock - feed->since > 50U) {
+			console_write(PSTR("Home trigger/tangle\r\n"));
+			flag_error(wear_tangle);
+			stop_at(next, 0);
+		}
 		break;
+	case act_spurious:
+	default:
+		console_write(PSTR("Spurious "));
+		console_write(pgm_read_ptr(&event_label[event]));
+		console_write(PSTR(" trigger\r\n"));
+		break;
+	}
+}
+
+static void trigger_reset(void)
+{
+	trigger(trig_reset, OVRNONE);
+}
+
+static void show_reset(void)
+{
+	if (reset_cause & _BV(WDRF)) {
+		console_write(PSTR("Reset: Watchdog\r\n"));
+	} else if (reset_cause & _BV(BORF)) {
+		console_write(PSTR("Reset: Brown-out\r\n"));
+	} else if (reset_cause & _BV(EXTRF)) {
+		console_write(PSTR("Reset: External\r\n"));
+	} else if (reset_cause & _BV(PORF)) {
+		console_write(PSTR("Reset: Power on\r\n"));
+	} else {
+		console_write(PSTR("Reset: Unknown\r\n"));
+	}
+}
+
+// Continue from a restored snapshot, a move in progress is stopped
+static void resume(void)
+{
+	uint8_t next;
+	console_write(PSTR("Resume: "));
+	console_write(pgm_read_ptr(&state_label[feed->state]));
+	console_write(PSTR("\r\n"));
+	switch (feed->state) {
 	case state_move_h_p1:
-		stop_at(state_stop_h_p1);
+		next = state_stop_h_p1;
 		break;
 	case state_move_p1_p2:
-		stop_at(state_stop_p1_p2);
+		next = state_stop_p1_p2;
 		break;
 	case state_move_h:
 	case state_move_man:
-		stop_at(state_stop);
+		next = state_stop;
 		break;
 	default:
-		console_write("Spurious DOWN trigger\r\n");
+		next = feed->state;
 		break;
 	}
+	if (next != feed->state) {
+		set_state(next);
+	} else {
+		// keep state age so dwell deadlines run on
+		arm_timers();
+		console_showstate(feed->state, feed->error, ADCH);
+	}
+	if (feed->state == state_at_p1) {
+		signal_p1();
+	}
 }
 
-static void trigger_home(void)
+// Report reset cause, then resume a warm snapshot or stop each hoist
+static void restart(void)
 {
-	console_write("Trigger: home\r\n");
-	switch (feed.state) {
-	case state_stop:
-	case state_move_h:
-		stop_at_home();
-		break;
-	case state_at_h:
-		// reset state counter for home-retry timeout
-		feed.count = 0;
-		break;
-	case state_at_p1:
-		// do nothing
-		console_write("Ignore home trigger\r\n");
-		break;
-	case state_move_h_p1:
-		// after 0.5s, might be tangled cord - flag error and stop
-		if (feed.count > 50) {
-			console_write("Home trigger/tangle\r\n");
-			flag_error();
-			stop_at(state_stop);
+	uint8_t n;
+	show_reset();
+	for (n = 0; n < HOIST_COUNT; n++) {
+		hoist_select(n);
+		if (warm_restore() && feed->state != state_error) {
+			resume();
+		} else {
+			if (reset_cause & WARM_CAUSES) {
+				console_write(PSTR("Resume: No snapshot\r\n"));
+			}
+			trigger_reset();
 		}
-		break;
-	default:
-		// spurious home sense - flag error and stop
-		console_write("Spurious Home trigger\r\n");
-		flag_error();
-		stop_at(state_stop);
-		break;
 	}
 }
 
-static void read_triggers(void)
+static void read_triggers(uint8_t triggers)
 {
-	uint8_t triggers = read_inputs();
-	if (triggers & TRIGMASK) {
-		if (triggers & TRIGGER_HOME) {
+	if (triggers & (pins->home | pins->up | pins->down)) {
+		if (triggers & pins->home) {
 			// Transition to home will mask concurrent trigs
-			trigger_home();
+			trigger(trig_home, OVRNONE);
 		} else {
-			if (triggers & TRIGGER_DOWN) {
+			if (triggers & pins->down) {
 				// remootio may override night voltage
-				trigger_down(OVRNIGHT);
+				trigger(trig_down, OVRNIGHT);
 			}
-			if (triggers & TRIGGER_UP) {
+			if (triggers & pins->up) {
 				// up cancels a concurrent down
-				trigger_up();
+				trigger(trig_up, OVRNONE);
 			}
 		}
 	}
 }
 
-static void read_timers(void)
+static void trigger_p1(void)
+{
+	trigger(trig_p1, OVRNONE);
+}
+
+static void trigger_p2(void)
+{
+	trigger(trig_p2, OVRNONE);
+}
+
+static void trigger_man(void)
+{
+	trigger(trig_man, OVRNONE);
+}
+
+static void trigger_max(void)
+{
+	trigger(trig_max, OVRNONE);
+}
+
+static void trigger_feedtime(void)
+{
+	trigger(trig_feedtime, OVRNONE);
+}
+
+static void trigger_randfeed(void)
+{
+	trigger(trig_randfeed, OVRNONE);
+}
+
+static void trigger_safetime(void)
+{
+	trigger(trig_safetime, OVRNONE);
+}
+
+static void trigger_retry(void)
+{
+	if ((bstate & pins->home) == 0) {
+		trigger(trig_notathome, OVRNONE);
+	} else {
+		arm_retry();
+	}
+}
+
+static void arm_retry(void)
+{
+	if (feed->hr_timeout) {
+		timer_arm(timer_retry, feed->hr_timeout + 1UL, trigger_retry);
+	}
+}
+
+// Arm deadline ticks after entry to the current state
+static void arm_state(uint8_t id, uint32_t ticks, timer_callback fn)
+{
+	uint32_t elapsed = feed->clock - feed->since;
+	timer_arm(id, ticks > elapsed ? ticks - elapsed : 0, fn);
+}
+
+// Ticks remaining on a resumable move, plus one to exceed target
+static uint32_t remaining(uint16_t elapsed, uint16_t target)
+{
+	uint32_t ticks = 1U;
+	if (elapsed < target) {
+		ticks += target - elapsed;
+	}
+	return ticks;
+}
+
+// Arm all deadlines for the current state and settings
+static void arm_timers(void)
 {
 	uint16_t thresh;
-	feed.count++;
-	feed.mincount++;
-	switch (feed.state) {
+	timer_cancel_all();
+	switch (feed->state) {
 	case state_move_h_p1:
-		feed.p1++;
-		if (feed.p1 > feed.p1_timeout) {
-			trigger_p1();
+		if (travel->run == travel_idle) {
+			thresh = travel_p1(feed->p1_timeout);
+		} else {
+			// calibration lowers for the set time
+			thresh = feed->p1_timeout;
 		}
+		arm_state(timer_move, remaining(feed->p1, thresh), trigger_p1);
 		break;
 	case state_move_p1_p2:
-		feed.p2++;
-		if (feed.p2 > feed.p2_timeout) {
-			trigger_p2();
-		}
+		arm_state(timer_move, remaining(feed->p2, feed->p2_timeout),
+			  trigger_p2);
 		break;
 	case state_move_man:
-		if (feed.count > feed.man_timeout) {
-			trigger_man();
-		}
+		arm_state(timer_move, feed->man_timeout + 1UL, trigger_man);
 		break;
 	case state_move_h:
-		if (feed.error) {
-			thresh = feed.man_timeout;
+		if (feed->error) {
+			thresh = feed->man_timeout;
 		} else {
-			thresh = feed.h_timeout;
-		}
-		if (feed.count > thresh) {
-			trigger_max();
+			thresh = feed->h_timeout;
 		}
+		arm_state(timer_move, thresh + 1UL, trigger_max);
 		break;
 	case state_at_p1:
-		if (feed.f_timeout) {
-			if (feed.minutes >= feed.f_timeout) {
-				trigger_up();
-			}
+		if (feed->f_timeout) {
+			arm_state(timer_dwell, feed->f_timeout * (uint32_t) ONEMINUTE,
+				  trigger_feedtime);
 		}
 		break;
 	case state_at_h:
-		if (feed.nf_timeout > 0 && feed.minutes >= feed.nf_timeout) {
-			trigger_down(OVRNONE);
-		} else if (feed.hr_timeout > 0 && feed.count > feed.hr_timeout) {
-			if ((feed.bstate & TRIGGER_HOME) == 0) {
-				console_write("Trigger: notathome\r\n");
-				move_up(state_move_h);
-			} else {
-				feed.count = 0;
-			}
+		if (feed->nf_timeout) {
+			arm_state(timer_dwell,
+				  feed->nf_timeout * (uint32_t) ONEMINUTE,
+				  trigger_randfeed);
 		}
+		arm_retry();
 		break;
 	case state_stop:
 	case state_stop_p1_p2:
 	case state_at_p2:
-		if (feed.minutes >= DEFAULT_S) {
-			console_write("Safe time reached\r\n");
-			trigger_up();
-		}
+		arm_state(timer_dwell, DEFAULT_S * (uint32_t) ONEMINUTE,
+			  trigger_safetime);
 		break;
 	default:
 		break;
 	}
-	if (feed.mincount >= ONEMINUTE) {
-		feed.minutes++;
-		feed.mincount = 0;
+}
+
+// Stop on controller fault, overcurrent or no rotation while driven,
+// or report it once per move if built without STALL_STOP
+static void check_stall(void)
+{
+	const char *reason = NULL;
+	if (spm_telemetry.current >= STALL_CURRENT) {
+		++stall_over;
+	} else {
+		stall_over = 0;
+	}
+	// no rotation is only a stall once the throttle has ramped up
+	if (spm_telemetry.speed == 0
+	    && feed->clock - feed->since > STALL_GRACE + (uint32_t) feed->accel) {
+		++stall_still;
+	} else {
+		stall_still = 0;
+	}
+	if (spm_telemetry.fault) {
+		reason = PSTR("Stall: Controller fault\r\n");
+	} else if (stall_over >= STALL_COUNT) {
+		reason = PSTR("Stall: Overcurrent\r\n");
+	} else if (stall_still >= STALL_COUNT) {
+		reason = PSTR("Stall: No rotation\r\n");
+	}
+	if (reason != NULL && !stall_seen) {
+		console_write(reason);
+#if STALL_STOP
+		trigger(trig_stall, OVRNONE);
+#else
+		stall_seen = 1U;
+		show_telemetry();
+#endif // STALL_STOP
+	}
+}
+
+// Advance the selected hoist by one tick
+static void update_hoist(uint8_t triggers)
+{
+	feed->clock++;
+	read_triggers(triggers);
+	timer_poll();
+	if (pins->spm && spm_poll()) {
+		check_stall();
+	}
+	if (sag_check()) {
+		console_write(PSTR("Stall: Voltage sag\r\n"));
+		trigger(trig_sag, OVRNONE);
+	}
+	if (feed->approach_at && feed->state == state_move_h
+	    && drives[unit].phase == drive_run
+	    && feed->clock - feed->since >= feed->approach_at) {
+		feed->approach_at = 0;
+		console_write(PSTR("Slow approach\r\n"));
+		throttle_ramp(THROTTLE_DUTY(feed->slow), feed->decel);
+	}
+	throttle_update();
+	motor_update();
+	if (travel->run == travel_raise && feed->state == state_at_p1) {
+		trigger(trig_up, OVRNONE);
 	}
 }
 
 static void update_state(uint8_t clock)
 {
-	feed.clock++;
-	read_triggers();
-	read_timers();
+	uint8_t triggers = 0;
+	uint8_t n;
+	uptime++;
+	if (clock == SYSTICK) {
+		// only sample inputs once caught up with the current tick
+		triggers = read_inputs();
+	}
+	sag_update();
+	for (n = 0; n < HOIST_COUNT; n++) {
+		hoist_select(n);
+		update_hoist(triggers);
+	}
+	battery_update();
+	wear_update();
 	if (clock == 0) {
 		read_voltage();
 	}
 }
 
+// Input filter lengths, S1 to S6
+static void show_debounce(const char *message)
+{
+	uint16_t ticks[INPUT_COUNT];
+	uint8_t n;
+	for (n = 0; n < INPUT_COUNT; n++) {
+		ticks[n] = debounce_get(n);
+	}
+	console_showvals(message, ticks, INPUT_COUNT);
+}
+
 static void show_value(struct console_event *event)
 {
 	switch (event->key) {
 	case 0x10:
 		// double auth
-		console_write("OK\r\n");
+		console_write(PSTR("OK\r\n"));
 		break;
 	case 0x31:
-		console_showval("H-P1 = ", feed.p1_timeout);
+		console_showval(PSTR("H-P1 = "), feed->p1_timeout);
 		break;
 	case 0x32:
-		console_showval("P1-P2 = ", feed.p2_timeout);
+		console_showval(PSTR("P1-P2 = "), feed->p2_timeout);
 		break;
 	case 0x66:
-		console_showval("Feed = ", feed.f_timeout);
+		console_showval(PSTR("Feed = "), feed->f_timeout);
 		break;
 	case 0x68:
-		console_showval("H = ", feed.h_timeout);
+		console_showval(PSTR("H = "), feed->h_timeout);
 		break;
 	case 0x6e:
-		console_showval("Feeds/week = ", feed.nf);
+		console_showval(PSTR("Feeds/week = "), feed->nf);
 		break;
 	case 0x6d:
-		console_showval("Man = ", feed.man_timeout);
+		console_showval(PSTR("Man = "), feed->man_timeout);
 		break;
 	case 0x70:
-		console_showval("PIN = ", feed.pk);
+		console_showval(PSTR("PIN = "), passkey);
+		break;
+	case 0x69:
+		console_showval(PSTR("Hoist = "), (uint16_t) (addressed + 1U));
+		break;
+	case 0x78:
+		console_showval(PSTR("Modbus = "), modbus_addr);
+		break;
+	case 0x67:
+		show_debounce(PSTR("Debounce = "));
 		break;
 	case 0x72:
-		console_showval("H-Retry = ", feed.hr_timeout);
+		console_showval(PSTR("H-Retry = "), feed->hr_timeout);
+		break;
+	case 0x61:
+		console_showval(PSTR("Accel = "), feed->accel);
+		break;
+	case 0x62:
+		console_showval(PSTR("Decel = "), feed->decel);
+		break;
+	case 0x7a:
+		console_showval(PSTR("Approach = "), feed->approach);
+		break;
+	case 0x6c:
+		console_showval(PSTR("Slow = "), feed->slow);
 		break;
 	default:
-		console_write("Unknown value\r\n");
+		console_write(PSTR("Unknown value\r\n"));
 		break;
 	}
 }
 
 static void update_value(struct console_event *event)
 {
+	uint8_t input;
+	uint8_t ticks;
 	switch (event->key) {
 	case 0x10:
 		// double auth
-		console_write("OK\r\n");
+		console_write(PSTR("OK\r\n"));
 		break;
 	case 0x31:
-		if (event->value) {
-			feed.p1_timeout = event->value;
+		if (event->value && event->value != feed->p1_timeout) {
+			feed->p1_timeout = event->value;
+			if (travel->up) {
+				// calibration depth is set by H-P1
+				travel_clear();
+				console_write(PSTR("Travel: Cleared\r\n"));
+			}
 		}
-		console_showval("H-P1 = ", feed.p1_timeout);
-		save_config(NVM_P1, feed.p1_timeout);
+		console_showval(PSTR("H-P1 = "), feed->p1_timeout);
+		save_hoist(NVM_P1, feed->p1_timeout);
 		break;
 	case 0x32:
 		if (event->value) {
-			feed.p2_timeout = event->value;
+			feed->p2_timeout = event->value;
 		}
-		console_showval("P1-P2 = ", feed.p2_timeout);
-		save_config(NVM_P2, feed.p2_timeout);
+		console_showval(PSTR("P1-P2 = "), feed->p2_timeout);
+		save_hoist(NVM_P2, feed->p2_timeout);
 		break;
 	case 0x66:
-		feed.f_timeout = event->value;
-		console_showval("Feed = ", feed.f_timeout);
-		save_config(NVM_F, feed.f_timeout);
+		feed->f_timeout = event->value;
+		console_showval(PSTR("Feed = "), feed->f_timeout);
+		save_hoist(NVM_F, feed->f_timeout);
 		break;
 	case 0x6e:
-		feed.nf = event->value;
-		console_showval("Feeds/week = ", feed.nf);
-		save_config(NVM_NF, feed.nf);
-		if (feed.state == state_at_h) {
+		feed->nf = event->value;
+		console_showval(PSTR("Feeds/week = "), feed->nf);
+		save_hoist(NVM_NF, feed->nf);
+		if (feed->state == state_at_h) {
 			set_randfeed();
 		}
 		break;
 	case 0x6d:
 		if (event->value) {
-			feed.man_timeout = event->value;
+			feed->man_timeout = event->value;
 		}
-		console_showval("Man = ", feed.man_timeout);
-		save_config(NVM_MAN, feed.man_timeout);
+		console_showval(PSTR("Man = "), feed->man_timeout);
+		save_hoist(NVM_MAN, feed->man_timeout);
 		break;
 	case 0x68:
 		if (event->value) {
-			feed.h_timeout = event->value;
+			feed->h_timeout = event->value;
 		}
-		console_showval("H = ", feed.h_timeout);
-		save_config(NVM_H, feed.h_timeout);
+		console_showval(PSTR("H = "), feed->h_timeout);
+		save_hoist(NVM_H, feed->h_timeout);
 		break;
 	case 0x70:
-		feed.pk = event->value;
-		console_showval("PIN = ", feed.pk);
-		save_config(NVM_PK, feed.pk);
+		passkey = event->value;
+		console_showval(PSTR("PIN = "), passkey);
+		save_config(NVM_PK, passkey);
+		break;
+	case 0x69:
+		if (event->value && event->value <= HOIST_COUNT) {
+			addressed = (uint8_t) (event->value - 1U);
+			hoist_select(addressed);
+		}
+		console_showval(PSTR("Hoist = "), (uint16_t) (addressed + 1U));
+		break;
+	case 0x78:
+		if (event->value <= MODBUS_LASTADDR) {
+			console_showval(PSTR("Modbus = "), event->value);
+			save_config(NVM_MBADDR, event->value);
+			// console is lost until the address is cleared
+			modbus_select((uint8_t) event->value);
+		} else {
+			console_showval(PSTR("Modbus = "), modbus_addr);
+		}
+		break;
+	case 0x67:
+		// input number then filter length, 13 sets S1 to 0.03s
+		input = (uint8_t) (event->value / 10U);
+		ticks = (uint8_t) (event->value % 10U);
+		if (event->value < 100U && input && input <= INPUT_COUNT
+		    && ticks && ticks <= DEBOUNCE_MAX) {
+			--input;
+			debounce_set(input, ticks);
+			save_config((uint16_t) (NVM_DEBOUNCE + 2U * input), ticks);
+		}
+		show_debounce(PSTR("Debounce = "));
 		break;
 	case 0x72:
-		feed.hr_timeout = event->value;
-		console_showval("H-Retry = ", feed.hr_timeout);
-		save_config(NVM_HR, feed.hr_timeout);
+		feed->hr_timeout = event->value;
+		console_showval(PSTR("H-Retry = "), feed->hr_timeout);
+		save_hoist(NVM_HR, feed->hr_timeout);
+		break;
+	case 0x61:
+		if (event->value <= MAX_RAMP) {
+			feed->accel = event->value;
+		}
+		console_showval(PSTR("Accel = "), feed->accel);
+		save_hoist(NVM_ACCEL, feed->accel);
+		break;
+	case 0x62:
+		if (event->value <= MAX_RAMP) {
+			feed->decel = event->value;
+		}
+		console_showval(PSTR("Decel = "), feed->decel);
+		save_hoist(NVM_DECEL, feed->decel);
+		break;
+	case 0x7a:
+		if (event->value <= MAX_APPROACH) {
+			feed->approach = event->value;
+		}
+		console_showval(PSTR("Approach = "), feed->approach);
+		save_hoist(NVM_APPROACH, feed->approach);
+		break;
+	case 0x6c:
+		if (event->value <= MAX_SLOW) {
+			feed->slow = event->value;
+		}
+		console_showval(PSTR("Slow = "), feed->slow);
+		save_hoist(NVM_SLOW, feed->slow);
 		break;
 	default:
-		console_write("Unknown value\r\n");
+		console_write(PSTR("Unknown value\r\n"));
 		break;
 	}
+	// apply updated settings to pending deadlines
+	arm_timers();
 }
 
 static void show_values(void)
 {
-	console_write("Values:\r\n");
-	console_showval("\tFirmware = v", sw_version);
-	console_showval("\tH-P1 = ", feed.p1_timeout);
-	console_showval("\tP1-P2 = ", feed.p2_timeout);
-	console_showval("\tMan = ", feed.man_timeout);
-	console_showval("\tH = ", feed.h_timeout);
-	console_showval("\tH-Retry = ", feed.hr_timeout);
-	console_showval("\tFeed = ", feed.f_timeout);
-	console_showval("\tFeeds/week = ", feed.nf);
-	console_showval("\tMin = ", feed.minutes);
-	console_write("\r\n");
+	console_write(PSTR("Values:\r\n"));
+	console_showval(PSTR("\tFirmware = v"), sw_version);
+	console_showval(PSTR("\tH-P1 = "), feed->p1_timeout);
+	console_showval(PSTR("\tP1-P2 = "), feed->p2_timeout);
+	console_showval(PSTR("\tMan = "), feed->man_timeout);
+	console_showval(PSTR("\tH = "), feed->h_timeout);
+	console_showval(PSTR("\tH-Retry = "), feed->hr_timeout);
+	console_showval(PSTR("\tFeed = "), feed->f_timeout);
+	console_showval(PSTR("\tFeeds/week = "), feed->nf);
+	console_showval(PSTR("\tAccel = "), feed->accel);
+	console_showval(PSTR("\tDecel = "), feed->decel);
+	console_showval(PSTR("\tApproach = "), feed->approach);
+	console_showval(PSTR("\tSlow = "), feed->slow);
+	console_showval(PSTR("\tModbus = "), modbus_addr);
+	console_showval(PSTR("\tUp = "), travel->up);
+	console_showval(PSTR("\tDown = "), travel->down);
+	console_showval(PSTR("\tMin = "),
+			(uint16_t) ((feed->clock - feed->since) / ONEMINUTE));
+	console_write(PSTR("\r\n"));
 }
 
 static void show_status(void)
 {
-	console_showstate(feed.state, feed.error, ADCH);
+	console_showstate(feed->state, feed->error, ADCH);
+}
+
+static void show_telemetry(void)
+{
+	uint8_t fault[2];
+	fault[0] = (uint8_t) (spm_telemetry.fault >> 8);
+	fault[1] = (uint8_t) (spm_telemetry.fault & 0xff);
+	console_write(PSTR("Telemetry:\r\n"));
+	console_showval(PSTR("\tSpeed = "), spm_telemetry.speed);
+	console_showval(PSTR("\tCurrent = "), spm_telemetry.current);
+	console_showval(PSTR("\tVolts = "), spm_telemetry.volts);
+	console_showhex(PSTR("\tFault = "), &fault[0], 2U);
+	console_showval(PSTR("\tSamples = "), spm_telemetry.samples);
+	console_write(PSTR("\r\n"));
+}
+
+static void show_battery(void)
+{
+	console_write(PSTR("Battery:\r\n"));
+	console_showval(PSTR("\tRest = "), battery.rest);
+	console_showval(PSTR("\tLoad = "), battery.load);
+	console_showval(PSTR("\tSag = "), battery.sag);
+	console_showval(PSTR("\tLower = "), sag_normal(sag_down));
+	console_showval(PSTR("\tRaise = "), sag_normal(sag_up));
+	console_showval(PSTR("\tResist = "), battery_resist());
+	console_showval(PSTR("\tCharge = "), battery_charge());
+	console_showval(PSTR("\tFeed = "), battery_feed());
+	console_showval(PSTR("\tAfter = "), battery_after());
+	console_write(PSTR("\r\n"));
+}
+
+// Wear counters, motor time in seconds and returns oldest first
+static void show_wear(void)
+{
+	struct wear *w = &wears[unit];
+	uint16_t returns[WEAR_WINDOW];
+	uint8_t i;
+	for (i = 0; i < WEAR_WINDOW; i++) {
+		returns[i] = w->returns[(w->next + i) % WEAR_WINDOW];
+	}
+	console_write(PSTR("Wear:\r\n"));
+	console_showlong(PSTR("\tDown = "), w->down / 100U);
+	console_showlong(PSTR("\tUp = "), w->up / 100U);
+	console_showval(PSTR("\tLifts = "), w->lifts);
+	console_showvals(PSTR("\tReturns = "), returns, WEAR_WINDOW);
+	console_showval(PSTR("\tMin = "), wear_min());
+	console_showval(PSTR("\tMean = "), wear_mean());
+	console_showval(PSTR("\tMax = "), wear_max());
+	console_showval(PSTR("\tSensor = "), w->errors[wear_sensor]);
+	console_showval(PSTR("\tFault = "), w->errors[wear_fault]);
+	console_showval(PSTR("\tTangle = "), w->errors[wear_tangle]);
+	console_showval(PSTR("\tTimeout = "), w->errors[wear_timeout]);
+	console_showval(PSTR("\tStall = "), w->errors[wear_stall]);
+	console_showval(PSTR("\tSag = "), w->errors[wear_sag]);
+	console_showval(PSTR("\tWatchdog = "),
+			wear_boot.resets[wear_watchdog]);
+	console_showval(PSTR("\tBrown-out = "),
+			wear_boot.resets[wear_brownout]);
+	console_showval(PSTR("\tExternal = "),
+			wear_boot.resets[wear_external]);
+	console_showval(PSTR("\tPower on = "), wear_boot.resets[wear_poweron]);
+	console_write(PSTR("\r\n"));
+}
+
+// Input filters and bounces since reset, S1 to S6
+static void show_inputs(void)
+{
+	console_write(PSTR("Inputs:\r\n"));
+	show_debounce(PSTR("\tDebounce = "));
+	console_showvals(PSTR("\tBounces = "), bounces, INPUT_COUNT);
+	console_write(PSTR("\r\n"));
+}
+
+// Restart into the serial bootloader while the motor is off
+static void bootload(void)
+{
+	if (pgm_read_word(BOOT_START) == 0xffffU) {
+		console_write(PSTR("Bootloader: Not installed\r\n"));
+		return;
+	}
+	if (motor_running()) {
+		console_write(PSTR("Bootloader: Motor running\r\n"));
+		return;
+	}
+	console_write(PSTR("Bootloader: Start\r\n"));
+	console_drain();
+	save_config(NVM_BOOT, BOOT_REQUEST);
+	// new firmware must not resume the old snapshot
+	warm_clear();
+	cli();
+	do {
+		// wait for watchdog reset into the boot section
+	} while (1);
+}
+
+// Lower to P1 for the set time then raise home, timing the raise
+static void calibrate(void)
+{
+	if (feed->state != state_at_h) {
+		console_write(PSTR("Calibrate: Not at home\r\n"));
+		return;
+	}
+	console_write(PSTR("Calibrate: Start\r\n"));
+	travel->run = travel_lower;
+	// console trigger may override low voltage
+	trigger(trig_down, OVRLOW);
+	if (feed->state != state_move_h_p1) {
+		travel->run = travel_idle;
+	}
 }
 
 static void handle_event(struct console_event *event)
@@ -531,12 +1129,31 @@ static void handle_event(struct console_event *event)
 	case event_values:
 		show_values();
 		break;
+	case event_telemetry:
+		show_telemetry();
+		break;
+	case event_battery:
+		show_battery();
+		break;
+	case event_wear:
+		show_wear();
+		break;
+	case event_inputs:
+		show_inputs();
+		break;
+	case event_calibrate:
+		calibrate();
+		break;
+	case event_bootload:
+		bootload();
+		break;
+
 	case event_down:
                 // console trigger may override low voltage
-		trigger_down(OVRLOW);
+		trigger(trig_down, OVRLOW);
 		break;
 	case event_up:
-		trigger_up();
+		trigger(trig_up, OVRNONE);
 		break;
 	default:
 		break;
@@ -545,23 +1162,34 @@ static void handle_event(struct console_event *event)
 
 void main(void)
 {
-	uint8_t lt = 0;
-	uint8_t nt;
+	uint8_t lt;
 	struct console_event event;
 	system_init();
-	trigger_reset();
+	restart();
+	hoist_select(addressed);
 	console_flush();
+	lt = SYSTICK;
 	do {
 		sleep_mode();
-		nt = SYSTICK;
-		if (nt != lt) {
-			update_state(nt);
-			lt = nt;
+		// replay every tick elapsed since the last wake
+		while (lt != SYSTICK) {
+			++lt;
+			update_state(lt);
 		}
-		console_read(&event);
-		if (event.type != event_none) {
+		hoist_select(addressed);
+		console_read();
+		modbus_poll();
+		// parse each line once the reply before it is queued
+		while (console_next(&event)) {
 			handle_event(&event);
+			console_read();
+		}
+		entropy_poll();
+		if (!motor_running() && !console_busy()) {
+			// counter batches wait for idle motors and bus
+			wear_poll();
 		}
+		warm_save();
 		wdt_reset();
 	} while (1);
 }
@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Modbus RTU slave
+ *
+ * Requests are delimited by the console UART on 3.5 character
+ * silences. Reads are answered directly from hoist state, while
+ * register and coil writes are queued as console events so settings
+ * are checked and saved exactly as if entered on the console.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/crc16.h>
+#include "system.h"
+#include "console.h"
+#include "spmcheck.h"
+#include "travel.h"
+#include "modbus.h"
+
+uint8_t modbus_addr;
+
+static uint8_t frame[MODBUS_FRAMELEN];
+static uint8_t replylen;
+static uint16_t messages;
+static uint16_t crcerrors;
+static uint16_t exceptions;
+static uint8_t targets;		// hoists a write is still to be posted to
+
+// Console keys of the holding registers
+static const uint8_t holding_key[holding_count] = {
+	0x31, 0x32, 0x6d, 0x68, 0x72, 0x66, 0x6e, 0x61, 0x62, 0x7a, 0x6c, 0x78,
+};
+
+// CRC of len bytes of frame, zero over a frame with valid checksum
+static uint16_t frame_crc(uint8_t len)
+{
+	uint16_t crc = 0xffff;
+	uint8_t i;
+	for (i = 0; i < len; i++) {
+		crc = _crc16_update(crc, frame[i]);
+	}
+	return crc;
+}
+
+static uint16_t get_word(uint8_t oft)
+{
+	return (uint16_t) (frame[oft] << 8 | frame[oft + 1U]);
+}
+
+static void put_word(uint8_t oft, uint16_t val)
+{
+	frame[oft] = (uint8_t) (val >> 8);
+	frame[oft + 1U] = (uint8_t) (val & 0xff);
+}
+
+// Coil bits from hoist n controller outputs
+static uint8_t coil_value(uint8_t n)
+{
+	const struct hoist_pins *p = &pinmap[n];
+	uint8_t out = *p->port;
+	uint8_t coils = 0;
+	if (out & p->pwr) {
+		if (out & p->fwd) {
+			coils |= _BV(coil_down);
+		}
+		if (out & p->rev) {
+			coils |= _BV(coil_up);
+		}
+	}
+	return coils;
+}
+
+static uint16_t holding_value(uint8_t n, uint8_t reg)
+{
+	const struct state_machine *m = &hoist[n];
+	switch (reg) {
+	case holding_p1:
+		return m->p1_timeout;
+	case holding_p2:
+		return m->p2_timeout;
+	case holding_man:
+		return m->man_timeout;
+	case holding_h:
+		return m->h_timeout;
+	case holding_hr:
+		return m->hr_timeout;
+	case holding_f:
+		return m->f_timeout;
+	case holding_nf:
+		return m->nf;
+	case holding_accel:
+		return m->accel;
+	case holding_decel:
+		return m->decel;
+	case holding_approach:
+		return m->approach;
+	case holding_slow:
+		return m->slow;
+	case holding_addr:
+		return modbus_addr;
+	default:
+		return 0;
+	}
+}
+
+// Return 1 if the console would store val to reg unchanged
+static uint8_t holding_valid(uint8_t reg, uint16_t val)
+{
+	switch (reg) {
+	case holding_p1:
+	case holding_p2:
+	case holding_man:
+	case holding_h:
+		return val != 0;
+	case holding_accel:
+	case holding_decel:
+		return val <= MAX_RAMP;
+	case holding_approach:
+		return val <= MAX_APPROACH;
+	case holding_slow:
+		return val <= MAX_SLOW;
+	case holding_addr:
+		return val <= MODBUS_LASTADDR;
+	default:
+		return 1U;
+	}
+}
+
+static uint16_t input_value(uint8_t n, uint8_t reg)
+{
+	const struct state_machine *m = &hoist[n];
+	uint8_t spm = pinmap[n].spm;
+	switch (reg) {
+	case input_state:
+		return m->state;
+	case input_error:
+		return m->error;
+	case input_volts:
+		return (uint16_t) ((ADCH * 128U + 40U) / 80U);
+	case input_minutes:
+		return (uint16_t) ((m->clock - m->since) / ONEMINUTE);
+	case input_clockhi:
+		return (uint16_t) (m->clock >> 16);
+	case input_clocklo:
+		return (uint16_t) (m->clock & 0xffff);
+	case input_version:
+		return sw_version;
+	case input_up:
+		return travels[n].up;
+	case input_down:
+		return travels[n].down;
+	case input_speed:
+		return spm ? spm_telemetry.speed : 0;
+	case input_current:
+		return spm ? spm_telemetry.current : 0;
+	case input_spmvolts:
+		return spm ? spm_telemetry.volts : 0;
+	case input_fault:
+		return spm ? spm_telemetry.fault : 0;
+	case input_samples:
+		return spm ? spm_telemetry.samples : 0;
+	case input_messages:
+		return messages;
+	case input_crcerrors:
+		return crcerrors;
+	case input_exceptions:
+		return exceptions;
+	default:
+		return 0;
+	}
+}
+
+static void post(uint8_t type, uint8_t key, uint16_t value)
+{
+	struct console_event event;
+	event.type = type;
+	event.key = key;
+	event.value = value;
+	console_post(&event);
+}
+
+// Return 1 if there is room to queue hoist selection and count events
+// for every hoist still to be written
+static uint8_t room(uint8_t count)
+{
+	return console_room() >= targets * (count + HOIST_COUNT - 1U);
+}
+
+// Address following events to hoist n
+static void post_hoist(uint8_t n)
+{
+#if HOIST_COUNT > 1
+	post(event_setvalue, 0x69, (uint16_t) (n + 1U));
+#else
+	(void) n;
+#endif // HOIST_COUNT
+}
+
+static uint8_t read_coils(uint8_t n)
+{
+	uint16_t start = get_word(2);
+	uint16_t count = get_word(4);
+	if (!count || count > 2000U) {
+		return MODBUS_BADVALUE;
+	}
+	if (start >= coil_count || count > coil_count - start) {
+		return MODBUS_BADADDRESS;
+	}
+	frame[2] = 1U;
+	frame[3] = (uint8_t) ((coil_value(n) >> start) & ((1U << count) - 1U));
+	replylen = 4U;
+	return 0;
+}
+
+static uint8_t read_registers(uint8_t n, uint8_t holding)
+{
+	uint16_t start = get_word(2);
+	uint16_t count = get_word(4);
+	uint16_t total = holding ? holding_count : input_count;
+	uint8_t reg;
+	uint8_t i;
+	if (!count || count > 125U) {
+		return MODBUS_BADVALUE;
+	}
+	if (start >= total || count > total - start) {
+		return MODBUS_BADADDRESS;
+	}
+	frame[2] = (uint8_t) (count * 2U);
+	for (i = 0; i < count; i++) {
+		reg = (uint8_t) (start + i);
+		put_word((uint8_t) (3U + 2U * i), holding ?
+			 holding_value(n, reg) : input_value(n, reg));
+	}
+	replylen = (uint8_t) (3U + 2U * count);
+	return 0;
+}
+
+static uint8_t write_coil(uint8_t n)
+{
+	uint16_t coil = get_word(2);
+	uint16_t value = get_word(4);
+	if (value != 0xff00U && value != 0) {
+		return MODBUS_BADVALUE;
+	}
+	if (coil >= coil_count) {
+		return MODBUS_BADADDRESS;
+	}
+	if (!room(1U)) {
+		return MODBUS_BUSY;
+	}
+	// coils are momentary, writing off has no effect
+	if (value) {
+		post_hoist(n);
+		post(coil == coil_down ? event_down : event_up, 0, 0);
+	}
+	replylen = 6U;
+	return 0;
+}
+
+static uint8_t write_registers(uint8_t n, uint8_t len)
+{
+	uint16_t start;
+	uint16_t count;
+	uint8_t oft;
+	uint8_t i;
+	if (frame[1] == MODBUS_WRITEREG) {
+		start = get_word(2);
+		count = 1U;
+		oft = 4U;
+	} else {
+		start = get_word(2);
+		count = get_word(4);
+		oft = 7U;
+		if (!count || count > 123U || frame[6] != count * 2U
+		    || len != 9U + frame[6]) {
+			return MODBUS_BADVALUE;
+		}
+	}
+	if (start >= holding_count || count > holding_count - start) {
+		return MODBUS_BADADDRESS;
+	}
+	for (i = 0; i < count; i++) {
+		if (!holding_valid((uint8_t) (start + i),
+				   get_word((uint8_t) (oft + 2U * i)))) {
+			return MODBUS_BADVALUE;
+		}
+	}
+	if (!room((uint8_t) count)) {
+		return MODBUS_BUSY;
+	}
+	post_hoist(n);
+	for (i = 0; i < count; i++) {
+		post(event_setvalue, holding_key[start + i],
+		     get_word((uint8_t) (oft + 2U * i)));
+	}
+	replylen = 6U;
+	return 0;
+}
+
+// Perform request for hoist n, return exception code or 0
+static uint8_t request(uint8_t n, uint8_t len)
+{
+	uint8_t bad = len != MODBUS_FIXEDLEN ? MODBUS_BADVALUE : 0;
+	switch (frame[1]) {
+	case MODBUS_READCOILS:
+		return bad ? bad : read_coils(n);
+	case MODBUS_READHOLDING:
+		return bad ? bad : read_registers(n, 1U);
+	case MODBUS_READINPUT:
+		return bad ? bad : read_registers(n, 0);
+	case MODBUS_WRITECOIL:
+		return bad ? bad : write_coil(n);
+	case MODBUS_WRITEREG:
+		return bad ? bad : write_registers(n, len);
+	case MODBUS_WRITEREGS:
+		return write_registers(n, len);
+	default:
+		return MODBUS_BADFUNCTION;
+	}
+}
+
+// Append checksum and send reply
+static void reply(uint8_t len)
+{
+	uint16_t crc = frame_crc(len);
+	frame[len] = (uint8_t) (crc & 0xff);
+	frame[len + 1U] = (uint8_t) (crc >> 8);
+	console_send(frame, (uint8_t) (len + 2U));
+}
+
+void modbus_poll(void)
+{
+	uint8_t len;
+	uint8_t code;
+	uint8_t n;
+	if (!modbus_addr) {
+		return;
+	}
+	len = console_frame(frame, MODBUS_FRAMELEN);
+	if (len < 4U) {
+		return;
+	}
+	if (frame_crc(len)) {
+		++crcerrors;
+		return;
+	}
+	++messages;
+	if (frame[0] == 0) {
+		// broadcast writes apply to every hoist, without reply, the
+		// first checks there is room for all so none is left out
+		if (frame[1] == MODBUS_WRITECOIL || frame[1] == MODBUS_WRITEREG
+		    || frame[1] == MODBUS_WRITEREGS) {
+			for (n = 0; n < HOIST_COUNT; n++) {
+				targets = (uint8_t) (HOIST_COUNT - n);
+				if (request(n, len)) {
+					break;
+				}
+			}
+		}
+		return;
+	}
+	if (frame[0] < modbus_addr || frame[0] >= modbus_addr + HOIST_COUNT) {
+		return;
+	}
+	targets = 1U;
+	code = request((uint8_t) (frame[0] - modbus_addr), len);
+	if (code) {
+		frame[1] |= 0x80;
+		frame[2] = code;
+		replylen = 3U;
+		++exceptions;
+	}
+	reply(replylen);
+}
+
+void modbus_select(uint8_t addr)
+{
+	if (addr != modbus_addr) {
+		modbus_addr = addr;
+		console_framed(addr != 0);
+	}
+}
+
+void modbus_init(void)
+{
+	uint16_t addr = read_word(NVM_MBADDR);
+	// unset EEPROM reads 0xffff
+	if (addr > MODBUS_LASTADDR) {
+		addr = 0;
+	}
+	modbus_select((uint8_t) addr);
+}
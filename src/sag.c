@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Stall detection from battery voltage sag under motor load
+ *
+ * While a motor is powered, every free running conversion is taken
+ * by interrupt and averaged over the tick. Once a move has run at
+ * full throttle past the spin up, the drop below the battery rest
+ * voltage is compared with the drop learned from earlier moves in the
+ * same direction. A jammed or overloaded motor draws several times
+ * its running current, so a drop held well over the learned value
+ * stops the motor within a fraction of a second. Nothing is checked
+ * until a direction has been learned, or while both hoists run.
+ *
+ * Learned drops are kept in EEPROM after the travel calibration, one
+ * byte of SAG_MV counts per direction, 0xff or 0 if not learned.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "system.h"
+#include "battery.h"
+#include "throttle.h"
+#include "sag.h"
+
+#define SAG_MV		40U	// mV per count of the 10 bit conversion
+
+// Motor load of one hoist
+struct sag {
+	uint16_t normal[sag_dirs];	// learned drop, mV, 0 until learned
+	uint32_t sum;		// drop over the steady ticks of this move
+	uint16_t ticks;		// steady ticks of this move
+	uint8_t full;		// ticks at full throttle, to SAG_GRACE
+	uint8_t over;		// consecutive ticks over the limit
+	uint8_t dir;
+	uint8_t running;
+	uint8_t stalled;
+};
+
+static struct sag sags[HOIST_COUNT];
+static volatile uint16_t adc_sum;
+static volatile uint8_t adc_count;
+static uint16_t rail;		// battery voltage of the last tick, 0 if none
+static uint8_t alone;		// only one motor is powered
+
+// ADCL must be read first
+ISR(ADC_vect)
+{
+	uint8_t lo = ADCL;
+	uint8_t hi = ADCH;
+	if (adc_count < SAG_SAMPLES) {
+		adc_sum = (uint16_t) (adc_sum + (hi << 2 | lo >> 6));
+		++adc_count;
+	}
+}
+
+void sag_update(void)
+{
+	uint16_t sum;
+	uint8_t count;
+	uint8_t running = 0;
+	uint8_t n;
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		sum = adc_sum;
+		count = adc_count;
+		adc_sum = 0;
+		adc_count = 0;
+	}
+	rail = 0;
+	if (count) {
+		rail = (uint16_t) ((uint32_t) sum * SAG_MV / count);
+	}
+	for (n = 0; n < HOIST_COUNT; n++) {
+		if (*pinmap[n].port & pinmap[n].pwr) {
+			++running;
+		}
+	}
+	alone = running == 1U;
+	if (!running) {
+		// conversions go back to the entropy collector
+		ADCSRA &= (uint8_t) ~_BV(ADIE);
+	}
+}
+
+// Learned drop of one direction in EEPROM counts
+static uint8_t sag_counts(uint16_t normal)
+{
+	uint16_t counts = normal / SAG_MV;
+	if (counts > 0xfeU) {
+		counts = 0xfeU;
+	} else if (normal && !counts) {
+		counts = 1U;
+	}
+	return (uint8_t) counts;
+}
+
+static uint16_t sag_drop(uint8_t counts)
+{
+	return counts == 0xffU ? 0 : (uint16_t) (counts * SAG_MV);
+}
+
+void sag_init(void)
+{
+	struct sag *s = &sags[unit];
+	uint16_t val = read_hoist(NVM_SAG);
+	s->normal[sag_down] = sag_drop((uint8_t) (val & 0xff));
+	s->normal[sag_up] = sag_drop((uint8_t) (val >> 8));
+}
+
+// Save the selected hoist's learned drops if their counts changed
+static void sag_save(void)
+{
+	struct sag *s = &sags[unit];
+	uint16_t val = (uint16_t) (sag_counts(s->normal[sag_up]) << 8
+				   | sag_counts(s->normal[sag_down]));
+	if (read_hoist(NVM_SAG) != val) {
+		save_hoist(NVM_SAG, val);
+	}
+}
+
+void sag_start(void)
+{
+	struct sag *s = &sags[unit];
+	s->dir = (*pins->port & pins->rev) ? sag_up : sag_down;
+	s->sum = 0;
+	s->ticks = 0;
+	s->full = 0;
+	s->over = 0;
+	s->stalled = 0;
+	s->running = 1U;
+	ADCSRA |= _BV(ADIE);
+}
+
+void sag_stop(uint8_t learn)
+{
+	struct sag *s = &sags[unit];
+	uint16_t *normal = &s->normal[s->dir];
+	uint16_t mean;
+	uint16_t step;
+	if (s->running && learn && !s->stalled && s->ticks >= SAG_LEARNMIN) {
+		mean = (uint16_t) (s->sum / s->ticks);
+		if (!*normal) {
+			*normal = mean;
+		} else {
+			// a slowly worsening load may only creep the baseline
+			if (mean > *normal) {
+				step = (uint16_t) ((mean - *normal) >> SAG_LEARN);
+			} else {
+				step = (uint16_t) ((*normal - mean) >> SAG_LEARN);
+			}
+			if (step > SAG_STEP) {
+				step = SAG_STEP;
+			}
+			if (mean > *normal) {
+				*normal = (uint16_t) (*normal + step);
+			} else {
+				*normal = (uint16_t) (*normal - step);
+			}
+		}
+		sag_save();
+	}
+	s->running = 0;
+}
+
+uint8_t sag_check(void)
+{
+	struct sag *s = &sags[unit];
+	uint16_t drop = 0;
+	uint16_t limit;
+	if (!s->running || !rail) {
+		// replayed ticks have no samples
+		return 0;
+	}
+	if (!alone || !throttle_full()) {
+		// ramping, slow approach or shared load
+		s->full = 0;
+		s->over = 0;
+		return 0;
+	}
+	if (s->full < SAG_GRACE) {
+		++s->full;
+		return 0;
+	}
+	if (battery.rest > rail) {
+		drop = (uint16_t) (battery.rest - rail);
+	}
+	if (s->ticks < 0xffffU) {
+		s->sum += drop;
+		++s->ticks;
+	}
+	limit = s->normal[s->dir];
+	if (!limit) {
+		return 0;
+	}
+	limit = (uint16_t) (limit + limit / 2U + SAG_MARGIN);
+	if (drop <= limit) {
+		s->over = 0;
+	} else if (++s->over >= SAG_COUNT) {
+		s->stalled = 1U;
+	}
+	return s->stalled;
+}
+
+uint16_t sag_normal(uint8_t dir)
+{
+	return sags[unit].normal[dir];
+}
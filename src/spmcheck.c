@@ -2,11 +2,14 @@
 
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/wdt.h>
 #include <util/delay_basic.h>
 #include <string.h>
 #include "system.h"
 #include "console.h"
+#include "spmcheck.h"
 #include "spm_config.h"
 
 #define SPM_MAXLEN	24U
@@ -15,10 +18,56 @@
 #define SPM_PACKLEN	0x10
 #define SPM_SUBLEN	0x0d
 #define SPM_WAKECOUNT	3U	// controller needs time to wake up
+#define SPM_UPDATEKEY	0x5355U	// NVM_SPMOFT: update attempted last boot
+
+// Telemetry monitor requests, 16 byte reply body (Kelly KLS layout)
+#define SPM_MONITOR1	0x3b	// switches, B+ volts, temperatures
+#define SPM_MON1_VOLTS	9U
+#define SPM_MONITOR2	0x3c	// speed, current and error flags
+#define SPM_MON2_SPEED	0	// MSB first
+#define SPM_MON2_CURRENT	2U
+#define SPM_MON2_FAULT	3U	// MSB first
+#define SPM_POLLSTEP	2U	// service USART every 2 timer counts (0.26ms)
+#define SPM_POLLWAKE	60U	// 0.6s controller boot before first poll
+#define SPM_POLLWAIT	4U	// 40ms reply timeout
+#define SPM_POLLPERIOD	5U	// 50ms between requests
+#define SPM_POLLVOLTS	8U	// request volts every 8th poll
 
 static uint8_t readbuf[SPM_MAXLEN];	// read buffer
 static uint8_t cfgmem[128];	// mem buffer
 
+struct spm_telemetry spm_telemetry;
+
+// Telemetry poller, serviced from timer0 compare B
+static uint8_t polltx[3];
+static volatile uint8_t polltxlen;
+static volatile uint8_t pollrxlen;
+static uint8_t pollwait;
+static uint8_t pollcount;
+static uint8_t pollreq;
+static uint8_t polling;
+
+ISR(TIMER0_COMPB_vect)
+{
+	uint8_t next = (uint8_t) (OCR0B + SPM_POLLSTEP);
+	if (next >= TICK_COUNT) {
+		next = (uint8_t) (next - TICK_COUNT);
+	}
+	OCR0B = next;
+	// a character takes 0.52ms at 19200, two passes per character
+	// and the two byte FIFO cover a pass held off by other handlers
+	while (bit_is_set(UCSR1A, RXC0)) {
+		uint8_t ch = UDR1;
+		if (pollrxlen < SPM_MAXLEN) {
+			readbuf[pollrxlen++] = ch;
+		}
+	}
+	if (polltxlen && bit_is_set(UCSR1A, UDRE0)) {
+		UDR1 = polltx[sizeof(polltx) - polltxlen];
+		--polltxlen;
+	}
+}
+
 // Write byte to controller USART
 static void spm_write(uint8_t ch)
 {
@@ -68,13 +117,13 @@ static uint8_t spm_receive(uint8_t hdr, uint8_t bodylen)
 	if (spm_read(total) == total) {
 		// Check header and report length
 		if (readbuf[0] != hdr || readbuf[1] != bodylen) {
-			console_write("SPM: Invalid header\r\n");
+			console_write(PSTR("SPM: Invalid header\r\n"));
 			return 0;
 		}
 		// Compare checksum
 		uint8_t sum = rcvsum(total);
 		if (sum != readbuf[total - 1]) {
-			console_write("SPM: Invalid checksum\r\n");
+			console_write(PSTR("SPM: Invalid checksum\r\n"));
 			return 0;
 		}
 		return 1U;
@@ -190,7 +239,7 @@ static uint8_t spm_writemem(void)
 		spm_send(0xf3, SPM_PACKLEN, &readbuf[0]);
 		wdt_reset();
 		if (!spm_receive(0xf3, 1)) {
-			console_write("SPM: Write error\r\n");
+			console_write(PSTR("SPM: Write error\r\n"));
 			break;
 		}
 		wdt_reset();
@@ -198,7 +247,7 @@ static uint8_t spm_writemem(void)
 	}
 
 	if (oft != 0x80) {
-		console_write("SPM: Write error\r\n");
+		console_write(PSTR("SPM: Write error\r\n"));
 		return 0;
 	}
 	spm_send(0xf4, 0, 0);
@@ -215,7 +264,7 @@ static uint8_t spm_modelok(void)
 	uint8_t *chk = &target[0];
 	while (count < 8U) {
 		if (*(src++) != *(chk++)) {
-			console_showascii("SPM: Unknown model ", &cfgmem[0x40],
+			console_showascii(PSTR("SPM: Unknown model "), &cfgmem[0x40],
 					  8U);
 			return 0;
 		}
@@ -241,36 +290,128 @@ static void spm_checkmem(void)
 		++count;
 	}
 	if (count != 8) {
-		console_write("SPM: Read error\r\n");
+		console_write(PSTR("SPM: Read error\r\n"));
 		return;
 	}
 	if (!spm_modelok()) {
 		return;
 	}
 	if (spm_comparemem()) {
-		console_showhex("SPM: ", &cfgmem[0x4c], 4);
-		write_word(NVM_SPMOFT, 1U);
+		console_showhex(PSTR("SPM: "), &cfgmem[0x4c], 4);
+		if (read_word(NVM_SPMOFT) != 1U) {
+			write_word(NVM_SPMOFT, 1U);
+		}
 		return;
 	}
 	wdt_reset();
 	// Avoid reboot loop
-	uint16_t seedoft = read_word(NVM_SEEDOFT);
 	uint16_t spmkey = read_word(NVM_SPMOFT);
-	uint16_t nextkey = seedoft + 4U;
-	if (nextkey >= SEEDOFT_LEN) {
-		nextkey = 0;
+	if (spmkey != SPM_UPDATEKEY) {
+		write_word(NVM_SPMOFT, SPM_UPDATEKEY);
 	}
-	write_word(NVM_SPMOFT, nextkey);
 	if (spm_writemem()) {
-		if (spmkey == seedoft) {
-			console_write("SPM: Update reboot error\r\n");
+		if (spmkey == SPM_UPDATEKEY) {
+			console_write(PSTR("SPM: Update reboot error\r\n"));
 			return;
 		} else {
-			spm_lockup("SPM: Config updated\r\n");
+			spm_lockup(PSTR("SPM: Config updated\r\n"));
 		}
 	} else {
-		console_write("SPM: Update error\r\n");
+		console_write(PSTR("SPM: Update error\r\n"));
+	}
+}
+
+static uint16_t monitor_word(uint8_t oft)
+{
+	return (uint16_t) ((readbuf[2U + oft] << 8) | readbuf[3U + oft]);
+}
+
+// Queue a monitor request for the compare B service routine
+static void poll_request(uint8_t hdr)
+{
+	polltx[0] = hdr;
+	polltx[1] = 0;
+	polltx[2] = hdr;
+	pollreq = hdr;
+	pollrxlen = 0;
+	polltxlen = sizeof(polltx);
+	pollwait = SPM_POLLWAIT;
+}
+
+// Check and store a completed monitor reply
+static uint8_t poll_reply(void)
+{
+	uint8_t total = (uint8_t) (3U + SPM_PACKLEN);
+	if (pollrxlen != total || readbuf[0] != pollreq
+	    || readbuf[1] != SPM_PACKLEN || rcvsum(total) != readbuf[total - 1]) {
+		return 0;
+	}
+	if (pollreq == SPM_MONITOR1) {
+		spm_telemetry.volts = readbuf[2U + SPM_MON1_VOLTS];
+		return 0;
+	}
+	spm_telemetry.speed = monitor_word(SPM_MON2_SPEED);
+	spm_telemetry.current = readbuf[2U + SPM_MON2_CURRENT];
+	spm_telemetry.fault = monitor_word(SPM_MON2_FAULT);
+	if (spm_telemetry.samples != 0xff) {
+		++spm_telemetry.samples;
+	}
+	return 1U;
+}
+
+void spm_poll_start(void)
+{
+	spm_telemetry.speed = 0;
+	spm_telemetry.fault = 0;
+	spm_telemetry.current = 0;
+	spm_telemetry.samples = 0;
+	polltxlen = 0;
+	pollrxlen = 0;
+	pollreq = 0;
+	pollcount = 0;
+	pollwait = SPM_POLLWAKE;
+	spm_open();
+	OCR0B = (uint8_t) ((TCNT0 + SPM_POLLSTEP) % TICK_COUNT);
+	TIFR0 = _BV(OCF0B);
+	TIMSK0 |= _BV(OCIE0B);
+	polling = 1U;
+}
+
+void spm_poll_stop(void)
+{
+	if (polling) {
+		TIMSK0 &= (uint8_t) ~ _BV(OCIE0B);
+		spm_close();
+		polling = 0;
+	}
+}
+
+uint8_t spm_poll(void)
+{
+	uint8_t sample = 0;
+	if (!polling) {
+		return 0;
+	}
+	if (pollwait) {
+		--pollwait;
+		if (pollreq == 0 || (pollrxlen != 3U + SPM_PACKLEN && pollwait)) {
+			return 0;
+		}
+	}
+	// reply complete or timed out, then wait out the poll period
+	if (pollreq) {
+		sample = poll_reply();
+		pollreq = 0;
+		pollwait = SPM_POLLPERIOD;
+		return sample;
+	}
+	++pollcount;
+	if ((pollcount & (SPM_POLLVOLTS - 1U)) == 0) {
+		poll_request(SPM_MONITOR1);
+	} else {
+		poll_request(SPM_MONITOR2);
 	}
+	return sample;
 }
 
 // Perform controller check
@@ -285,7 +426,7 @@ void spm_check(void)
 		wdt_reset();
 		spm_checkmem();
 	} else {
-		console_write("SPM: Not connected\r\n");
+		console_write(PSTR("SPM: Not connected\r\n"));
 	}
 	spm_close();
 	PORTD &= (uint8_t) ~ _BV(PWR);	// disable motor controller
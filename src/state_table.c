@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Generated by reference/sm_mktable.py from reference/state_table.txt
+ */
+#include "state_table.h"
+
+const uint8_t state_table[STATE_COUNT][EVENT_COUNT] PROGMEM = {
+	[state_stop] = {
+		[trig_up] = (act_move_up << 4) | state_move_h,
+		[trig_down] = (act_move_down << 4) | state_move_man,
+		[trig_home] = (act_home << 4) | state_at_h,
+		[trig_p1] = (act_spurious << 4) | state_stop,
+		[trig_p2] = (act_spurious << 4) | state_stop,
+		[trig_man] = (act_spurious << 4) | state_stop,
+		[trig_max] = (act_spurious << 4) | state_stop,
+		[trig_feedtime] = (act_spurious << 4) | state_stop,
+		[trig_randfeed] = (act_spurious << 4) | state_stop,
+		[trig_safetime] = (act_move_up << 4) | state_move_h,
+		[trig_notathome] = (act_spurious << 4) | state_stop,
+		[trig_stall] = (act_ignore << 4) | state_stop,
+		[trig_sag] = (act_ignore << 4) | state_stop,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_stop_h_p1] = {
+		[trig_up] = (act_move_up << 4) | state_move_h,
+		[trig_down] = (act_move_down << 4) | state_move_h_p1,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_p2] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_man] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_max] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_feedtime] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_randfeed] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_safetime] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_notathome] = (act_spurious << 4) | state_stop_h_p1,
+		[trig_stall] = (act_ignore << 4) | state_stop_h_p1,
+		[trig_sag] = (act_ignore << 4) | state_stop_h_p1,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_stop_p1_p2] = {
+		[trig_up] = (act_move_up << 4) | state_move_h,
+		[trig_down] = (act_move_down << 4) | state_move_p1_p2,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_p2] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_man] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_max] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_feedtime] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_randfeed] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_safetime] = (act_move_up << 4) | state_move_h,
+		[trig_notathome] = (act_spurious << 4) | state_stop_p1_p2,
+		[trig_stall] = (act_ignore << 4) | state_stop_p1_p2,
+		[trig_sag] = (act_ignore << 4) | state_stop_p1_p2,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_at_h] = {
+		[trig_up] = (act_spurious << 4) | state_at_h,
+		[trig_down] = (act_start_p1 << 4) | state_move_h_p1,
+		[trig_home] = (act_retry << 4) | state_at_h,
+		[trig_p1] = (act_spurious << 4) | state_at_h,
+		[trig_p2] = (act_spurious << 4) | state_at_h,
+		[trig_man] = (act_spurious << 4) | state_at_h,
+		[trig_max] = (act_spurious << 4) | state_at_h,
+		[trig_feedtime] = (act_spurious << 4) | state_at_h,
+		[trig_randfeed] = (act_start_p1 << 4) | state_move_h_p1,
+		[trig_safetime] = (act_spurious << 4) | state_at_h,
+		[trig_notathome] = (act_move_up << 4) | state_move_h,
+		[trig_stall] = (act_ignore << 4) | state_at_h,
+		[trig_sag] = (act_ignore << 4) | state_at_h,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_at_p1] = {
+		[trig_up] = (act_move_up << 4) | state_move_h,
+		[trig_down] = (act_start_p2 << 4) | state_move_p1_p2,
+		[trig_home] = (act_ignore << 4) | state_at_p1,
+		[trig_p1] = (act_spurious << 4) | state_at_p1,
+		[trig_p2] = (act_spurious << 4) | state_at_p1,
+		[trig_man] = (act_spurious << 4) | state_at_p1,
+		[trig_max] = (act_spurious << 4) | state_at_p1,
+		[trig_feedtime] = (act_move_up << 4) | state_move_h,
+		[trig_randfeed] = (act_spurious << 4) | state_at_p1,
+		[trig_safetime] = (act_spurious << 4) | state_at_p1,
+		[trig_notathome] = (act_spurious << 4) | state_at_p1,
+		[trig_stall] = (act_ignore << 4) | state_at_p1,
+		[trig_sag] = (act_ignore << 4) | state_at_p1,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_at_p2] = {
+		[trig_up] = (act_move_up << 4) | state_move_h,
+		[trig_down] = (act_move_down << 4) | state_move_man,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_at_p2,
+		[trig_p2] = (act_spurious << 4) | state_at_p2,
+		[trig_man] = (act_spurious << 4) | state_at_p2,
+		[trig_max] = (act_spurious << 4) | state_at_p2,
+		[trig_feedtime] = (act_spurious << 4) | state_at_p2,
+		[trig_randfeed] = (act_spurious << 4) | state_at_p2,
+		[trig_safetime] = (act_move_up << 4) | state_move_h,
+		[trig_notathome] = (act_spurious << 4) | state_at_p2,
+		[trig_stall] = (act_ignore << 4) | state_at_p2,
+		[trig_sag] = (act_ignore << 4) | state_at_p2,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_move_h_p1] = {
+		[trig_up] = (act_stop << 4) | state_stop_h_p1,
+		[trig_down] = (act_stop << 4) | state_stop_h_p1,
+		[trig_home] = (act_tangle << 4) | state_stop,
+		[trig_p1] = (act_arrive_p1 << 4) | state_at_p1,
+		[trig_p2] = (act_spurious << 4) | state_move_h_p1,
+		[trig_man] = (act_spurious << 4) | state_move_h_p1,
+		[trig_max] = (act_spurious << 4) | state_move_h_p1,
+		[trig_feedtime] = (act_spurious << 4) | state_move_h_p1,
+		[trig_randfeed] = (act_spurious << 4) | state_move_h_p1,
+		[trig_safetime] = (act_spurious << 4) | state_move_h_p1,
+		[trig_notathome] = (act_spurious << 4) | state_move_h_p1,
+		[trig_stall] = (act_error << 4) | state_stop_h_p1,
+		[trig_sag] = (act_error << 4) | state_stop_h_p1,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_move_p1_p2] = {
+		[trig_up] = (act_stop << 4) | state_stop_p1_p2,
+		[trig_down] = (act_stop << 4) | state_stop_p1_p2,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_p2] = (act_stop << 4) | state_at_p2,
+		[trig_man] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_max] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_feedtime] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_randfeed] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_safetime] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_notathome] = (act_spurious << 4) | state_move_p1_p2,
+		[trig_stall] = (act_error << 4) | state_stop_p1_p2,
+		[trig_sag] = (act_error << 4) | state_stop_p1_p2,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_move_h] = {
+		[trig_up] = (act_stop << 4) | state_stop,
+		[trig_down] = (act_stop << 4) | state_stop,
+		[trig_home] = (act_home << 4) | state_at_h,
+		[trig_p1] = (act_spurious << 4) | state_move_h,
+		[trig_p2] = (act_spurious << 4) | state_move_h,
+		[trig_man] = (act_spurious << 4) | state_move_h,
+		[trig_max] = (act_error << 4) | state_stop,
+		[trig_feedtime] = (act_spurious << 4) | state_move_h,
+		[trig_randfeed] = (act_spurious << 4) | state_move_h,
+		[trig_safetime] = (act_spurious << 4) | state_move_h,
+		[trig_notathome] = (act_spurious << 4) | state_move_h,
+		[trig_stall] = (act_error << 4) | state_stop,
+		[trig_sag] = (act_error << 4) | state_stop,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_move_man] = {
+		[trig_up] = (act_stop << 4) | state_stop,
+		[trig_down] = (act_stop << 4) | state_stop,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_move_man,
+		[trig_p2] = (act_spurious << 4) | state_move_man,
+		[trig_man] = (act_stop << 4) | state_stop,
+		[trig_max] = (act_spurious << 4) | state_move_man,
+		[trig_feedtime] = (act_spurious << 4) | state_move_man,
+		[trig_randfeed] = (act_spurious << 4) | state_move_man,
+		[trig_safetime] = (act_spurious << 4) | state_move_man,
+		[trig_notathome] = (act_spurious << 4) | state_move_man,
+		[trig_stall] = (act_error << 4) | state_stop,
+		[trig_sag] = (act_error << 4) | state_stop,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+	[state_error] = {
+		[trig_up] = (act_spurious << 4) | state_error,
+		[trig_down] = (act_spurious << 4) | state_error,
+		[trig_home] = (act_fault << 4) | state_stop,
+		[trig_p1] = (act_spurious << 4) | state_error,
+		[trig_p2] = (act_spurious << 4) | state_error,
+		[trig_man] = (act_spurious << 4) | state_error,
+		[trig_max] = (act_spurious << 4) | state_error,
+		[trig_feedtime] = (act_spurious << 4) | state_error,
+		[trig_randfeed] = (act_spurious << 4) | state_error,
+		[trig_safetime] = (act_spurious << 4) | state_error,
+		[trig_notathome] = (act_spurious << 4) | state_error,
+		[trig_stall] = (act_ignore << 4) | state_error,
+		[trig_sag] = (act_ignore << 4) | state_error,
+		[trig_reset] = (act_stop << 4) | state_stop,
+	},
+};
+
+// Label strings in program space
+static const char sl_stop[] PROGMEM = "[STOP]";
+static const char sl_stop_h_p1[] PROGMEM = "[STOP H-P1]";
+static const char sl_stop_p1_p2[] PROGMEM = "[STOP P1-P2]";
+static const char sl_at_h[] PROGMEM = "[AT H]";
+static const char sl_at_p1[] PROGMEM = "[AT P1]";
+static const char sl_at_p2[] PROGMEM = "[AT P2]";
+static const char sl_move_h_p1[] PROGMEM = "[MOVE H-P1]";
+static const char sl_move_p1_p2[] PROGMEM = "[MOVE P1-P2]";
+static const char sl_move_h[] PROGMEM = "[MOVE -H]";
+static const char sl_move_man[] PROGMEM = "[MOVE MAN]";
+static const char sl_error[] PROGMEM = "[Unknown/Error]";
+static const char en_up[] PROGMEM = "up";
+static const char en_down[] PROGMEM = "down";
+static const char en_home[] PROGMEM = "home";
+static const char en_p1[] PROGMEM = "p1";
+static const char en_p2[] PROGMEM = "p2";
+static const char en_man[] PROGMEM = "man";
+static const char en_max[] PROGMEM = "max";
+static const char en_feedtime[] PROGMEM = "feedtime";
+static const char en_randfeed[] PROGMEM = "randfeed";
+static const char en_safetime[] PROGMEM = "safetime";
+static const char en_notathome[] PROGMEM = "notathome";
+static const char en_stall[] PROGMEM = "stall";
+static const char en_sag[] PROGMEM = "sag";
+static const char en_reset[] PROGMEM = "reset";
+static const char el_up[] PROGMEM = "UP";
+static const char el_down[] PROGMEM = "DOWN";
+static const char el_home[] PROGMEM = "Home";
+static const char el_p1[] PROGMEM = "P1";
+static const char el_p2[] PROGMEM = "P2";
+static const char el_man[] PROGMEM = "Man";
+static const char el_max[] PROGMEM = "Max";
+static const char el_feedtime[] PROGMEM = "Feedtime";
+static const char el_randfeed[] PROGMEM = "Randfeed";
+static const char el_safetime[] PROGMEM = "Safetime";
+static const char el_notathome[] PROGMEM = "Not at home";
+static const char el_stall[] PROGMEM = "Stall";
+static const char el_sag[] PROGMEM = "Sag";
+static const char el_reset[] PROGMEM = "Reset";
+
+const char *const state_label[STATE_COUNT] PROGMEM = {
+	sl_stop,
+	sl_stop_h_p1,
+	sl_stop_p1_p2,
+	sl_at_h,
+	sl_at_p1,
+	sl_at_p2,
+	sl_move_h_p1,
+	sl_move_p1_p2,
+	sl_move_h,
+	sl_move_man,
+	sl_error,
+};
+
+const char *const event_name[EVENT_COUNT] PROGMEM = {
+	en_up,
+	en_down,
+	en_home,
+	en_p1,
+	en_p2,
+	en_man,
+	en_max,
+	en_feedtime,
+	en_randfeed,
+	en_safetime,
+	en_notathome,
+	en_stall,
+	en_sag,
+	en_reset,
+};
+
+const char *const event_label[EVENT_COUNT] PROGMEM = {
+	el_up,
+	el_down,
+	el_home,
+	el_p1,
+	el_p2,
+	el_man,
+	el_max,
+	el_feedtime,
+	el_randfeed,
+	el_safetime,
+	el_notathome,
+	el_stall,
+	el_sag,
+	el_reset,
+};
@@ -1,7 +1,7 @@
 // SPDX-License-Identifier: MIT
 
+#include <stddef.h>
 #include <stdint.h>
-#include <stdlib.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
@@ -9,43 +9,223 @@
 #include "system.h"
 #include "console.h"
 #include "spmcheck.h"
+#include "throttle.h"
+#include "timer.h"
+#include "travel.h"
+#include "entropy.h"
+#include "battery.h"
+#include "wear.h"
+#include "sag.h"
+#include "modbus.h"
+#include "boot.h"
 
-// Global state machine
-struct state_machine feed;
+// Hoist state machines, and the selected hoist
+struct state_machine hoist[HOIST_COUNT];
+struct state_machine *feed = &hoist[0];
+uint8_t unit;
+
+// Ticks since reset, shared by all hoists
+uint32_t uptime;
+
+// Accepted input state, shared by all hoists
+uint8_t bstate;
+
+// Abandoned input changes, S1 to S6
+uint16_t bounces[INPUT_COUNT];
+
+// PINC mask of inputs S1 to S6
+static const uint8_t input_bit[INPUT_COUNT] = {
+	_BV(S1), _BV(S2), _BV(S3), _BV(S4), _BV(S5), _BV(S6),
+};
+
+// Vertical counters of samples differing from bstate, one bit of
+// each input's count per byte, and filter lengths in the same form
+static uint8_t count0;
+static uint8_t count1;
+static uint8_t count2;
+static uint8_t length0;
+static uint8_t length1 = IMASK;	// DEBOUNCE_DEFAULT
+static uint8_t length2;
+
+// Serial console passkey
+uint16_t passkey;
+
+const struct hoist_pins pinmap[HOIST_COUNT] = {
+	{
+	 .port = &PORTD,
+	 .fwd = _BV(FWD),
+	 .rev = _BV(REV),
+	 .pwr = _BV(PWR),
+	 .atport = &PORTD,
+	 .atp1 = _BV(ATP1),
+	 .tport = &PORTD,
+	 .throttle = _BV(THROTTLE),
+	 .ocr = &OCR2B,
+	 .tccr = &TCCR2A,
+	 .com = _BV(COM2B1),
+	 .home = TRIGGER_HOME,
+	 .up = TRIGGER_UP,
+	 .down = TRIGGER_DOWN,
+	 .spm = 1U,
+	 },
+#if HOIST_COUNT > 1
+	{
+	 .port = &PORTB,
+	 .fwd = _BV(H2_FWD),
+	 .rev = _BV(H2_REV),
+	 .pwr = _BV(H2_PWR),
+	 .atport = &PORTE,
+	 .atp1 = _BV(H2_ATP1),
+	 .tport = &PORTD,
+	 .throttle = _BV(H2_THROTTLE),
+	 .ocr = &OCR3BL,
+	 .tccr = &TCCR3A,
+	 .com = _BV(COM3B1),
+	 .home = _BV(H2_HOME),
+	 .up = _BV(H2_UP),
+	 .down = _BV(H2_DOWN),
+	 .spm = 0,
+	 },
+#endif // HOIST_COUNT
+};
+
+const struct hoist_pins *pins = &pinmap[0];
 
 // Global software version
 uint16_t sw_version = SW_VERSION;
 
+// Global reset cause
+uint8_t reset_cause;
+
+// State machine snapshot, not cleared by the C runtime on reset
+struct warm_state {
+	uint32_t clock;
+	uint32_t since;
+	uint16_t p1;
+	uint16_t p2;
+	uint16_t nf_timeout;
+	uint8_t state;
+	uint8_t error;
+	uint8_t resumes;	// restarts without a change of state
+	uint16_t check;
+};
+static struct warm_state warm[HOIST_COUNT]
+    __attribute__((section(".noinit")));
+
 ISR(TIMER0_COMPA_vect)
 {
+	static uint8_t frac;
+	uint8_t next = (uint8_t) (frac + TICK_FRAC);
+	// stretch one period in eight to average exactly 10ms
+	if (next < frac) {
+		OCR0A = TICK_COUNT;
+	} else {
+		OCR0A = TICK_COUNT - 1U;
+	}
+	frac = next;
 	++SYSTICK;
 }
 
+// Count inputs that fell back to bstate with a change pending
+static void count_bounces(uint8_t mask)
+{
+	uint8_t n;
+	for (n = 0; n < INPUT_COUNT; n++) {
+		if ((mask & input_bit[n]) && bounces[n] != 0xffffU) {
+			++bounces[n];
+		}
+	}
+}
+
+// Accept each input once it has differed from bstate for its filter
+// length, and return the inputs that rose
 uint8_t read_inputs(void)
 {
-	static uint8_t prev = _BV(S3) | _BV(S4);
-	uint8_t cur = PINC & IMASK;
-	uint8_t flags = 0;
-	uint8_t mask;
-	if ((cur ^ prev) == 0) {
-		mask = cur ^ feed.bstate;
-		flags = (uint8_t) (mask & (~feed.bstate));
-		feed.bstate = cur;
+	uint8_t delta = (uint8_t) ((PINC & IMASK) ^ bstate);
+	uint8_t bounced = (uint8_t) ((count0 | count1 | count2) & ~delta);
+	uint8_t carry;
+	uint8_t done;
+	if (bounced) {
+		count_bounces(bounced);
+	}
+	// restart where equal, then count up where different
+	count0 &= delta;
+	count1 &= delta;
+	count2 &= delta;
+	carry = count0;
+	count0 ^= delta;
+	count2 ^= (uint8_t) (count1 & carry);
+	count1 ^= carry;
+	done = (uint8_t) (delta & ~((count0 ^ length0) | (count1 ^ length1)
+				    | (count2 ^ length2)));
+	count0 &= (uint8_t) ~done;
+	count1 &= (uint8_t) ~done;
+	count2 &= (uint8_t) ~done;
+	bstate ^= done;
+	return (uint8_t) (done & bstate);
+}
+
+void debounce_set(uint8_t input, uint8_t ticks)
+{
+	uint8_t bit = input_bit[input];
+	length0 &= (uint8_t) ~bit;
+	length1 &= (uint8_t) ~bit;
+	length2 &= (uint8_t) ~bit;
+	if (ticks & 1U) {
+		length0 |= bit;
+	}
+	if (ticks & 2U) {
+		length1 |= bit;
+	}
+	if (ticks & 4U) {
+		length2 |= bit;
+	}
+}
+
+uint8_t debounce_get(uint8_t input)
+{
+	uint8_t bit = input_bit[input];
+	uint8_t ticks = 0;
+	if (length0 & bit) {
+		ticks |= 1U;
+	}
+	if (length1 & bit) {
+		ticks |= 2U;
+	}
+	if (length2 & bit) {
+		ticks |= 4U;
+	}
+	return ticks;
+}
+
+// Load input filter lengths, unset EEPROM reads 0xffff
+static void debounce_init(void)
+{
+	uint16_t ticks;
+	uint8_t n;
+	for (n = 0; n < INPUT_COUNT; n++) {
+		ticks = read_word((uint16_t) (NVM_DEBOUNCE + 2U * n));
+		if (ticks == 0 || ticks > DEBOUNCE_MAX) {
+			ticks = DEBOUNCE_DEFAULT;
+		}
+		debounce_set(n, (uint8_t) ticks);
 	}
-	prev = cur;
-	return flags;
 }
 
 static void watchdog_init(void)
 {
+	// the bootloader clears MCUSR and passes its flags in BOOT_CAUSE
+	reset_cause = MCUSR | BOOT_CAUSE;
+	MCUSR = 0;
+	BOOT_CAUSE = 0;
 	// set watchdog timer to ~ 0.25s
 	wdt_enable(WDTO_250MS);
 }
 
 static void timer_init(void)
 {
-	// ~10ms Uptime timer
-	OCR0A = 78U;
+	// 10ms Uptime timer, period trimmed in compare ISR
+	OCR0A = TICK_COUNT - 1U;
 	TCCR0A = _BV(WGM01);
 	TCCR0B = _BV(CS02);
 	TIMSK0 |= _BV(OCIE0A);
@@ -56,8 +236,14 @@ static void gpio_init(void)
 {
 	// Pullup unused inputs
 	// Note: Controller serial lines are pulled low externally
+#if HOIST_COUNT > 1
+	PORTE |= _BV(1) | _BV(2);
+	DDRB |= H2_BMASK;
+	DDRE |= H2_EMASK;
+#else
 	PORTB |= _BV(0) | _BV(1) | _BV(2);
 	PORTE |= _BV(0) | _BV(1) | _BV(2);
+#endif // HOIST_COUNT
 
 	// Pullup inputs
 	PORTC |= IMASK;
@@ -66,22 +252,31 @@ static void gpio_init(void)
 	DDRD |= OMASK;
 
 	// Turn on indicator LED
-	PORTD |= _BV(LED);
+	PORTD |= INDICATOR;
 }
 
 static void adc_init(void)
 {
 	ADMUX |= _BV(REFS0) | _BV(ADLAR) | _BV(MUX2) | _BV(MUX1) | _BV(MUX0);
-	ADCSRA |= _BV(ADEN) | _BV(ADPS2) | _BV(ADPS0);
+	// free running conversions keep ADCH current
+	ADCSRA |= _BV(ADEN) | _BV(ADATE) | _BV(ADSC) | _BV(ADPS2) | _BV(ADPS0);
 }
 
-static void write_eeprom(uint16_t addr, uint8_t val)
+void write_byte(uint16_t addr, uint8_t val)
 {
-	loop_until_bit_is_clear(EECR, EEPE);
 	EEAR = addr;
 	EEDR = val;
-	EECR |= _BV(EEMPE);
-	EECR |= _BV(EEPE);
+	// EEPE must be set within four cycles of EEMPE
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		EECR |= _BV(EEMPE);
+		EECR |= _BV(EEPE);
+	}
+}
+
+static void write_eeprom(uint16_t addr, uint8_t val)
+{
+	loop_until_bit_is_clear(EECR, EEPE);
+	write_byte(addr, val);
 }
 
 void write_word(uint16_t addr, uint16_t val)
@@ -90,7 +285,7 @@ void write_word(uint16_t addr, uint16_t val)
 	write_eeprom(addr, (uint8_t) (val >> 8));
 }
 
-static uint8_t read_eeprom(uint16_t addr)
+uint8_t read_byte(uint16_t addr)
 {
 	loop_until_bit_is_clear(EECR, EEPE);
 	EEAR = addr;
@@ -100,58 +295,92 @@ static uint8_t read_eeprom(uint16_t addr)
 
 uint16_t read_word(uint16_t addr)
 {
-	uint16_t val = read_eeprom(addr++);
-	return val | (uint16_t) (read_eeprom(addr) << 8);
+	uint16_t val = read_byte(addr++);
+	return val | (uint16_t) (read_byte(addr) << 8);
 }
 
-static void load_parameters(void)
+// Address of a setting in the selected hoist's block
+static uint16_t hoist_addr(uint16_t addr)
+{
+	return (uint16_t) (addr - unit * NVM_HOISTLEN);
+}
+
+uint16_t read_hoist(uint16_t addr)
 {
-	// Set initial input state
-	feed.bstate = _BV(S3) | _BV(S4);
+	return read_word(hoist_addr(addr));
+}
+
+void save_hoist(uint16_t addr, uint16_t val)
+{
+	save_config(hoist_addr(addr), val);
+}
+
+static void write_hoist(uint16_t addr, uint16_t val)
+{
+	write_word(hoist_addr(addr), val);
+}
 
-	// Load feeder parameters from EEPROM
-	uint16_t seedoft = 0;
-	uint16_t tmp = read_word(NVM_KEY);
+// Read a setting added after v25003, zero on patched units
+static uint16_t read_setting(uint16_t addr, uint16_t max, uint16_t def)
+{
+	uint16_t val = read_hoist(addr);
+	if (val > max) {
+		val = def;
+		write_hoist(addr, val);
+	}
+	return val;
+}
+
+// Load the selected hoist's parameters from its EEPROM block
+static void load_parameters(void)
+{
+	uint16_t tmp = read_hoist(NVM_KEY);
 	if (tmp == NVM_KEYVAL) {
-		feed.p1_timeout = read_word(NVM_P1);
-		feed.p2_timeout = read_word(NVM_P2);
-		feed.man_timeout = read_word(NVM_MAN);
-		feed.h_timeout = read_word(NVM_H);
-		feed.f_timeout = read_word(NVM_F);
-		feed.nf = read_word(NVM_NF);
-		feed.hr_timeout = read_word(NVM_HR);
-		feed.pk = read_word(NVM_PK);
-		seedoft = read_word(NVM_SEEDOFT) + 4U;
-		if (seedoft >= SEEDOFT_LEN) {
-			seedoft = 0;
+		feed->p1_timeout = read_hoist(NVM_P1);
+		feed->p2_timeout = read_hoist(NVM_P2);
+		feed->man_timeout = read_hoist(NVM_MAN);
+		feed->h_timeout = read_hoist(NVM_H);
+		feed->f_timeout = read_hoist(NVM_F);
+		feed->nf = read_hoist(NVM_NF);
+		feed->hr_timeout = read_hoist(NVM_HR);
+		if (!unit) {
+			passkey = read_word(NVM_PK);
 		}
-		write_word(NVM_SEEDOFT, seedoft);
+		feed->accel = read_setting(NVM_ACCEL, MAX_RAMP, DEFAULT_ACCEL);
+		feed->decel = read_setting(NVM_DECEL, MAX_RAMP, DEFAULT_DECEL);
+		feed->approach = read_setting(NVM_APPROACH, MAX_APPROACH,
+					     DEFAULT_APPROACH);
+		feed->slow = read_setting(NVM_SLOW, MAX_SLOW, DEFAULT_SLOW);
 	} else {
-		feed.p1_timeout = DEFAULT_P1;
-		write_word(NVM_P1, feed.p1_timeout);
-		feed.p2_timeout = DEFAULT_P2;
-		write_word(NVM_P2, feed.p2_timeout);
-		feed.man_timeout = DEFAULT_MAN;
-		write_word(NVM_MAN, feed.man_timeout);
-		feed.h_timeout = DEFAULT_H;
-		write_word(NVM_H, feed.h_timeout);
-		feed.f_timeout = DEFAULT_F;
-		write_word(NVM_F, feed.f_timeout);
-		feed.nf = DEFAULT_NF;
-		write_word(NVM_NF, feed.nf);
-		write_word(NVM_SPMOFT, 1U);
-		write_word(NVM_SEEDOFT, seedoft);
-		write_word(NVM_KEY, NVM_KEYVAL);
-		feed.hr_timeout = DEFAULT_HR;
-		write_word(NVM_HR, feed.hr_timeout);
-		feed.pk = DEFAULT_PK;
-		write_word(NVM_PK, feed.pk);
-	}
-
-	// Initialise PRNG using next value from eeprom
-	uint32_t seed = 0 | read_word(seedoft);
-	seed = (seed << 16) | read_word(seedoft + 2U);
-	srandom(seed);
+		feed->p1_timeout = DEFAULT_P1;
+		write_hoist(NVM_P1, feed->p1_timeout);
+		feed->p2_timeout = DEFAULT_P2;
+		write_hoist(NVM_P2, feed->p2_timeout);
+		feed->man_timeout = DEFAULT_MAN;
+		write_hoist(NVM_MAN, feed->man_timeout);
+		feed->h_timeout = DEFAULT_H;
+		write_hoist(NVM_H, feed->h_timeout);
+		feed->f_timeout = DEFAULT_F;
+		write_hoist(NVM_F, feed->f_timeout);
+		feed->nf = DEFAULT_NF;
+		write_hoist(NVM_NF, feed->nf);
+		write_hoist(NVM_KEY, NVM_KEYVAL);
+		feed->hr_timeout = DEFAULT_HR;
+		write_hoist(NVM_HR, feed->hr_timeout);
+		if (!unit) {
+			write_word(NVM_SPMOFT, 1U);
+			passkey = DEFAULT_PK;
+			write_word(NVM_PK, passkey);
+		}
+		feed->accel = DEFAULT_ACCEL;
+		write_hoist(NVM_ACCEL, feed->accel);
+		feed->decel = DEFAULT_DECEL;
+		write_hoist(NVM_DECEL, feed->decel);
+		feed->approach = DEFAULT_APPROACH;
+		write_hoist(NVM_APPROACH, feed->approach);
+		feed->slow = DEFAULT_SLOW;
+		write_hoist(NVM_SLOW, feed->slow);
+	}
 }
 
 void save_config(uint16_t addr, uint16_t val)
@@ -161,14 +390,108 @@ void save_config(uint16_t addr, uint16_t val)
 	}
 }
 
+void hoist_select(uint8_t n)
+{
+	unit = n;
+	feed = &hoist[n];
+	pins = &pinmap[n];
+	travel = &travels[n];
+	timer_select(n);
+	throttle_select(n);
+}
+
+// Fletcher checksum over snapshot, seeded so a cleared RAM is invalid
+static uint16_t warm_check(const struct warm_state *w)
+{
+	const uint8_t *buf = (const uint8_t *) w;
+	uint8_t sum1 = 0x5aU;
+	uint8_t sum2 = 0xa5U;
+	uint8_t i;
+	for (i = 0; i < offsetof(struct warm_state, check); i++) {
+		sum1 = (uint8_t) (sum1 + buf[i]);
+		sum2 = (uint8_t) (sum2 + sum1);
+	}
+	return (uint16_t) (sum2 << 8) | sum1;
+}
+
+// Snapshot every hoist
+void warm_save(void)
+{
+	struct warm_state *w;
+	struct state_machine *m;
+	uint8_t n;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		w = &warm[n];
+		m = &hoist[n];
+		if (w->state != m->state) {
+			w->resumes = 0;
+		}
+		w->clock = m->clock;
+		w->since = m->since;
+		w->p1 = m->p1;
+		w->p2 = m->p2;
+		w->nf_timeout = m->nf_timeout;
+		w->state = m->state;
+		w->error = m->error;
+		w->check = warm_check(w);
+	}
+}
+
+void warm_clear(void)
+{
+	uint8_t n;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		warm[n].check = (uint16_t) ~warm_check(&warm[n]);
+	}
+}
+
+// Restore selected hoist after a watchdog or brown-out reset, 1 if valid
+uint8_t warm_restore(void)
+{
+	struct warm_state *w = &warm[unit];
+	uint8_t valid = (reset_cause & WARM_CAUSES)
+	    && w->check == warm_check(w) && w->state < STATE_COUNT
+	    && w->resumes < WARM_RESUMES;
+	if (valid) {
+		feed->clock = w->clock;
+		feed->since = w->since;
+		feed->p1 = w->p1;
+		feed->p2 = w->p2;
+		feed->nf_timeout = w->nf_timeout;
+		feed->state = w->state;
+		feed->error = w->error;
+		++w->resumes;
+		// keep the count valid should the next reset come before a save
+		w->check = warm_check(w);
+	} else {
+		w->resumes = 0;
+	}
+	return valid;
+}
+
 void system_init(void)
 {
+	uint8_t n;
 	watchdog_init();
 	timer_init();
 	gpio_init();
+	throttle_init();
 	adc_init();
 	console_init();
-	load_parameters();
+	bstate = INPUT_IDLE;
+	debounce_init();
+	for (n = 0; n < HOIST_COUNT; n++) {
+		hoist_select(n);
+		load_parameters();
+		travel_init();
+		sag_init();
+	}
+	hoist_select(0);
+	entropy_init();
+	battery_init();
+	wear_init();
+	wear_reset(reset_cause);
 	sei();
 	spm_check();
+	modbus_init();
 }
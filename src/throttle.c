@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "system.h"
+#include "throttle.h"
+
+// Ramp position and rate in 8.8 fixed point duty
+struct ramp {
+	uint16_t level;
+	uint16_t rate;
+	uint8_t target;
+};
+
+static struct ramp ramps[HOIST_COUNT];
+
+// Ramp of the selected hoist
+static struct ramp *ramp = &ramps[0];
+
+// Drive the selected hoist's throttle from the upper byte of level
+static void throttle_output(void)
+{
+	uint8_t duty = (uint8_t) (ramp->level >> 8);
+	if (duty == 0) {
+		*pins->tccr &= (uint8_t) ~ pins->com;
+		*pins->tport &= (uint8_t) ~ pins->throttle;
+	} else if (duty == THROTTLE_FULL) {
+		// hold pin high rather than pulse low once per period
+		*pins->tccr &= (uint8_t) ~ pins->com;
+		*pins->tport |= pins->throttle;
+	} else {
+		*pins->ocr = duty;
+		*pins->tccr |= pins->com;
+	}
+}
+
+void throttle_select(uint8_t n)
+{
+	ramp = &ramps[n];
+}
+
+void throttle_init(void)
+{
+	uint8_t n;
+	// Fast PWM, 2MHz/256 = 7.8kHz, OC2A/B connected while ramping
+	TCCR2A = _BV(WGM21) | _BV(WGM20);
+	TCCR2B = _BV(CS20);
+	OCR2A = 0;
+	OCR2B = 0;
+#if HOIST_COUNT > 1
+	// Hoist 2 on timer3, 8 bit fast PWM at the same rate, OC3B
+	TCCR3A = _BV(WGM30);
+	TCCR3B = _BV(WGM32) | _BV(CS30);
+	OCR3BH = 0;
+	OCR3BL = 0;
+#endif // HOIST_COUNT
+	for (n = 0; n < HOIST_COUNT; n++) {
+		ramps[n].level = 0;
+		ramps[n].target = 0;
+		*pinmap[n].tport &= (uint8_t) ~ pinmap[n].throttle;
+	}
+}
+
+void throttle_ramp(uint8_t duty, uint16_t ticks)
+{
+	ramp->target = duty;
+	if (ticks) {
+		ramp->rate = (uint16_t) ((THROTTLE_FULL << 8) / ticks);
+		if (ramp->rate == 0) {
+			ramp->rate = 1U;
+		}
+	} else {
+		// no ramp, step directly to duty
+		ramp->rate = 0xffffU;
+	}
+	throttle_update();
+}
+
+void throttle_update(void)
+{
+	uint16_t goal = (uint16_t) (ramp->target << 8);
+	uint16_t level = ramp->level;
+	if (level < goal) {
+		if (goal - level > ramp->rate) {
+			level = (uint16_t) (level + ramp->rate);
+		} else {
+			level = goal;
+		}
+	} else if (level > goal) {
+		if (level - goal > ramp->rate) {
+			level = (uint16_t) (level - ramp->rate);
+		} else {
+			level = goal;
+		}
+	}
+	ramp->level = level;
+	throttle_output();
+}
+
+uint8_t throttle_off(void)
+{
+	return ramp->level == 0;
+}
+
+uint8_t throttle_full(void)
+{
+	return (uint8_t) (ramp->level >> 8) == THROTTLE_FULL;
+}
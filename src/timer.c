@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include "system.h"
+#include "timer.h"
+
+#define TIMER_NONE	0xffU
+
+// Pending deadlines are kept in a list sorted by time remaining
+struct timer_list {
+	uint32_t deadline[timer_count];
+	timer_callback callback[timer_count];
+	uint8_t next[timer_count];
+	uint8_t head;
+};
+
+static struct timer_list timers[HOIST_COUNT] = {
+	{.head = TIMER_NONE },
+#if HOIST_COUNT > 1
+	{.head = TIMER_NONE },
+#endif // HOIST_COUNT
+};
+
+// Deadlines of the selected hoist
+static struct timer_list *tl = &timers[0];
+
+void timer_select(uint8_t n)
+{
+	tl = &timers[n];
+}
+
+// Remove id from the pending list
+void timer_cancel(uint8_t id)
+{
+	uint8_t *link = &tl->head;
+	while (*link != TIMER_NONE) {
+		if (*link == id) {
+			*link = tl->next[id];
+			break;
+		}
+		link = &tl->next[*link];
+	}
+}
+
+void timer_cancel_all(void)
+{
+	tl->head = TIMER_NONE;
+}
+
+void timer_arm(uint8_t id, uint32_t delay, timer_callback fn)
+{
+	uint8_t *link = &tl->head;
+	timer_cancel(id);
+	tl->deadline[id] = feed->clock + delay;
+	tl->callback[id] = fn;
+	while (*link != TIMER_NONE) {
+		if (tl->deadline[*link] - feed->clock > delay) {
+			break;
+		}
+		link = &tl->next[*link];
+	}
+	tl->next[id] = *link;
+	*link = id;
+}
+
+void timer_poll(void)
+{
+	uint8_t id;
+	while (tl->head != TIMER_NONE) {
+		id = tl->head;
+		if ((int32_t) (feed->clock - tl->deadline[id]) < 0) {
+			break;
+		}
+		// unlink before callback, which may re-arm
+		tl->head = tl->next[id];
+		tl->callback[id]();
+	}
+}
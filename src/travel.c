@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include "system.h"
+#include "travel.h"
+
+struct travel travels[HOIST_COUNT];
+struct travel *travel = &travels[0];
+
+static uint8_t move_volts(void)
+{
+	if (travel->volts) {
+		return travel->volts;
+	}
+	return TRAVEL_VREF;
+}
+
+static uint16_t clamp(uint32_t ticks)
+{
+	if (ticks > 0xffffU) {
+		return 0xffffU;
+	}
+	return (uint16_t) ticks;
+}
+
+uint16_t travel_norm(uint16_t ticks)
+{
+	return clamp((uint32_t) ticks * move_volts() / TRAVEL_VREF);
+}
+
+// Scale reference ticks to travel->volts
+static uint16_t actual(uint16_t ticks)
+{
+	return clamp((uint32_t) ticks * TRAVEL_VREF / move_volts());
+}
+
+uint16_t travel_p1(uint16_t fixed)
+{
+	if (!travel->up) {
+		return fixed;
+	}
+	return actual(travel->down);
+}
+
+uint16_t travel_home(void)
+{
+	if (!travel->up || !travel->known || !travel->lowered) {
+		return 0;
+	}
+	return actual(clamp((uint32_t) travel->lowered * travel->up
+			    / travel->down));
+}
+
+uint8_t travel_learn(uint16_t raised)
+{
+	uint16_t up = travel_norm(raised);
+	uint16_t down;
+	if (!travel->up || !up) {
+		return 0;
+	}
+	// lowering time that would have reached P1, if raise speed holds
+	down = clamp((uint32_t) travel->lowered * travel->up / up);
+	if (down < (travel->down >> 1) || down > (uint32_t) travel->down << 1) {
+		return 0;
+	}
+	if (down > travel->down) {
+		down = (uint16_t) (travel->down
+				   + ((down - travel->down) >> TRAVEL_GAIN));
+	} else {
+		down = (uint16_t) (travel->down
+				   - ((travel->down - down) >> TRAVEL_GAIN));
+	}
+	if (down != travel->down) {
+		travel->down = down;
+		save_hoist(NVM_DOWN, travel->down);
+	}
+	return 1U;
+}
+
+void travel_calibrate(uint16_t raised)
+{
+	travel->up = travel_norm(raised);
+	travel->down = travel->lowered;
+	if (!travel->up || !travel->down) {
+		travel_clear();
+		return;
+	}
+	save_hoist(NVM_UP, travel->up);
+	save_hoist(NVM_DOWN, travel->down);
+	save_hoist(NVM_TRAVELKEY, TRAVEL_KEYVAL);
+}
+
+void travel_clear(void)
+{
+	travel->up = 0;
+	travel->down = 0;
+	save_hoist(NVM_TRAVELKEY, 0);
+}
+
+void travel_init(void)
+{
+	if (read_hoist(NVM_TRAVELKEY) == TRAVEL_KEYVAL) {
+		travel->up = read_hoist(NVM_UP);
+		travel->down = read_hoist(NVM_DOWN);
+		if (!travel->down) {
+			travel->up = 0;
+		}
+	}
+}
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Persistent wear and usage counters
+ *
+ * Counters are kept in RAM and mirrored to EEPROM in batches. A
+ * batch is due an hour after the first change, or at once on a
+ * return home, an error or a reset. The main loop then compares the
+ * records byte by byte with EEPROM and starts one changed byte write
+ * per pass while EEPROM is idle, so the write completes in the
+ * background and a batch costs one write per byte that changed.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include "system.h"
+#include "wear.h"
+
+#define WEAR_WORDS	(sizeof(struct wear) / 2U)
+#define BOOT_WORDS	(sizeof(struct wear_boot) / 2U)
+#define IMAGE_BYTES	(2U * (HOIST_COUNT * WEAR_WORDS + BOOT_WORDS))
+
+struct wear wears[HOIST_COUNT];
+struct wear_boot wear_boot;
+
+static uint8_t dirty;		// counters changed since the last batch
+static uint8_t due;		// batch under way
+static uint32_t age;		// ticks since the first change
+static uint8_t cursor;		// next image byte to compare
+
+static void saturate(uint16_t * count)
+{
+	if (*count != 0xffffU) {
+		++*count;
+	}
+}
+
+// EEPROM address of hoist n's record
+static uint16_t record_addr(uint8_t n)
+{
+	return (uint16_t) (NVM_WEAR - n * NVM_HOISTLEN);
+}
+
+// Locate image byte k in RAM and EEPROM
+static const uint8_t *image_byte(uint8_t k, uint16_t *addr)
+{
+	uint8_t n = (uint8_t) (k / (2U * WEAR_WORDS));
+	if (n < HOIST_COUNT) {
+		k = (uint8_t) (k - n * 2U * WEAR_WORDS);
+		*addr = (uint16_t) (record_addr(n) + k);
+		return (const uint8_t *) &wears[n] + k;
+	}
+	k = (uint8_t) (k - HOIST_COUNT * 2U * WEAR_WORDS);
+	*addr = (uint16_t) (NVM_WEARBOOT + k);
+	return (const uint8_t *) &wear_boot + k;
+}
+
+// Copy a record from EEPROM, or clear it if never written
+static void load_record(void *rec, uint16_t addr, uint8_t words)
+{
+	uint8_t *dst = rec;
+	uint16_t val;
+	uint8_t i;
+	for (i = 0; i < words; i++) {
+		val = read_word((uint16_t) (addr + 2U * i));
+		memcpy(dst + 2U * i, &val, 2U);
+	}
+	if (*(uint16_t *) rec != WEAR_KEYVAL) {
+		memset(rec, 0, 2U * words);
+		*(uint16_t *) rec = WEAR_KEYVAL;
+		due = 1U;
+	}
+}
+
+static void changed(void)
+{
+	dirty = 1U;
+}
+
+// Start a batch now, from the first word so nothing is missed
+static void flush(void)
+{
+	dirty = 1U;
+	due = 1U;
+	cursor = 0;
+}
+
+void wear_init(void)
+{
+	uint8_t n;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		load_record(&wears[n], record_addr(n), WEAR_WORDS);
+		if (wears[n].next >= WEAR_WINDOW) {
+			wears[n].next = 0;
+		}
+	}
+	load_record(&wear_boot, NVM_WEARBOOT, BOOT_WORDS);
+}
+
+void wear_update(void)
+{
+	uint8_t n;
+	uint8_t out;
+	for (n = 0; n < HOIST_COUNT; n++) {
+		out = *pinmap[n].port;
+		if (out & pinmap[n].pwr) {
+			if (out & pinmap[n].fwd) {
+				++wears[n].down;
+				changed();
+			} else if (out & pinmap[n].rev) {
+				++wears[n].up;
+				changed();
+			}
+		}
+	}
+	if (dirty && !due && ++age >= WEAR_FLUSH) {
+		due = 1U;
+	}
+}
+
+void wear_poll(void)
+{
+	const uint8_t *src;
+	uint16_t addr;
+	if (!due || (EECR & _BV(EEPE))) {
+		// previous byte still being written
+		return;
+	}
+	if (!cursor) {
+		// changes from here on wait for the next batch
+		dirty = 0;
+		age = 0;
+	}
+	while (cursor < IMAGE_BYTES) {
+		src = image_byte(cursor, &addr);
+		++cursor;
+		if (read_byte(addr) != *src) {
+			write_byte(addr, *src);
+			return;
+		}
+	}
+	cursor = 0;
+	due = 0;
+}
+
+void wear_reset(uint8_t cause)
+{
+	uint8_t n;
+	if (cause & _BV(WDRF)) {
+		n = wear_watchdog;
+	} else if (cause & _BV(BORF)) {
+		n = wear_brownout;
+	} else if (cause & _BV(EXTRF)) {
+		n = wear_external;
+	} else if (cause & _BV(PORF)) {
+		n = wear_poweron;
+	} else {
+		return;
+	}
+	saturate(&wear_boot.resets[n]);
+	flush();
+}
+
+void wear_error(uint8_t cause)
+{
+	saturate(&wears[unit].errors[cause]);
+	flush();
+}
+
+void wear_home(uint16_t ticks, uint8_t timed)
+{
+	struct wear *w = &wears[unit];
+	saturate(&w->lifts);
+	if (timed && ticks) {
+		w->returns[w->next] = ticks;
+		w->next = (uint16_t) ((w->next + 1U) % WEAR_WINDOW);
+	}
+	flush();
+}
+
+uint16_t wear_min(void)
+{
+	uint16_t min = 0;
+	uint8_t i;
+	for (i = 0; i < WEAR_WINDOW; i++) {
+		if (wears[unit].returns[i]
+		    && (!min || wears[unit].returns[i] < min)) {
+			min = wears[unit].returns[i];
+		}
+	}
+	return min;
+}
+
+uint16_t wear_mean(void)
+{
+	uint32_t sum = 0;
+	uint8_t count = 0;
+	uint8_t i;
+	for (i = 0; i < WEAR_WINDOW; i++) {
+		if (wears[unit].returns[i]) {
+			sum += wears[unit].returns[i];
+			++count;
+		}
+	}
+	if (!count) {
+		return 0;
+	}
+	return (uint16_t) ((sum + count / 2U) / count);
+}
+
+uint16_t wear_max(void)
+{
+	uint16_t max = 0;
+	uint8_t i;
+	for (i = 0; i < WEAR_WINDOW; i++) {
+		if (wears[unit].returns[i] > max) {
+			max = wears[unit].returns[i];
+		}
+	}
+	return max;
+}
@@ -7,7 +7,7 @@ Bluetooth Config tool for Hay Hoist
 Usage: blehhconfig [-v]
 
 """
-__version__ = '1.0.0'
+__version__ = '1.1.0'
 
 import os
 import sys
@@ -22,6 +22,8 @@ import threading
 import queue
 import logging
 import asyncio
+from collections import deque
+from time import monotonic
 from bleak import BleakClient, BleakScanner
 
 _log = logging.getLogger('blehhconfig')
@@ -37,6 +39,8 @@ _BLE_MID = 0xffff  # TBC BLE Manufactuter ID
 _CHARGEDVOLTS = 13.2  # Low charge state threshold
 _LOWVOLTS = 11.8  # Low voltage threshold, Remootio access is disabled
 _BLE_READTIME = 2.0  # timeout for command response
+_BLE_MTU = 23  # Default ATT MTU, payload is 3 bytes less
+_BLE_WINDOW = 128  # Maximum unanswered command bytes, half hoist rx buffer
 _BLE_SCANTIME = 5.0  # maximum scan time
 _BLE_CNAMELEN = 6  # Maximum valid encoded CNAME length
 _BLE_PINMAX = 999999  # Maximum BLE PIN
@@ -296,7 +300,7 @@ class BleConsole(threading.Thread):
         threading.Thread.__init__(self, daemon=False)
         self._stopscan = asyncio.Event()
         self._startscan = asyncio.Event()
-        self._resp = asyncio.Event()
+        self._pending = deque()
         self._acn = 0
         self._sreq = 0
         self._portbuf = bytearray()
@@ -319,12 +323,67 @@ class BleConsole(threading.Thread):
         await self._portdev.write_gatt_char(char, val, True)
         await self._message('Updated %s OK' % (label, ))
 
-    async def _waitresp(self):
-        """Wait for a response from connected hoist"""
-        try:
-            await asyncio.wait_for(self._resp.wait(), timeout=_BLE_READTIME)
-        except TimeoutError:
-            _log.debug('Response timeout')
+    def _expect(self, prefix, cmd):
+        """Return a future completed by the reply line starting prefix"""
+        fut = self._loop.create_future()
+        self._pending.append((prefix, fut, cmd, monotonic()))
+        return fut
+
+    def _match(self, line):
+        """Complete the oldest outstanding command answered by line"""
+        for p in self._pending:
+            if line.startswith(p[0]):
+                self._pending.remove(p)
+                if not p[1].done():
+                    p[1].set_result(line)
+                _log.debug('RTT %r: %0.1f ms', p[2],
+                           1000.0 * (monotonic() - p[3]))
+                break
+
+    def _failpending(self):
+        """Release all commands waiting on a reply"""
+        while self._pending:
+            p = self._pending.popleft()
+            if not p[1].done():
+                p[1].cancel()
+
+    async def _waitresp(self, futs):
+        """Wait for replies to futs from connected hoist"""
+        if futs:
+            done, notdone = await asyncio.wait(futs, timeout=_BLE_READTIME)
+            if notdone:
+                _log.debug('Response timeout on %d commands', len(notdone))
+                for p in [p for p in self._pending if p[1] in notdone]:
+                    self._pending.remove(p)
+                    p[1].cancel()
+
+    async def _sendcmds(self, cmds):
+        """Write (cmd, reply prefix) pairs coalesced into MTU sized writes"""
+        if self._portdev is None:
+            return
+        mtu = max(_BLE_MTU, self._portdev.mtu_size) - 3
+        futs = []
+        buf = bytearray()
+        unanswered = 0
+        for cmd, expect in cmds:
+            if buf and len(buf) + len(cmd) > mtu:
+                await self._send(bytes(buf))
+                buf.clear()
+            if unanswered + len(cmd) > _BLE_WINDOW:
+                # let the hoist catch up before overrunning its input
+                if buf:
+                    await self._send(bytes(buf))
+                    buf.clear()
+                await self._waitresp(futs)
+                futs = []
+                unanswered = 0
+            buf.extend(cmd)
+            unanswered += len(cmd)
+            if expect is not None:
+                futs.append(self._expect(expect, cmd))
+        if buf:
+            await self._send(bytes(buf))
+        await self._waitresp(futs)
 
     async def _blescan_cb(self, device=None, adv=None):
         """Scanner detection callback"""
@@ -388,35 +447,40 @@ class BleConsole(threading.Thread):
         self._acn = acn
         if self.connected() and self.configured():
             cmd = 'p' + str(acn) + '\r\n'
-            await self._send(cmd.encode('ascii', 'ignore'))
-            await self._waitresp()
+            await self._sendcmds(((cmd.encode('ascii', 'ignore'), 'PIN = '), ))
 
     async def _update(self, cfg):
+        cmds = []
         for k in cfg:
             cmd = _CFGKEYS[k] + str(cfg[k]) + '\r\n'
-            await self._send(cmd.encode('ascii', 'ignore'))
-            await self._waitresp()
+            cmds.append((cmd.encode('ascii', 'ignore'), k + ' = '))
+        await self._sendcmds(cmds)
 
-    async def _discard(self, data=None):
-        """Send hello prompt"""
-        await self._send(b' ')
+    def _authcmd(self):
+        cmd = '\x10' + str(self._acn) + '\r\n'
+        return (cmd.encode('ascii', 'ignore'), 'OK')
+
+    async def _hello(self, data=None):
+        """Send hello, ACN, values and status requests in one write"""
+        await self._sendcmds((
+            (b' ', None),
+            self._authcmd(),
+            (b'v', 'Values:'),
+            (b's', 'State:'),
+        ))
 
     async def _auth(self, data=None):
         """Send console ACN"""
-        cmd = '\x10' + str(self._acn) + '\r\n'
-        await self._send(cmd.encode('ascii', 'ignore'))
-        await self._waitresp()
+        await self._sendcmds((self._authcmd(), ))
 
     async def _status(self, data=None):
-        await self._send(b's')
-        await self._waitresp()
+        await self._sendcmds(((b's', 'State:'), ))
         if self._sreq > _ERRCOUNT:
             _log.debug('No response to status request, closing device')
             await self._disconnect()
 
     async def _getvalues(self, data=None):
-        await self._send(b'v')
-        await self._waitresp()
+        await self._sendcmds(((b'v', 'Values:'), ))
 
     async def _setvalue(self, key, value):
         """Response from BLE to PC"""
@@ -441,21 +505,18 @@ class BleConsole(threading.Thread):
 
     async def _down(self, data=None):
         if self.connected():
-            await self._send(b'd')
-            await self._waitresp()
+            await self._sendcmds(((b'd', 'Trigger:'), ))
 
     async def _up(self, data=None):
         if self.connected():
-            await self._send(b'u')
-            await self._waitresp()
+            await self._sendcmds(((b'u', 'Trigger:'), ))
 
     async def _send(self, buf):
         if self._portdev is not None:
             _log.debug('SEND: %r', buf)
-            self._resp.clear()
             await self._portdev.write_gatt_char(_TX_UUID, buf, False)
         else:
-            self._resp.set()
+            self._failpending()
 
     def _splitstate(self, smsg):
         """Return the content of a status message"""
@@ -486,6 +547,7 @@ class BleConsole(threading.Thread):
             return False
         docb = False
         wasconfigured = self.configured()
+        self._match(line)
         if line.startswith('State:'):
             self._sreq = 0
             statmsg = line.split(': ', maxsplit=1)[1].strip()
@@ -533,14 +595,17 @@ class BleConsole(threading.Thread):
     async def _notify(self, characteristic, data):
         """Receive bytes from connected hoist"""
         self._portbuf.extend(data)
-        self._resp.set()
+        if b'\n' not in data:
+            return
+        # split all complete lines at once, keep any partial line
+        idx = self._portbuf.rindex(b'\n') + 1
+        rb = self._portbuf[0:idx]
+        del self._portbuf[0:idx]
+        _log.debug('RECV: %r', rb)
         docb = False
-        while b'\n' in self._portbuf:
-            idx = self._portbuf.index(b'\n')
-            _log.debug('RECV: %r', self._portbuf[0:idx + 1])
-            l = self._portbuf[0:idx + 1].decode('ascii', 'ignore').strip()
-            del self._portbuf[0:idx + 1]
-            docb = await self._readresponse(l)
+        for l in rb.decode('ascii', 'ignore').split('\n'):
+            if await self._readresponse(l.strip()):
+                docb = True
         if docb:
             self.cb()
 
@@ -549,7 +614,7 @@ class BleConsole(threading.Thread):
         if not self.inproc():
             _log.debug('Unexpected client disconnect')
             self.flush()  # clear any pending requests
-            self._resp.set()  # terminate a pending read request
+            self._failpending()  # terminate pending read requests
             self._cqueue.put_nowait(('_disconnect', None))
 
     async def _connect(self):
@@ -559,7 +624,7 @@ class BleConsole(threading.Thread):
             return True
         if self.portdev is not None:
             self._portinproc = True
-            self._resp.set()
+            self._failpending()
             self._startscan.clear()
             self._stopscan.set()
             self._portdev = BleakClient(
@@ -624,10 +689,7 @@ class BleConsole(threading.Thread):
                 self.cfg = {}
                 self._cqueue.put_nowait(('_getblecname', None))
                 self._cqueue.put_nowait(('_getblefwver', None))
-                self._cqueue.put_nowait(('_discard', None))
-                self._cqueue.put_nowait(('_auth', None))
-                self._cqueue.put_nowait(('_getvalues', None))
-                self._cqueue.put_nowait(('_status', None))
+                self._cqueue.put_nowait(('_hello', None))
                 self._equeue.put((
                     'connect',
                     None,
@@ -652,7 +714,7 @@ class BleConsole(threading.Thread):
     async def _doclose(self):
         """Close bleak client ignoring exceptions"""
         try:
-            self._resp.set()  # terminate a pending read request
+            self._failpending()  # terminate pending read requests
             await self._portdev.disconnect()
         except Exception as e:
             _log.debug('%s closing client: %s', e.__class__.__name__, e)
@@ -1292,7 +1354,7 @@ class HHConfig:
     def _endp1measure(self, clock):
         self.mstate = 'P1END'
         if self.measurestart is not None:
-            elap = (clock - self.measurestart) & 0xffff
+            elap = (clock - self.measurestart) & 0xffffffff
             _log.debug('End P1 measure at %d: dt = %d', clock, elap)
             oldp2 = self.uval['P1-P2']
             oldtot = self.oldp1 + oldp2
@@ -1312,7 +1374,7 @@ class HHConfig:
         self.mstate = 'P2END'
         if self.measurestart is not None:
             result = 'Error'
-            elap = (clock - self.measurestart) & 0xffff
+            elap = (clock - self.measurestart) & 0xffffffff
             _log.debug('End P2 measure at %d: dt = %d', clock, elap)
             p2tot = elap
             # restore H-P1
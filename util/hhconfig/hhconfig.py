@@ -4,13 +4,27 @@
 
 Crude TK Graphical front-end for Hay Hoist serial console
 
+Update firmware over the console with the serial bootloader:
+
+	$ hhconfig --upload remootio-adapter.hex --port /dev/ttyUSB0 --acn 1234
+
+Provision many hoists concurrently from a saved config file:
+
+	$ hhconfig --provision hhconfig.json --acn 1234 /dev/ttyUSB0 /dev/ttyUSB1
+
+Record console output to a telemetry log while the GUI is running:
+
+	$ hhconfig --record hoist.hhl
+
 """
-__version__ = '1.2.0'
+__version__ = '1.4.0'
 
 import os
 import re
 import sys
 import json
+import zlib
+import struct
 from serial import Serial
 from tkinter import *
 from tkinter import filedialog
@@ -18,8 +32,12 @@ from tkinter import ttk
 from base64 import b64decode
 import threading
 import queue
+from collections import deque
 import logging
-from time import sleep
+import argparse
+from concurrent.futures import ThreadPoolExecutor
+from binascii import crc_hqx
+from time import sleep, monotonic, time
 
 _log = logging.getLogger('hhconfig')
 _log.setLevel(logging.WARNING)
@@ -46,6 +64,17 @@ home position after this many minutes (0 = disabled)'
 _HELP_FEEDWEEK = 'Feeds/week: Schedule this many randomly spaced \
 feeds per week (0 = disabled)'
 
+_HELP_ACCEL = 'Accel: Time in seconds to ramp throttle from \
+stop to full speed (0 = off, v25004)'
+
+_HELP_DECEL = 'Decel: Time in seconds to ramp throttle from \
+full speed to stop at P1 and P2 (0 = off, v25004)'
+
+_HELP_APPROACH = 'Approach: Raise at slow speed for this many \
+seconds before reaching home (0 = off, v25004)'
+
+_HELP_SLOW = 'Slow: Throttle percent for slow approach to home (v25004)'
+
 _HELP_DOWN = 'Send down command to connected hoist'
 _HELP_UP = 'Send up command to connected hoist'
 _HELP_LOAD = 'Load configuration values from file and update connected hoist'
@@ -56,8 +85,17 @@ Source: https://pypi.org/project/hhconfig/\nSupport: https://hyspec.com.au/'
 _HELP_PORT = 'Hoist device, select to re-connect'
 _HELP_STAT = 'Current status of connected hoist'
 _HELP_FIRMWARE = 'Firmware version of connected hoist'
+_HELP_WEAR = 'Chart recent return home times and show wear counters \
+of connected hoist (v25004)'
 _VER_ACN = 25001
 _VER_RETRY = 25001
+_VER_THROTTLE = 25004
+_VER_WEAR = 25004
+_WEARERRORS = ('Sensor', 'Fault', 'Tangle', 'Timeout', 'Stall',
+               'Sag')
+_WEARRESETS = ('Watchdog', 'Brown-out', 'External', 'Power on')
+_CHARTW = 360  # Wear chart size in pixels
+_CHARTH = 180
 _SERPOLL = 0.2
 _DEVPOLL = 3000
 _ERRCOUNT = 2  # Tolerate two missed status before dropping connection
@@ -65,6 +103,27 @@ _DEVRETRY = 2  # If devpoll gets stuck waiting for status, restart
 _BAUDRATE = 19200
 _READLEN = 512
 _CFG_LEN = 8  # Number of required config elements for full connection
+_INFLIGHT = 4  # Maximum console commands awaiting a reply
+_RTTLIMIT = 2.0  # Abandon reply to a console command after this many seconds
+_BOOT_INFO = 0x49  # Serial bootloader protocol, refer include/boot.h
+_BOOT_PAGE = 0x50
+_BOOT_RLE = 0x5a
+_BOOT_DONE = 0x44
+_BOOT_OK = b'.'
+_BOOT_RETRIES = 5
+_BOOT_TIMEOUT = 0.5
+_BOOT_SYNC = 5.0  # Seconds to wait for bootloader after request
+_PROVIDLE = 0.1  # Provisioning reply is complete after this idle time
+_PROVREPLY = 1.0  # Maximum wait for first byte of provisioning reply
+_LOGMAGIC = b'HHL1'  # Telemetry log block header
+_LOGBLOCK = 512  # Maximum records per log block
+_LOGFLUSH = 60.0  # Write a partial log block after this many seconds
+_LOG_TEXT = 0  # Telemetry record kinds
+_LOG_STATE = 1
+_LOG_TRIGGER = 2
+_LOG_VALUE = 3
+_STATERE = re.compile(
+    r'State: (\[[^\]]*\])( \[Error\])?(?: Batt: ([0-9.]+)V)?(?: @(\d+))?')
 _CFGKEYS = {
     'H-P1': '1',
     'P1-P2': '2',
@@ -73,7 +132,17 @@ _CFGKEYS = {
     'H-Retry': 'r',
     'Feed': 'f',
     'Feeds/week': 'n',
+    'Accel': 'a',
+    'Decel': 'b',
+    'Approach': 'z',
+    'Slow': 'l',
 }
+_THROTTLEKEYS = (
+    'Accel',
+    'Decel',
+    'Approach',
+    'Slow',
+)
 _SPINKEYS = (
     'H-P1',
     'P1-P2',
@@ -84,10 +153,19 @@ _TIMEKEYS = (
     'Man',
     'H',
     'H-Retry',
+    'Accel',
+    'Decel',
+    'Approach',
+)
+_ZEROKEYS = (
+    'Accel',
+    'Decel',
+    'Approach',
 )
 _INTKEYS = (
     'Feed',
     'Feeds/week',
+    'Slow',
 )
 _KEYSUBS = {
     '1': 'H-P1',
@@ -106,6 +184,10 @@ _KEYSUBS = {
     'n': 'Feeds/week',
     'r': 'H-Retry',
     'p': 'ACN',
+    'a': 'Accel',
+    'b': 'Decel',
+    'z': 'Approach',
+    'l': 'Slow',
 }
 
 _LOGODATA = b64decode(b'\
@@ -206,6 +288,204 @@ def _mkopt(parent,
     return svar, ent
 
 
+def _wearvalues(block):
+    """Return wear counters from the lines of a console Wear block"""
+    wear = {}
+    for k, v in block.items():
+        try:
+            if k == 'Returns':
+                wear[k] = [int(r) for r in v.split()]
+            else:
+                wear[k] = int(v)
+        except ValueError:
+            _log.debug('Ignored wear value %r = %r', k, v)
+    return wear
+
+
+def _logrecord(when, line):
+    """Return a telemetry record for one console line
+
+    Records are tuples: host time (ms), kind, symbol, device clock or
+    None, battery decivolts or 0, error flag, value.
+    """
+    ms = int(when * 1000)
+    m = _STATERE.match(line)
+    if m is not None:
+        volts = 0
+        if m.group(3):
+            volts = int(round(float(m.group(3)) * 10))
+        clock = int(m.group(4)) if m.group(4) else None
+        return (ms, _LOG_STATE, m.group(1), clock, volts, 1 if m.group(2)
+                else 0, 0)
+    if line.startswith('Trigger: '):
+        return (ms, _LOG_TRIGGER, line[9:].strip(), None, 0, 0, 0)
+    lv = line.split(' = ', maxsplit=1)
+    if len(lv) == 2 and lv[1].strip().isdigit():
+        return (ms, _LOG_VALUE, _subkey(lv[0].strip()), None, 0, 0,
+                int(lv[1]))
+    return (ms, _LOG_TEXT, line, None, 0, 0, 0)
+
+
+def _varints(vals):
+    """Return unsigned LEB128 encoding of vals"""
+    out = bytearray()
+    for v in vals:
+        while v > 0x7f:
+            out.append(0x80 | (v & 0x7f))
+            v >>= 7
+        out.append(v)
+    return out
+
+
+def _unvarints(buf, oft, count):
+    """Decode count varints from buf at oft, return values, new oft"""
+    vals = []
+    for i in range(0, count):
+        v = 0
+        shift = 0
+        while True:
+            b = buf[oft]
+            oft += 1
+            v |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        vals.append(v)
+    return vals, oft
+
+
+def _zigzag(v):
+    return (v << 1) if v >= 0 else ((-v << 1) - 1)
+
+
+def _unzigzag(v):
+    return (v >> 1) if not v & 1 else -((v + 1) >> 1)
+
+
+def _logblock(recs):
+    """Encode records as one compressed columnar log block
+
+    Columns: zigzag time deltas, kinds, symbol indexes into a block string
+    table, clock deltas (0 = none, else zigzag + 1), decivolts, error
+    flags and zigzag values, each as a varint run.
+    """
+    syms = {}
+    symcol = []
+    for r in recs:
+        symcol.append(syms.setdefault(r[2], len(syms)))
+    tcol = []
+    ccol = []
+    last = recs[0][0]
+    lastclock = 0
+    for r in recs:
+        tcol.append(_zigzag(r[0] - last))
+        last = r[0]
+        if r[3] is None:
+            ccol.append(0)
+        else:
+            ccol.append(_zigzag(r[3] - lastclock) + 1)
+            lastclock = r[3]
+    body = _varints((len(recs), recs[0][0], len(syms)))
+    for sym in syms:
+        sb = sym.encode('utf-8')
+        body += _varints((len(sb), ))
+        body += sb
+    body += _varints(tcol)
+    body += bytes(r[1] for r in recs)
+    body += _varints(symcol)
+    body += _varints(ccol)
+    body += bytes(min(r[4], 0xff) for r in recs)
+    body += bytes(r[5] for r in recs)
+    body += _varints(_zigzag(r[6]) for r in recs)
+    data = zlib.compress(bytes(body), 9)
+    return _LOGMAGIC + struct.pack('<L', len(data)) + data
+
+
+def _readblock(data):
+    """Decode one log block into a list of records"""
+    buf = zlib.decompress(data)
+    (count, base, nsym), oft = _unvarints(buf, 0, 3)
+    syms = []
+    for i in range(0, nsym):
+        (sl, ), oft = _unvarints(buf, oft, 1)
+        syms.append(buf[oft:oft + sl].decode('utf-8', 'replace'))
+        oft += sl
+    tcol, oft = _unvarints(buf, oft, count)
+    kcol = buf[oft:oft + count]
+    oft += count
+    symcol, oft = _unvarints(buf, oft, count)
+    ccol, oft = _unvarints(buf, oft, count)
+    vcol = buf[oft:oft + count]
+    oft += count
+    ecol = buf[oft:oft + count]
+    oft += count
+    valcol, oft = _unvarints(buf, oft, count)
+    recs = []
+    when = base
+    clock = 0
+    for i in range(0, count):
+        when += _unzigzag(tcol[i])
+        c = None
+        if ccol[i]:
+            clock += _unzigzag(ccol[i] - 1)
+            c = clock
+        recs.append((when, kcol[i], syms[symcol[i]], c, vcol[i], ecol[i],
+                     _unzigzag(valcol[i])))
+    return recs
+
+
+def readlog(filename):
+    """Yield telemetry records from log file, skipping a truncated tail"""
+    with open(filename, 'rb') as f:
+        while True:
+            hdr = f.read(8)
+            if len(hdr) < 8 or hdr[0:4] != _LOGMAGIC:
+                break
+            (dlen, ) = struct.unpack('<L', hdr[4:8])
+            data = f.read(dlen)
+            if len(data) < dlen:
+                _log.debug('Truncated log block ignored')
+                break
+            yield from _readblock(data)
+
+
+class Recorder:
+    """Append console lines to a compact columnar telemetry log"""
+
+    def __init__(self, filename):
+        self._file = open(filename, 'ab')
+        self._lock = threading.Lock()
+        self._recs = []
+        self._since = monotonic()
+
+    def line(self, line, when=None):
+        """Record line, received at when (epoch seconds) or now"""
+        if not line:
+            return
+        if when is None:
+            when = time()
+        with self._lock:
+            if self._file.closed:
+                return
+            self._recs.append(_logrecord(when, line))
+            if (len(self._recs) >= _LOGBLOCK
+                    or monotonic() - self._since > _LOGFLUSH):
+                self._flush()
+
+    def _flush(self):
+        if self._recs:
+            self._file.write(_logblock(self._recs))
+            self._file.flush()
+            self._recs = []
+        self._since = monotonic()
+
+    def close(self):
+        with self._lock:
+            if not self._file.closed:
+                self._flush()
+                self._file.close()
+
+
 class SerialConsole(threading.Thread):
     """Serial console command/response wrapper"""
 
@@ -231,6 +511,14 @@ class SerialConsole(threading.Thread):
         """Return true if open or close underway"""
         return self._portinproc or self._closeinproc
 
+    def latency(self):
+        """Return count, mean and max command round trip in seconds"""
+        with self._lock:
+            if self._rttcount:
+                return (self._rttcount, self._rttsum / self._rttcount,
+                        self._rttmax)
+        return (0, 0.0, 0.0)
+
     def clearproc(self):
         """Clear out state to idle condition"""
         self._flush()
@@ -255,6 +543,10 @@ class SerialConsole(threading.Thread):
         """Request up trigger"""
         self._cqueue.put_nowait(('_up', data))
 
+    def wear(self, data=None):
+        """Request wear counters"""
+        self._cqueue.put_nowait(('_wear', data))
+
     def exit(self):
         """Request thread termination"""
         self._running = False
@@ -273,6 +565,10 @@ class SerialConsole(threading.Thread):
     def setacn(self, acn):
         self._acn = acn
 
+    def record(self, filename):
+        """Record all received console lines to telemetry log filename"""
+        self.recorder = Recorder(filename)
+
     def __init__(self):
         threading.Thread.__init__(self, daemon=True)
         self._acn = 0
@@ -286,76 +582,110 @@ class SerialConsole(threading.Thread):
         self._closeinproc = False
         self.cb = self._defcallback
         self.cfg = None
+        self._lock = threading.Condition()
+        self._pending = deque()
+        self._rttcount = 0
+        self._rttsum = 0.0
+        self._rttmax = 0.0
+        self.recorder = None
+        self._wearblock = None
 
     def run(self):
         """Thread main loop, called by object.start()"""
         self._running = True
         while self._running:
             try:
-                if self.connected():
-                    if self._cqueue.qsize() != 0:
-                        c = self._cqueue.get()
-                    else:
-                        self._readresponse()
-                        c = self._cqueue.get_nowait()
-                else:
-                    c = self._cqueue.get()
+                c = self._cqueue.get()
                 self._cqueue.task_done()
                 self._proccmd(c)
-            except queue.Empty:
-                pass
             except Exception as e:
                 _log.error('console %s: %s', e.__class__.__name__, e)
                 self._close()
 
-    def _send(self, buf):
+    def _expire(self):
+        """Drop outstanding commands which will not be answered"""
+        now = monotonic()
+        while self._pending and now - self._pending[0][2] > _RTTLIMIT:
+            p = self._pending.popleft()
+            _log.debug('No reply to %r', p[1])
+            self._lock.notify_all()
+
+    def _send(self, buf, expect=None):
+        """Write buf, waiting for an in-flight slot if a reply is expected"""
+        if expect is not None:
+            with self._lock:
+                self._expire()
+                while len(self._pending) >= _INFLIGHT:
+                    if self._portdev is None:
+                        return None
+                    self._lock.wait(_SERPOLL)
+                    self._expire()
+                self._pending.append((expect, buf, monotonic()))
         if self._portdev is not None:
             _log.debug('SEND: %r', buf)
             return self._portdev.write(buf)
 
-    def _recv(self, len):
-        rb = b''
-        if self._portdev is not None:
-            while not rb.endswith(b'\r\n'):
-                nb = self._portdev.read(len)
-                if nb == b'':
-                    # timeout
+    def _match(self, line):
+        """Complete the oldest outstanding command answered by line"""
+        with self._lock:
+            for p in self._pending:
+                if line.startswith(p[0]):
+                    self._pending.remove(p)
+                    rtt = monotonic() - p[2]
+                    self._rttcount += 1
+                    self._rttsum += rtt
+                    self._rttmax = max(self._rttmax, rtt)
+                    self._lock.notify_all()
+                    _log.debug('RTT %r: %0.1f ms', p[1], 1000.0 * rtt)
                     break
-                rb = rb + nb
-            if rb:
-                _log.debug('RECV: %r', rb)
-                self._portinproc = False
-        return rb
+
+    def _reader(self, portdev):
+        """Frame lines from portdev and dispatch each as it arrives"""
+        rb = b''
+        try:
+            while self._portdev is portdev:
+                nb = portdev.read(max(1, portdev.in_waiting))
+                if nb:
+                    _log.debug('RECV: %r', nb)
+                    self._portinproc = False
+                    lines = (rb + nb).split(b'\n')
+                    rb = lines.pop()
+                    docb = False
+                    for l in lines:
+                        l = l.decode('ascii', 'ignore').strip()
+                        if self.recorder is not None:
+                            self.recorder.line(l)
+                        if self._readline(l):
+                            docb = True
+                    if docb:
+                        self.cb()
+        except Exception as e:
+            if self._portdev is portdev:
+                _log.error('reader %s: %s', e.__class__.__name__, e)
+                self._cqueue.put_nowait(('_close', None))
 
     def _updateacn(self, acn):
         self._acn = acn
         if self.connected() and self.configured():
             cmd = 'p' + str(acn) + '\r\n'
-            self._send(cmd.encode('ascii', 'ignore'))
-            self._readresponse()
+            self._send(cmd.encode('ascii', 'ignore'), 'PIN = ')
 
     def _update(self, cfg):
         for k in cfg:
             cmd = _CFGKEYS[k] + str(cfg[k]) + '\r\n'
-            self._send(cmd.encode('ascii', 'ignore'))
-            self._readresponse()
+            self._send(cmd.encode('ascii', 'ignore'), k + ' = ')
 
     def _discard(self, data=None):
-        """Send hello/escape sequence and discard any output"""
+        """Send hello/escape sequence, any output is ignored by reader"""
         self._send(b' ')
-        rb = self._recv(_READLEN)
-        _log.debug('HELLO: %r', rb)
 
     def _auth(self, data=None):
         """Send console ACN"""
         cmd = '\x10' + str(self._acn) + '\r\n'
-        self._send(cmd.encode('ascii', 'ignore'))
-        rb = self._recv(_READLEN)
-        _log.debug('AUTH: %r', rb)
+        self._send(cmd.encode('ascii', 'ignore'), 'OK')
 
     def _status(self, data=None):
-        self._send(b's')
-        self._readresponse()
+        self._send(b's', 'State:')
         if self._sreq > _ERRCOUNT:
             _log.debug('No response to status request, closing device')
             self._close()
@@ -381,63 +711,72 @@ class SerialConsole(threading.Thread):
             self._equeue.put(('message', data))
             self.cb()
 
-    def _readresponse(self, data=None):
+    def _readline(self, l):
+        """Dispatch one line of console output, return true if event"""
         docb = False
         wasconfigured = self.configured()
-        rb = self._recv(_READLEN)
-        rv = rb.decode('ascii', 'ignore').strip().split('\n')
-        for line in rv:
-            l = line.strip()
-            if l.startswith('State:'):
-                self._sreq = 0
-                statmsg = l.split(': ', maxsplit=1)[1].strip()
-                self._equeue.put((
-                    'status',
-                    statmsg,
-                ))
-                docb = True
-            elif ':' in l:
-                self._equeue.put(('message', l))
-                docb = True
-                if l.startswith('Trigger:'):
-                    if 'reset' in l:
-                        # re-auth required
-                        self._cqueue.put_nowait(('_auth', None))
-            elif '=' in l:
-                lv = l.split(' = ', maxsplit=1)
-                if len(lv) == 2:
-                    key = _subkey(lv[0].strip())
-                    if key != 'ACN':
-                        self._setvalue(key, lv[1].strip())
-                        docb = True
-                        if self.configured() and not wasconfigured:
-                            self._equeue.put((
-                                'connect',
-                                None,
-                            ))
-                    else:
-                        _log.debug('ACN Updated')
-
+        self._match(l)
+        if self._wearblock is not None:
+            lv = l.split(' = ', maxsplit=1)
+            if len(lv) == 2:
+                self._wearblock[lv[0].strip()] = lv[1].strip()
+                return False
+            self._equeue.put(('wear', _wearvalues(self._wearblock)))
+            self._wearblock = None
+            docb = True
+        if l == 'Wear:':
+            self._wearblock = {}
+        elif l.startswith('State:'):
+            self._sreq = 0
+            statmsg = l.split(': ', maxsplit=1)[1].strip()
+            self._equeue.put((
+                'status',
+                statmsg,
+            ))
+            docb = True
+        elif ':' in l:
+            self._equeue.put(('message', l))
+            docb = True
+            if l.startswith('Trigger:'):
+                if 'reset' in l:
+                    # re-auth required
+                    self._cqueue.put_nowait(('_auth', None))
+        elif '=' in l:
+            lv = l.split(' = ', maxsplit=1)
+            if len(lv) == 2:
+                key = _subkey(lv[0].strip())
+                if key != 'ACN':
+                    self._setvalue(key, lv[1].strip())
+                    docb = True
+                    if self.configured() and not wasconfigured:
+                        self._equeue.put((
+                            'connect',
+                            None,
+                        ))
                 else:
-                    _log.debug('Ignored unexpected response %r', l)
-            elif '?' in l:
-                pass
+                    _log.debug('ACN Updated')
+
             else:
-                if l:
-                    self._equeue.put(('message', l))
-                    docb = True
-        if docb:
-            self.cb()
+                _log.debug('Ignored unexpected response %r', l)
+        elif '?' in l:
+            pass
+        else:
+            if l:
+                self._equeue.put(('message', l))
+                docb = True
+        return docb
 
     def _down(self, data=None):
         if self.connected():
-            self._send(b'd')
-            self._readresponse()
+            self._send(b'd', 'Trigger:')
 
     def _up(self, data=None):
         if self.connected():
-            self._send(b'u')
-            self._readresponse()
+            self._send(b'u', 'Trigger:')
+
+    def _wear(self, data=None):
+        if self.connected():
+            self._send(b'o', 'Wear:')
 
     def _serialopen(self):
         if self._portdev is not None:
@@ -452,11 +791,13 @@ class SerialConsole(threading.Thread):
                                    baudrate=_BAUDRATE,
                                    rtscts=False,
                                    timeout=_SERPOLL)
+            threading.Thread(target=self._reader,
+                             args=(self._portdev, ),
+                             daemon=True).start()
         return self._portdev is not None
 
     def _getvalues(self, data=None):
-        self._send(b'v')
-        self._readresponse()
+        self._send(b'v', 'Values:')
 
     def _port(self, port):
         """Blocking close, followed by blocking open, then queue cmds"""
@@ -487,8 +828,15 @@ class SerialConsole(threading.Thread):
         if self._portdev is not None:
             self._closeinproc = True
             self.cfg = None
-            self._portdev.close()
+            portdev = self._portdev
             self._portdev = None
+            portdev.close()
+            with self._lock:
+                self._pending.clear()
+                self._lock.notify_all()
+            count, mean, worst = self.latency()
+            _log.debug('RTT %d commands: mean %0.1f ms, max %0.1f ms', count,
+                       1000.0 * mean, 1000.0 * worst)
             self._equeue.put((
                 'disconnect',
                 None,
@@ -519,6 +867,339 @@ class SerialConsole(threading.Thread):
         pass
 
 
+def _readhex(filename):
+    """Return flash image from Intel hex file"""
+    image = bytearray()
+    base = 0
+    with open(filename) as f:
+        for l in f:
+            l = l.strip()
+            if not l.startswith(':'):
+                continue
+            rec = bytes.fromhex(l[1:])
+            if sum(rec) & 0xff:
+                raise ValueError('Invalid hex record checksum')
+            count, addr, rtype = rec[0], rec[1] << 8 | rec[2], rec[3]
+            data = rec[4:4 + count]
+            if rtype == 0:
+                oft = base + addr
+                if len(image) < oft + count:
+                    image.extend(b'\xff' * (oft + count - len(image)))
+                image[oft:oft + count] = data
+            elif rtype == 1:
+                break
+            elif rtype == 2:
+                base = (data[0] << 8 | data[1]) << 4
+            elif rtype == 4:
+                base = (data[0] << 8 | data[1]) << 16
+    return image
+
+
+def _rle(page):
+    """Encode page as bootloader run-length tokens"""
+    out = bytearray()
+    lit = bytearray()
+    i = 0
+    while i < len(page):
+        run = 1
+        while i + run < len(page) and page[i + run] == page[i] and run < 128:
+            run += 1
+        if run > 2:
+            if lit:
+                out.append(len(lit) - 1)
+                out.extend(lit)
+                lit.clear()
+            out.append(0x80 | (run - 1))
+            out.append(page[i])
+            i += run
+        else:
+            lit.append(page[i])
+            if len(lit) == 128:
+                out.append(len(lit) - 1)
+                out.extend(lit)
+                lit.clear()
+            i += 1
+    if lit:
+        out.append(len(lit) - 1)
+        out.extend(lit)
+    return bytes(out)
+
+
+class Uploader:
+    """Serial bootloader client"""
+
+    def __init__(self, port, baud=_BAUDRATE, acn=0):
+        self._port = Serial(port=port,
+                            baudrate=baud,
+                            rtscts=False,
+                            timeout=_BOOT_TIMEOUT)
+        self._acn = acn
+        self.pagesize = 0
+        self.pages = 0
+        self.sent = 0
+        self.retries = 0
+
+    def close(self):
+        self._port.close()
+
+    def _frame(self, cmd, payload=b''):
+        buf = bytearray((cmd, len(payload)))
+        buf.extend(payload)
+        crc = crc_hqx(buf, 0xffff)
+        buf.append(crc & 0xff)
+        buf.append(crc >> 8)
+        return bytes(buf)
+
+    def _request(self, cmd, payload=b'', rlen=1):
+        """Send frame, retry until reply of rlen bytes starts ok"""
+        frame = self._frame(cmd, payload)
+        for i in range(0, _BOOT_RETRIES):
+            if i:
+                self.retries += 1
+            self._port.reset_input_buffer()
+            self._port.write(frame)
+            self.sent += len(frame)
+            rb = self._port.read(rlen)
+            _log.debug('BOOT: 0x%02x %d bytes -> %r', cmd, len(payload), rb)
+            if len(rb) == rlen and rb[0:1] in (_BOOT_OK, bytes((cmd, ))):
+                return rb
+        raise RuntimeError('No response to bootloader command 0x%02x' %
+                           (cmd, ))
+
+    def enter(self):
+        """Request bootloader from firmware and wait for sync"""
+        self._port.write(b' ')
+        self._port.write(('\x10' + str(self._acn) + '\r\n').encode('ascii'))
+        sleep(_BOOT_TIMEOUT)
+        self._port.reset_input_buffer()
+        self._port.write(b'w')
+        rb = self._port.read_until(b'\n')
+        _log.debug('ENTER: %r', rb)
+        if b'Not installed' in rb or b'Motor running' in rb:
+            raise RuntimeError(rb.decode('ascii', 'ignore').strip())
+        # Info frame bytes are not console commands if firmware is running
+        end = monotonic() + _BOOT_SYNC
+        while monotonic() < end:
+            self._port.reset_input_buffer()
+            self._port.write(self._frame(_BOOT_INFO))
+            rb = self._port.read(4)
+            if len(rb) == 4 and rb[0] == _BOOT_INFO:
+                self.pagesize = rb[1]
+                self.pages = rb[2]
+                _log.debug('Bootloader v%d: %d pages of %d bytes', rb[3],
+                           self.pages, self.pagesize)
+                return
+        raise RuntimeError('No response from bootloader')
+
+    def upload(self, image, progress=None):
+        """Write image to flash, return transfer summary"""
+        if not self.pagesize:
+            self.enter()
+        count = (len(image) + self.pagesize - 1) // self.pagesize
+        if count > self.pages:
+            raise RuntimeError('Image exceeds application flash')
+        image = bytes(image) + b'\xff' * (count * self.pagesize - len(image))
+        start = monotonic()
+        self.sent = 0
+        for num in range(0, count):
+            page = image[num * self.pagesize:(num + 1) * self.pagesize]
+            packed = _rle(page)
+            if len(packed) < len(page):
+                self._request(_BOOT_RLE, bytes((num, )) + packed)
+            else:
+                self._request(_BOOT_PAGE, bytes((num, )) + page)
+            if progress is not None:
+                progress(num + 1, count)
+        crc = crc_hqx(image, 0xffff)
+        self._request(
+            _BOOT_DONE,
+            bytes((len(image) & 0xff, len(image) >> 8, crc & 0xff,
+                   crc >> 8)))
+        elapsed = monotonic() - start
+        return {
+            'bytes': len(image),
+            'pages': count,
+            'sent': self.sent,
+            'retries': self.retries,
+            'elapsed': elapsed,
+            'rate': len(image) / elapsed,
+        }
+
+
+def upload(filename, port, baud=_BAUDRATE, acn=0):
+    """Update firmware on the hoist at port and report throughput"""
+    image = _readhex(filename)
+    up = Uploader(port, baud, acn)
+    try:
+        up.enter()
+        print('Bootloader: %d pages of %d bytes' % (up.pages, up.pagesize))
+
+        def progress(num, count):
+            print('\rPage %d/%d' % (num, count), end='', flush=True)
+
+        st = up.upload(image, progress)
+        print()
+        print('Wrote %d bytes in %d pages, %0.1fs: %0.0f bytes/s' %
+              (st['bytes'], st['pages'], st['elapsed'], st['rate']))
+        print('Sent %d bytes (%0.0f%% of image), %d retries' %
+              (st['sent'], 100.0 * st['sent'] / st['bytes'], st['retries']))
+    finally:
+        up.close()
+    return 0
+
+
+class Provisioner:
+    """Headless console session to diff, write and verify one hoist"""
+
+    def __init__(self, port, baud=_BAUDRATE, acn=0):
+        self.port = port
+        self._acn = acn
+        self._portdev = Serial(port=port,
+                               baudrate=baud,
+                               rtscts=False,
+                               timeout=_PROVIDLE)
+
+    def close(self):
+        self._portdev.close()
+
+    def _command(self, cmd):
+        """Send cmd and return reply lines once the line goes idle"""
+        _log.debug('%s SEND: %r', self.port, cmd)
+        self._portdev.write(cmd.encode('ascii', 'ignore'))
+        rb = b''
+        end = monotonic() + _PROVREPLY
+        while True:
+            nb = self._portdev.read(_READLEN)
+            if nb:
+                rb += nb
+            elif rb or monotonic() > end:
+                break
+        _log.debug('%s RECV: %r', self.port, rb)
+        return rb.decode('ascii', 'ignore').split('\n')
+
+    def _values(self, lines, cfg):
+        for line in lines:
+            lv = line.strip().split(' = ', maxsplit=1)
+            if len(lv) == 2:
+                key = _subkey(lv[0].strip())
+                if key == 'PIN':
+                    key = 'ACN'
+                if key == 'Firmware':
+                    cfg[key] = lv[1].strip()
+                elif key in _CFGKEYS or key == 'ACN':
+                    try:
+                        cfg[key] = int(lv[1])
+                    except ValueError:
+                        pass
+        return cfg
+
+    def auth(self):
+        self._portdev.write(b' ')
+        for line in self._command('\x10' + str(self._acn) + '\r\n'):
+            if line.strip() == 'OK':
+                return True
+        return False
+
+    def read(self):
+        """Return current device values, including ACN"""
+        cfg = self._values(self._command('v'), {})
+        return self._values(self._command('p\r\n'), cfg)
+
+    def write(self, key, value):
+        if key == 'ACN':
+            cmd = 'p' + str(value) + '\r\n'
+        else:
+            cmd = _CFGKEYS[key] + str(value) + '\r\n'
+        self._command(cmd)
+
+
+def _provision_one(port, target, baud, acn):
+    """Provision target onto hoist at port, return result summary"""
+    res = {
+        'port': port,
+        'result': 'error',
+        'firmware': '',
+        'written': [],
+        'skipped': [],
+        'failed': [],
+        'elapsed': 0.0,
+    }
+    start = monotonic()
+    dev = None
+    try:
+        dev = Provisioner(port, baud, acn)
+        if not dev.auth():
+            res['result'] = 'no auth'
+            return res
+        current = dev.read()
+        res['firmware'] = current.get('Firmware', '')
+        for k in target:
+            if k not in current:
+                # value not supported by this firmware
+                res['skipped'].append(k)
+            elif current[k] != target[k]:
+                dev.write(k, target[k])
+                res['written'].append(k)
+        if res['written']:
+            check = dev.read()
+            for k in res['written']:
+                if check.get(k) != target[k]:
+                    res['failed'].append(k)
+        res['result'] = 'failed' if res['failed'] else 'ok'
+    except Exception as e:
+        _log.debug('%s %s: %s', port, e.__class__.__name__, e)
+        res['result'] = e.__class__.__name__
+    finally:
+        if dev is not None:
+            dev.close()
+        res['elapsed'] = monotonic() - start
+    return res
+
+
+def _loadtarget(filename):
+    """Return provisioning target from a saved config file"""
+    with open(filename) as f:
+        cfg = json.load(f)
+    if not isinstance(cfg, dict):
+        raise ValueError('Invalid config file')
+    target = {}
+    for key in cfg:
+        k = _subkey(key)
+        if (k in _CFGKEYS or k == 'ACN') and isinstance(cfg[key], int):
+            target[k] = cfg[key]
+        else:
+            _log.debug('Ignored invalid config key %r', key)
+    if not target.get('ACN'):
+        # an unset ACN in the file leaves device ACN unchanged
+        target.pop('ACN', None)
+    return target
+
+
+def provision(filename, ports, baud=_BAUDRATE, acn=0):
+    """Provision all ports concurrently and print a per-unit report"""
+    target = _loadtarget(filename)
+    start = monotonic()
+    with ThreadPoolExecutor(max_workers=len(ports)) as pool:
+        results = list(
+            pool.map(lambda p: _provision_one(p, target, baud, acn), ports))
+    elapsed = monotonic() - start
+    ok = 0
+    print('%-16s %-8s %-8s %6s  %s' %
+          ('Port', 'Firmware', 'Result', 'Time', 'Written'))
+    for r in results:
+        if r['result'] == 'ok':
+            ok += 1
+        detail = ','.join(r['written']) or '-'
+        if r['failed']:
+            detail += ' failed: ' + ','.join(r['failed'])
+        if r['skipped']:
+            detail += ' skipped: ' + ','.join(r['skipped'])
+        print('%-16s %-8s %-8s %5.1fs  %s' %
+              (r['port'], r['firmware'], r['result'], r['elapsed'], detail))
+    print('Provisioned %d/%d units in %0.1fs' % (ok, len(results), elapsed))
+    return 0 if ok == len(results) else 1
+
+
 class HHConfig:
     """TK Hay Hoist serial console utility"""
 
@@ -589,6 +1270,8 @@ class HHConfig:
                         self.devval[k] = self.devio.cfg[k]
             self.dbut.state(['!disabled'])
             self.ubut.state(['!disabled'])
+            if self.wearenabled:
+                self.wbut.state(['!disabled'])
             self.uiupdate()
         elif self.devio.connected():
             self.logvar.set('Reading hoist configuration...')
@@ -605,6 +1288,7 @@ class HHConfig:
             self.fwval.set('')
             self.dbut.state(['disabled'])
             self.ubut.state(['disabled'])
+            self.wbut.state(['disabled'])
 
     def checkversion(self, fwver):
         """Disable unavailable elements based on firmware"""
@@ -626,6 +1310,18 @@ class HHConfig:
         else:
             self.retryentry.state(['!disabled'])
             self.enabled['H-Retry'] = True
+        throttle = fvno >= _VER_THROTTLE
+        if not throttle:
+            _log.debug('Throttle entries disabled: %d < %d', fvno,
+                       _VER_THROTTLE)
+        for k in _THROTTLEKEYS:
+            self.throttleentry[k].state(
+                ['!disabled'] if throttle else ['disabled'])
+            self.enabled[k] = throttle
+        self.wearenabled = fvno >= _VER_WEAR
+        if not self.wearenabled:
+            _log.debug('Wear counters disabled: %d < %d', fvno, _VER_WEAR)
+            self.wbut.state(['disabled'])
 
     def devevent(self, data=None):
         """Extract and handle any pending events from the attached device"""
@@ -636,6 +1332,11 @@ class HHConfig:
 
             _log.debug('Serial event: %r', evt)
             if evt[0] == 'status':
+                # refresh an open wear chart after each return home
+                if self.wearwin is not None and evt[1].startswith(
+                        '[AT H]') and self.statvar.get().startswith(
+                            '[MOVE -H]'):
+                    self.devio.wear()
                 self.statvar.set(evt[1])
                 _log.debug('Received status: %s', evt[1])
             elif evt[0] == 'set':
@@ -655,6 +1356,8 @@ class HHConfig:
                 self.disconnect()
             elif evt[0] == 'message':
                 self.logvar.set(evt[1])
+            elif evt[0] == 'wear':
+                self.drawwear(evt[1])
             else:
                 _log.warning('Unknown serial event: %r', evt)
 
@@ -725,8 +1428,10 @@ class HHConfig:
         nv = self.uival[k].get()
         if nv:
             try:
-                t = max(round(float(nv) * 100), 1)
-                if t > 0 and t < 65536:
+                t = round(float(nv) * 100)
+                if k not in _ZEROKEYS:
+                    t = max(t, 1)
+                if t >= 0 and t < 65536:
                     v = t
                     fv = '%0.2f' % (v / 100.0, )
             except Exception:
@@ -855,6 +1560,84 @@ class HHConfig:
         """Request up trigger"""
         self.devio.up()
 
+    def showwear(self, data=None):
+        """Open the wear chart and request counters"""
+        if self.wearwin is None:
+            self.wearwin = Toplevel(self.window)
+            self.wearwin.title('Hoist Wear')
+            self.wearwin.protocol('WM_DELETE_WINDOW', self.closewear)
+            self.wearchart = Canvas(self.wearwin,
+                                    width=_CHARTW,
+                                    height=_CHARTH,
+                                    background='white')
+            self.wearchart.grid(column=0, row=0, padx=6, pady=4)
+            self.wearvar = StringVar(value='Reading wear counters...')
+            ttk.Label(self.wearwin,
+                      textvariable=self.wearvar,
+                      font='TkFixedFont').grid(column=0,
+                                               row=1,
+                                               padx=6,
+                                               pady=4,
+                                               sticky=(W, ))
+        self.devio.wear()
+
+    def closewear(self):
+        """Close the wear chart"""
+        self.wearwin.destroy()
+        self.wearwin = None
+
+    def drawwear(self, wear):
+        """Chart return home times oldest first, with min, mean and max"""
+        if self.wearwin is None:
+            return
+        c = self.wearchart
+        c.delete('all')
+        returns = [r / 100.0 for r in wear.get('Returns', []) if r]
+        # scale to the spread of returns, so a slow drift stands out
+        low = min(returns) * 0.9 if returns else 0.0
+        top = max(returns) * 1.1 if returns else 1.0
+        left = 40
+        bottom = _CHARTH - 20
+        height = bottom - 10
+
+        def ypos(v):
+            return bottom - height * (v - low) / (top - low)
+
+        c.create_line(left, 10, left, bottom, _CHARTW - 10,
+                      bottom)
+        c.create_text(left - 4, ypos(top), text='%0.0fs' % (top, ), anchor=E)
+        c.create_text(left - 4, bottom, text='%0.0fs' % (low, ), anchor=E)
+        c.create_text(_CHARTW // 2,
+                      _CHARTH - 8,
+                      text='Return home, oldest first')
+        if returns:
+            step = (_CHARTW - left - 20) / max(1, len(returns) - 1)
+            points = []
+            for i, r in enumerate(returns):
+                points.extend((left + 10 + i * step, ypos(r)))
+                c.create_oval(points[-2] - 3, points[-1] - 3, points[-2] + 3,
+                              points[-1] + 3)
+            if len(points) > 2:
+                c.create_line(*points)
+            for k, dash in (('Min', (2, 2)), ('Mean', ()), ('Max', (2, 2))):
+                v = wear.get(k, 0) / 100.0
+                c.create_line(left, ypos(v), _CHARTW - 10, ypos(v),
+                              fill='grey', dash=dash)
+                c.create_text(_CHARTW - 12,
+                              ypos(v) - 6,
+                              text='%s %0.2fs' % (k, v),
+                              anchor=E,
+                              fill='grey')
+        lines = [
+            'Lifts: %d  Down: %ds  Up: %ds' %
+            (wear.get('Lifts', 0), wear.get('Down', 0), wear.get('Up', 0)),
+            'Errors: ' + ', '.join('%s %d' % (k, wear.get(k, 0))
+                                   for k in _WEARERRORS),
+            'Resets: ' + ', '.join('%s %d' % (k, wear.get(k, 0))
+                                   for k in _WEARRESETS),
+        ]
+        self.wearvar.set('\n'.join(lines))
+
     def loadvalues(self, cfg):
         """Update each value in cfg to device and ui"""
         doupdate = False
@@ -951,6 +1734,8 @@ class HHConfig:
         self.devio.cb = self.devcallback
         self.devio.setacn(self.acn)
         self._devpollcnt = 0
+        self.wearenabled = False
+        self.wearwin = None
         window.title('Hay Hoist Config')
         row = 0
         frame = ttk.Frame(window, padding="0 0 0 0")
@@ -1073,6 +1858,23 @@ class HHConfig:
                                                 self.uiupdate, self.setHelp,
                                                 _HELP_FEEDWEEK)
         row += 1
+        self.throttleentry = {}
+        self.uival['Accel'], self.throttleentry['Accel'] = _mkopt(
+            frame, "Accel:", "seconds", row, check_cent_wrapper,
+            self.uiupdate, self.setHelp, _HELP_ACCEL)
+        row += 1
+        self.uival['Decel'], self.throttleentry['Decel'] = _mkopt(
+            frame, "Decel:", "seconds", row, check_cent_wrapper,
+            self.uiupdate, self.setHelp, _HELP_DECEL)
+        row += 1
+        self.uival['Approach'], self.throttleentry['Approach'] = _mkopt(
+            frame, "Approach:", "seconds", row, check_cent_wrapper,
+            self.uiupdate, self.setHelp, _HELP_APPROACH)
+        row += 1
+        self.uival['Slow'], self.throttleentry['Slow'] = _mkopt(
+            frame, "Slow:", "% (max 100)", row, check_int_wrapper,
+            self.uiupdate, self.setHelp, _HELP_SLOW)
+        row += 1
 
         # firmware version label
         ttk.Label(frame, text='Firmware:').grid(column=0,
@@ -1166,6 +1968,16 @@ class HHConfig:
         sbut.bind('<Enter>',
                   lambda event, text=_HELP_SAVE: self.setHelp(text),
                   add='+')
+        aframe.columnconfigure(4, weight=1)
+        self.wbut = ttk.Button(aframe, text='Wear', command=self.showwear)
+        self.wbut.grid(column=4, row=0, sticky=(
+            E,
+            W,
+        ))
+        self.wbut.state(['disabled'])
+        self.wbut.bind('<Enter>',
+                       lambda event, text=_HELP_WEAR: self.setHelp(text),
+                       add='+')
         row += 1
 
         # status label
@@ -1193,14 +2005,48 @@ class HHConfig:
 
 def main():
     logging.basicConfig()
-    if len(sys.argv) > 1 and '-v' in sys.argv[1:]:
+    p = argparse.ArgumentParser(description='Hay Hoist config tool')
+    p.add_argument('-v', '--verbose', action='store_true')
+    p.add_argument('--upload', metavar='HEX', help='update firmware')
+    p.add_argument('--port', help='serial port for --upload')
+    p.add_argument('--acn', type=int, default=0, help='console access code')
+    p.add_argument('--baud', type=int, default=_BAUDRATE)
+    p.add_argument('--provision',
+                   metavar='CONFIG',
+                   help='write saved config to each port')
+    p.add_argument('--record',
+                   metavar='LOG',
+                   help='append console output to telemetry log')
+    p.add_argument('ports', nargs='*', help='serial ports for --provision')
+    args = p.parse_args()
+    if args.verbose:
         _log.setLevel(logging.DEBUG)
         _log.debug('Enabled debug logging')
+    if args.upload:
+        if not args.port:
+            p.error('--upload requires --port')
+        try:
+            return upload(args.upload, args.port, args.baud, args.acn)
+        except Exception as e:
+            print('Upload failed: %s' % (e, ))
+            return 1
+    if args.provision:
+        if not args.ports:
+            p.error('--provision requires one or more ports')
+        try:
+            return provision(args.provision, args.ports, args.baud, args.acn)
+        except Exception as e:
+            print('Provision failed: %s' % (e, ))
+            return 1
     sio = SerialConsole()
+    if args.record:
+        sio.record(args.record)
     sio.start()
     win = Tk()
     app = HHConfig(window=win, devio=sio)
     win.mainloop()
+    if sio.recorder is not None:
+        sio.recorder.close()
     return 0
 
 